@@ -60,7 +60,7 @@ Window {
                                 return
                             }
                             var ok = glCanvas.saveOraAllLayers("file:///" + lastOraPath.replace(/\\/g,"/"))
-                            console.log(ok ? "Saved ALL layers ORA:" : "Failed multi-layer save", lastOraPath)
+                            console.log(ok ? "Saving ALL layers ORA:" : "Failed multi-layer save", lastOraPath)
                         }
                     }
                     MenuItem {
@@ -75,6 +75,7 @@ Window {
                         text: "Save All Layers As..."
                         onTriggered: saveAllLayersDialog.open()
                     }
+                    MenuItem { text: "Include Merged Image"; checkable: true; checked: glCanvas.saveMergedImage; onTriggered: glCanvas.saveMergedImage = checked }
                     MenuSeparator {}
                     MenuItem { text: "Export..." }
                     MenuItem { text: "Close" }
@@ -83,10 +84,14 @@ Window {
                 Menu { title: "Edit"
                     MenuItem {
                         text: "Undo"
-                        onTriggered: glCanvas.undoLastStroke()
-                        enabled: glCanvas.strokeCount > 0
+                        onTriggered: glCanvas.undo()
+                        enabled: glCanvas.canUndo
+                    }
+                    MenuItem {
+                        text: "Redo"
+                        onTriggered: glCanvas.redo()
+                        enabled: glCanvas.canRedo
                     }
-                    MenuItem { text: "Redo" }
                     MenuSeparator {}
                     MenuItem { text: "Cut" }
                     MenuItem { text: "Copy" }
@@ -100,9 +105,13 @@ Window {
                 }
 
                 Menu { title: "View"
-                    MenuItem { text: "Zoom In" }
-                    MenuItem { text: "Zoom Out" }
-                    MenuItem { text: "Reset Zoom" }
+                    MenuItem { text: "Zoom In"; onTriggered: glCanvas.zoomBy(1.25) }
+                    MenuItem { text: "Zoom Out"; onTriggered: glCanvas.zoomBy(0.8) }
+                    MenuItem { text: "Reset Zoom"; onTriggered: glCanvas.resetZoom() }
+                    MenuItem { text: "Fit to Window"; onTriggered: glCanvas.fitToView() }
+                    MenuSeparator {}
+                    MenuItem { text: "GPU Painting"; checkable: true; checked: glCanvas.gpuPainting; onTriggered: glCanvas.gpuPainting = checked }
+                    MenuItem { text: "Stroke Prediction"; checkable: true; checked: glCanvas.strokePrediction; onTriggered: glCanvas.strokePrediction = checked }
                 }
 
                 Menu { title: "Image"
@@ -195,13 +204,28 @@ Window {
 
                     Rectangle { width: 1; height: 24; color: uiBorder; anchors.verticalCenter: parent.verticalCenter }
 
-                    Button { id: undoBtn; text: "Undo"; enabled: glCanvas.strokeCount > 0; onClicked: glCanvas.undoLastStroke(); }
+                    Button { id: undoBtn; text: "Undo"; enabled: glCanvas.canUndo; onClicked: glCanvas.undo(); }
+
+                    Button { id: redoBtn; text: "Redo"; enabled: glCanvas.canRedo; onClicked: glCanvas.redo(); }
 
                     Button { id: clearBtn; text: "Clear"; enabled: glCanvas.strokeCount > 0; onClicked: glCanvas.clearAllStrokes() }
 
                     Rectangle { width: 1; height: 24; color: uiBorder; anchors.verticalCenter: parent.verticalCenter }
                     Text { text: "Strokes: " + glCanvas.strokeCount; color: uiSubText; font.pixelSize: 12; verticalAlignment: Text.AlignVCenter }
                     Text { text: "Layers: " + glCanvas.layerCount + " • Active: " + (glCanvas.activeLayerIndex >=0 ? glCanvas.activeLayerIndex+1 : "-"); color: uiSubText; font.pixelSize: 12; verticalAlignment: Text.AlignVCenter }
+                    Text { text: "FPS: " + Math.round(glCanvas.framesPerSecond); color: uiSubText; font.pixelSize: 12; verticalAlignment: Text.AlignVCenter }
+                    Text { text: "Upload: " + glCanvas.uploadMilliseconds.toFixed(2) + " ms"; color: uiSubText; font.pixelSize: 12; verticalAlignment: Text.AlignVCenter }
+                    Text { text: "Zoom: " + Math.round(glCanvas.zoom * 100) + "%"; color: uiSubText; font.pixelSize: 12; verticalAlignment: Text.AlignVCenter }
+
+                    // Background save in progress
+                    Row {
+                        visible: glCanvas.saving
+                        spacing: 6
+                        anchors.verticalCenter: parent.verticalCenter
+                        Text { text: "Saving"; color: uiSubText; font.pixelSize: 12; anchors.verticalCenter: parent.verticalCenter }
+                        ProgressBar { id: saveProgressBar; width: 120; from: 0; to: 1; anchors.verticalCenter: parent.verticalCenter }
+                        Button { text: "Cancel"; onClicked: glCanvas.cancelSave() }
+                    }
                 }
             }
 
@@ -271,7 +295,15 @@ Window {
                             }
                         }
 
-                        Row { id: footerRow; spacing: 6; height: 28; Button { text: "Remove"; enabled: glCanvas.layerCount > 1; onClicked: glCanvas.removeLayer(glCanvas.activeLayerIndex) } }
+                        Row { id: footerRow; spacing: 6; height: 28; Button { text: "Remove"; enabled: glCanvas.layerCount > 1; onClicked: glCanvas.removeLayer(glCanvas.activeLayerIndex) }
+                            Slider {
+                                width: 90; from: 0; to: 1
+                                enabled: glCanvas.activeLayerIndex >= 0
+                                value: glCanvas.activeLayerIndex >= 0 ? glCanvas.layers[glCanvas.activeLayerIndex].opacity : 1
+                                onMoved: glCanvas.layers[glCanvas.activeLayerIndex].opacity = value
+                                ToolTip.visible: hovered; ToolTip.text: "Layer opacity"
+                            }
+                        }
                     }
                 }
 
@@ -280,14 +312,18 @@ Window {
                     id: drawingArea
                     anchors.top: parent.top
                     anchors.bottom: parent.bottom
-                    width: Math.min(parent.width - layerSidebar.width - 40, canvasWindow.initialWidth)
-                    height: Math.min(parent.height - topMenuBar.height - 40, canvasWindow.initialHeight)
+                    // The canvas is a view onto the document, so it takes all remaining space
+                    width: parent.width - layerSidebar.width - parent.spacing
                     color: uiPanel
                     border.color: uiBorder
                     border.width: 1
                     Canvas {
                         id: glCanvas
                         anchors.fill: parent
+                        anchors.margins: 1
+                        clip: true
+                        // New documents get the requested size; opened images and ORA layers set their own
+                        documentSize: Qt.size(canvasWindow.initialWidth, canvasWindow.initialHeight)
                         brushColor: "black"
                         brushSize: 5
                         z: 1
@@ -336,7 +372,7 @@ Window {
             if (!localPath.toLowerCase().endsWith(".ora")) localPath += ".ora"
             lastOraPath = localPath
             var ok = glCanvas.saveOraAllLayers("file:///" + localPath.replace(/\\/g,"/"))
-            console.log(ok ? "Saved ALL layers ORA:" : "Failed ALL layers ORA", localPath)
+            console.log(ok ? "Saving ALL layers ORA:" : "Failed ALL layers ORA", localPath)
         }
     }
 
@@ -351,7 +387,17 @@ Window {
             if (!localPath.toLowerCase().endsWith(".ora")) localPath += ".ora"
             lastOraPath = localPath
             var ok = glCanvas.saveOraStrokesOnly("file:///" + localPath.replace(/\\/g,"/"))
-            console.log(ok ? "Saved strokes-only ORA:" : "Failed save strokes-only ORA", localPath)
+            console.log(ok ? "Saving strokes-only ORA:" : "Failed save strokes-only ORA", localPath)
+        }
+    }
+
+    // Saves run in the background; the outcome arrives here
+    Connections {
+        target: glCanvas
+        function onSaveProgress(fraction) { saveProgressBar.value = fraction }
+        function onSaveFinished(ok, destinationUrl) {
+            saveProgressBar.value = 0
+            console.log(ok ? "Saved ORA:" : "Save failed or cancelled:", destinationUrl)
         }
     }
 }
@@ -3,6 +3,7 @@
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QSaveFile>
 #include <QImage>
 #include <QTextStream>
 #include <QTemporaryDir>
@@ -12,6 +13,10 @@
 #include <QDebug>
 #include <QUrl>
 #include <QPainter>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentMap>
+#include <atomic>
 #include <utility>
 #include <utility> // std::as_const
 
@@ -159,11 +164,11 @@ public:
             << centralDirSize
             << centralDirOffset
             << quint16(0); // comment len
-        f.close();
-        return true;
+        // Replaces the destination only now; an abandoned writer leaves it untouched
+        return f.commit();
     }
 private:
-    QFile f;
+    QSaveFile f;
     QVector<ZipEntryMeta> entries;
 };
 
@@ -212,7 +217,10 @@ bool OraCreator::createOra(const QString &destinationPath, int width, int height
     {
         QBuffer buf(&thumbPng);
         buf.open(QIODevice::WriteOnly);
-        thumb.save(&buf, "PNG");
+        if (!thumb.save(&buf, "PNG")) {
+            qWarning() << "Failed to encode thumbnail PNG";
+            return false;
+        }
     }
 
     // stack.xml (single empty background layer). Use spec attribute names: visibility.
@@ -311,7 +319,10 @@ bool OraCreator::saveOra(const QString &destinationPath, const QImage &layerImg)
     {
         QBuffer buf(&thumbPng);
         buf.open(QIODevice::WriteOnly);
-        thumb.save(&buf, "PNG");
+        if (!thumb.save(&buf, "PNG")) {
+            qWarning() << "saveOra: failed encode thumbnail PNG";
+            return false;
+        }
     }
 
     // stack.xml (single layer) - use visibility attribute
@@ -353,12 +364,23 @@ bool OraCreator::saveOraMulti(const QString &destinationPath,
                               const QList<QImage> &layerImages,
                               const QStringList &layerNames,
                               const QList<bool> &visibilityFlags)
+{
+    return saveOraMulti(destinationPath, layerImages, layerNames, visibilityFlags, QList<qreal>(), Progress());
+}
+
+bool OraCreator::saveOraMulti(const QString &destinationPath,
+                              const QList<QImage> &layerImages,
+                              const QStringList &layerNames,
+                              const QList<bool> &visibilityFlags,
+                              const QList<qreal> &opacities,
+                              const Progress &progress)
 {
     if (layerImages.isEmpty()) {
         qWarning() << "saveOraMulti: no layers provided";
         return false;
     }
-    if (layerImages.size() != layerNames.size() || layerImages.size() != visibilityFlags.size()) {
+    if (layerImages.size() != layerNames.size() || layerImages.size() != visibilityFlags.size()
+        || (!opacities.isEmpty() && layerImages.size() != opacities.size())) {
         qWarning() << "saveOraMulti: size mismatch";
         return false;
     }
@@ -371,53 +393,93 @@ bool OraCreator::saveOraMulti(const QString &destinationPath,
             return false;
         }
     }
+    if (!m_mergedImage.isNull() && m_mergedImage.size() != QSize(w, h)) {
+        qWarning() << "saveOraMulti: merged image size mismatch";
+        return false;
+    }
 
-    // Prepare PNG data for each layer
-    struct LayerData { QByteArray png; QString name; bool visible; int index; };
-    QVector<LayerData> data;
-    data.reserve(layerImages.size());
+    // Every PNG is independent of the others, so they are encoded on the global thread
+    // pool: one task per layer, plus one for the merged image and the thumbnail (listed
+    // first, since it takes longest). The archive is still written in a fixed order below.
+    struct LayerData { QByteArray png; QString name; bool visible; qreal opacity; int index; };
+    QVector<LayerData> data(layerImages.size());
     const int layerCount = layerImages.size();
-    // Input is assumed TOP-FIRST (first element is top layer). We will number files top-first as well
-    // (layer0.png is top) to reduce ambiguity when inspecting archive manually.
-    for (int i = 0; i < layerCount; ++i) {
-        QByteArray png;
+    QByteArray mergedPng;
+    QByteArray thumbPng;
+    std::atomic<bool> stop{false}; // encoding failed or the caller cancelled
+    auto encodePng = [](const QImage &img, QByteArray &png) {
         QBuffer buf(&png);
         buf.open(QIODevice::WriteOnly);
-        if (!layerImages[i].save(&buf, "PNG")) {
-            qWarning() << "saveOraMulti: failed to encode layer" << i;
-            return false;
+        return img.save(&buf, "PNG");
+    };
+    QList<int> tasks{-1};
+    for (int i = 0; i < layerCount; ++i) tasks.append(i);
+    LayerData *layers = data.data(); // detached once, here: tasks fill disjoint entries
+    auto encodeTask = [&](int task) {
+        if (stop) return;
+        if (task < 0) {
+            QImage composite = m_mergedImage;
+            if (composite.isNull()) {
+                // Composite from all visible layers at their opacity (simple painter blend)
+                composite = QImage(w, h, QImage::Format_RGBA8888);
+                composite.fill(Qt::transparent);
+                QPainter p(&composite);
+                // Bottom-most layer is last in list (since first is top). Paint reverse order.
+                for (int i = layerCount - 1; i >= 0; --i) {
+                    if (!visibilityFlags[i]) continue;
+                    p.setOpacity(opacities.value(i, 1.0));
+                    p.drawImage(0, 0, layerImages[i]);
+                }
+                p.end();
+            }
+            if (m_writeMergedImage && !encodePng(composite, mergedPng)) {
+                qWarning() << "saveOraMulti: failed to encode merged image";
+                stop = true;
+                return;
+            }
+            // Scale thumbnail down to <=256
+            const int thumbMax = 256;
+            QImage thumb = composite;
+            if (thumb.width() > thumbMax || thumb.height() > thumbMax) {
+                thumb = thumb.scaled(thumbMax, thumbMax, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+            }
+            if (!encodePng(thumb, thumbPng)) {
+                qWarning() << "saveOraMulti: failed to encode thumbnail";
+                stop = true;
+            }
+            return;
         }
-        int fileIndex = i; // top-first numbering: 0 is top layer
-        data.push_back({png,
-                        layerNames[i].isEmpty() ? QString("Layer %1").arg(fileIndex) : layerNames[i],
-                        visibilityFlags[i],
-                        fileIndex});
-    }
-
-    // Composite thumbnail from all visible layers (simple painter blend)
-    QImage composite(w, h, QImage::Format_RGBA8888);
-    composite.fill(Qt::transparent);
-    {
-        QPainter p(&composite);
-        // Bottom-most layer is last in list (since first is top). Paint reverse order.
-        for (int i = data.size() - 1; i >= 0; --i) {
-            if (!data[i].visible) continue;
-            p.drawImage(0, 0, layerImages[i]);
+        // Input is assumed TOP-FIRST (first element is top layer). We will number files top-first as well
+        // (layer0.png is top) to reduce ambiguity when inspecting archive manually.
+        const int fileIndex = task; // top-first numbering: 0 is top layer
+        LayerData &ld = layers[task];
+        if (!encodePng(layerImages[task], ld.png)) {
+            qWarning() << "saveOraMulti: failed to encode layer" << task;
+            stop = true;
+            return;
         }
-        p.end();
-    }
-    // Scale thumbnail down to <=256
-    const int thumbMax = 256;
-    QImage thumb = composite;
-    if (thumb.width() > thumbMax || thumb.height() > thumbMax) {
-        thumb = thumb.scaled(thumbMax, thumbMax, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-    }
-    QByteArray thumbPng;
-    {
-        QBuffer buf(&thumbPng);
-        buf.open(QIODevice::WriteOnly);
-        thumb.save(&buf, "PNG");
-    }
+        ld.name = layerNames[task].isEmpty() ? QString("Layer %1").arg(fileIndex) : layerNames[task];
+        ld.visible = visibilityFlags[task];
+        ld.opacity = qBound(0.0, opacities.value(task, 1.0), 1.0);
+        ld.index = fileIndex;
+    };
+    QSemaphore finishedTasks;
+    QThreadPool *pool = QThreadPool::globalInstance();
+    QFuture<void> work = QtConcurrent::map(pool, tasks, [&](const int &task) {
+        encodeTask(task);
+        finishedTasks.release();
+    });
+    // Progress is reported here, as tasks finish. This thread only waits meanwhile, so
+    // the pool may run another one in its place.
+    const int steps = int(tasks.size()) + 1;
+    pool->releaseThread();
+    for (int done = 1; done <= tasks.size(); ++done) {
+        finishedTasks.acquire();
+        if (progress && !stop && !progress(done, steps)) stop = true;
+    }
+    pool->reserveThread();
+    work.waitForFinished();
+    if (stop) return false; // nothing written
 
     // Build stack.xml (top-most layer first per spec). We number files layer0.png=top.
     QByteArray stackXml;
@@ -430,7 +492,7 @@ bool OraCreator::saveOraMulti(const QString &destinationPath,
         for (int i = 0; i < data.size(); ++i) { // i=0 is top layer
             const LayerData &ld = data[i];
             out << "    <layer name=\"" << ld.name << "\" src=\"data/layer" << ld.index
-                << ".png\" x=\"0\" y=\"0\" opacity=\"1.0\" visibility=\""
+                << ".png\" x=\"0\" y=\"0\" opacity=\"" << QString::number(ld.opacity, 'f', 3) << "\" visibility=\""
                 << (ld.visible ? "visible" : "hidden") << "\" composite-op=\"svg:src-over\"/>\n"; // spec-compliant visibility values
         }
         out << "  </stack>\n";
@@ -448,7 +510,10 @@ bool OraCreator::saveOraMulti(const QString &destinationPath,
         const QString fileName = QString("data/layer%1.png").arg(ld.index);
         if (!zip.add(fileName, ld.png)) return false;
     }
+    if (m_writeMergedImage && !zip.add(QStringLiteral("mergedimage.png"), mergedPng)) return false;
     if (!zip.add(QStringLiteral("Thumbnails/thumbnail.png"), thumbPng)) return false;
+    // Last chance to cancel: the destination is only replaced by close()
+    if (progress && !progress(steps, steps)) return false;
     if (!zip.close()) return false;
     qWarning() << "saveOraMulti: wrote" << destinationPath << "with" << data.size() << "layers";
     return true;
@@ -458,9 +523,19 @@ bool OraCreator::saveOraMulti(const QUrl &destinationUrl,
                               const QList<QImage> &layerImages,
                               const QStringList &layerNames,
                               const QList<bool> &visibilityFlags)
+{
+    return saveOraMulti(destinationUrl, layerImages, layerNames, visibilityFlags, QList<qreal>(), Progress());
+}
+
+bool OraCreator::saveOraMulti(const QUrl &destinationUrl,
+                              const QList<QImage> &layerImages,
+                              const QStringList &layerNames,
+                              const QList<bool> &visibilityFlags,
+                              const QList<qreal> &opacities,
+                              const Progress &progress)
 {
     if (!destinationUrl.isValid()) return false;
     QString local = destinationUrl.isLocalFile() ? destinationUrl.toLocalFile() : destinationUrl.toString();
     if (!local.endsWith(".ora", Qt::CaseInsensitive)) local += ".ora";
-    return saveOraMulti(local, layerImages, layerNames, visibilityFlags);
+    return saveOraMulti(local, layerImages, layerNames, visibilityFlags, opacities, progress);
 }
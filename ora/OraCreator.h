@@ -5,6 +5,7 @@
 #include <QImage>
 #include <QList>
 #include <QStringList>
+#include <functional>
 
 class OraCreator : public QObject
 {
@@ -15,6 +16,15 @@ public:
     // Create a minimal .ora file at destinationPath with an empty layer of given size.
     Q_INVOKABLE bool createOra(const QString &destinationPath, int width = 100, int height = 100);
 
+    // Whether saveOraMulti also stores mergedimage.png, the flattened visible layers
+    // (required by OpenRaster 0.0.5; readers use it as a preview). On by default.
+    void setWriteMergedImage(bool enabled) { m_writeMergedImage = enabled; }
+    bool writeMergedImage() const { return m_writeMergedImage; }
+    // The flattened image saveOraMulti stores as mergedimage.png and scales for the
+    // thumbnail, when the caller has rendered it already. It must have the layers' size.
+    // Without one, the visible layers are composited here with QPainter.
+    void setMergedImage(const QImage &image) { m_mergedImage = image; }
+
     // Overload for QML 'url' type; converts URL to local file path and delegates.
     Q_INVOKABLE bool createOra(const QUrl &destinationUrl, int width, int height);
 
@@ -24,7 +34,9 @@ public:
 
     // Save an ORA with multiple layers. The first image in layerImages is the top layer.
     // layerNames (same size) provides names; visibility flags indicate if layer is visible.
-    // All layers are positioned at (0,0) with full opacity for now.
+    // All layers are positioned at (0,0); these overloads write them at full opacity.
+    // The layer PNGs, the merged image and the thumbnail are encoded in parallel on
+    // the global thread pool; the archive entries are always written in the same order.
     Q_INVOKABLE bool saveOraMulti(const QString &destinationPath,
                                   const QList<QImage> &layerImages,
                                   const QStringList &layerNames,
@@ -33,4 +45,28 @@ public:
                                   const QList<QImage> &layerImages,
                                   const QStringList &layerNames,
                                   const QList<bool> &visibilityFlags);
+
+    // Called on the calling thread with (steps done, total steps): one step per layer
+    // encoded, one for the merged image and thumbnail, and a last one just before the
+    // archive replaces the destination. Returning false abandons the save; the
+    // destination is left as it was.
+    // `opacities` (0..1, same size as the layers, or empty for all 1.0) are written to
+    // stack.xml and applied when compositing the merged image and thumbnail.
+    using Progress = std::function<bool(int done, int total)>;
+    bool saveOraMulti(const QString &destinationPath,
+                      const QList<QImage> &layerImages,
+                      const QStringList &layerNames,
+                      const QList<bool> &visibilityFlags,
+                      const QList<qreal> &opacities,
+                      const Progress &progress);
+    bool saveOraMulti(const QUrl &destinationUrl,
+                      const QList<QImage> &layerImages,
+                      const QStringList &layerNames,
+                      const QList<bool> &visibilityFlags,
+                      const QList<qreal> &opacities,
+                      const Progress &progress);
+
+private:
+    bool m_writeMergedImage = true;
+    QImage m_mergedImage;
 };
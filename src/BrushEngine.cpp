@@ -1,8 +1,246 @@
 #include "BrushEngine.h"
+#include "PointCodec.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <utility>
 
+namespace {
+// Monotonic stroke id source shared by all engines (GUI thread only)
+quint64 g_nextStrokeId = 1;
+}
+
+StrokeList::Encoding StrokeList::defaultEncoding() {
+    static const Encoding encoding = [] {
+        const char *env = std::getenv("TRAHERE_POINT_ENCODING");
+        return env && std::strcmp(env, "delta") == 0 ? Encoding::Delta : Encoding::Float;
+    }();
+    return encoding;
+}
+
+template <typename T>
+T *StrokeList::Arena<T>::reserve(quint32 count, quint32 &block, quint32 &offset) {
+    if (m_blocks.isEmpty() || m_blocks.last()->capacity - m_blocks.last()->used < count) {
+        // Very long strokes get a block of their own
+        const quint32 grown = m_blocks.isEmpty() ? m_minBlock : std::min(m_blocks.last()->capacity * 2, m_maxBlock);
+        auto b = std::make_shared<Block>();
+        b->capacity = std::max(grown, count);
+        b->data.reset(new T[b->capacity]);
+        m_blocks.append(std::move(b));
+    }
+    block = quint32(m_blocks.size() - 1);
+    offset = m_blocks.last()->used;
+    return m_blocks.last()->data.get() + offset;
+}
+
+template <typename T>
+qint64 StrokeList::Arena<T>::bytes() const {
+    qint64 bytes = 0;
+    for (const auto &b : m_blocks) bytes += qint64(b->capacity) * qint64(sizeof(T));
+    return bytes;
+}
+
+StrokeView StrokeList::at(int index) const {
+    const Record &r = record(index);
+    const StrokeStyle &style = m_styles.at(int(r.style));
+    StrokeView view;
+    view.color = QColor::fromRgba(style.color);
+    view.size = style.size;
+    view.id = r.id;
+    if (m_encoding == Encoding::Delta) {
+        // Only grows, so decoding strokes one after another does not allocate
+        thread_local QList<QVector2D> decoded;
+        if (decoded.size() < qsizetype(r.count)) decoded.resize(qsizetype(r.count));
+        PointCodec::decode(m_codes.data(r.block, r.offset), int(r.count), decoded.data());
+        view.points = PointSpan(decoded.constData(), int(r.count));
+    } else {
+        view.points = PointSpan(m_points.data(r.block, r.offset), int(r.count));
+    }
+    return view;
+}
+
+int StrokeList::indexOf(quint64 id) const {
+    int lo = 0, hi = m_size;
+    while (lo < hi) {
+        const int mid = lo + (hi - lo) / 2;
+        if (idAt(mid) < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < m_size && idAt(lo) == id ? lo : -1;
+}
+
+qint64 StrokeList::arenaBytes() const {
+    return m_points.bytes() + m_codes.bytes();
+}
+
+void StrokeList::store(const QVector2D *points, int count, Record &r) {
+    if (m_encoding == Encoding::Delta) {
+        quint8 *out = m_codes.reserve(quint32(count) * PointCodec::MaxBytesPerPoint, r.block, r.offset);
+        m_codes.commit(quint32(PointCodec::encode(points, count, out)));
+    } else {
+        std::copy(points, points + count, m_points.reserve(quint32(count), r.block, r.offset));
+        m_points.commit(quint32(count));
+    }
+}
+
+quint32 StrokeList::styleId(const QColor &color, float size) {
+    const StrokeStyle style{color.rgba(), size};
+    const auto it = m_styleIds.constFind(style);
+    if (it != m_styleIds.constEnd()) return it.value();
+    const quint32 id = quint32(m_styles.size());
+    m_styles.append(style);
+    m_styleIds.insert(style, id);
+    return id;
+}
+
+void StrokeList::append(const BrushStroke &stroke) {
+    Record r;
+    r.id = stroke.id;
+    r.count = quint32(stroke.points.size());
+    r.style = styleId(stroke.color, stroke.size);
+    store(stroke.points.constData(), int(stroke.points.size()), r);
+    appendRecord(r);
+}
+
+void StrokeList::appendRecord(const Record &r) {
+    m_livePoints += r.count;
+    if (m_size % ChunkSize == 0) {
+        auto chunk = std::make_shared<Chunk>();
+        chunk->reserve(ChunkSize);
+        chunk->append(r);
+        m_chunks.append(std::move(chunk));
+    } else {
+        // Chunks may be shared with snapshots, so the tail chunk is copied, not modified
+        auto chunk = std::make_shared<Chunk>(*m_chunks.last());
+        chunk->append(r);
+        m_chunks.last() = std::move(chunk);
+    }
+    ++m_size;
+}
+
+void StrokeList::releasePoints(const Record &r) {
+    m_livePoints -= r.count;
+    m_deadPoints += r.count;
+}
+
+void StrokeList::removeLast() {
+    if (m_size == 0) return;
+    releasePoints(record(m_size - 1));
+    if (m_chunks.last()->size() == 1) {
+        m_chunks.removeLast();
+    } else {
+        auto chunk = std::make_shared<Chunk>(*m_chunks.last());
+        chunk->removeLast();
+        m_chunks.last() = std::move(chunk);
+    }
+    --m_size;
+    compact();
+}
+
+void StrokeList::removeAt(int index) {
+    if (index < 0 || index >= m_size) return;
+    if (index == m_size - 1) { removeLast(); return; }
+    releasePoints(record(index));
+    // Chunks before the removed stroke stay shared; the rest are rebuilt shifted by one
+    const int firstChunk = index / ChunkSize;
+    QList<std::shared_ptr<const Chunk>> chunks = m_chunks.mid(0, firstChunk);
+    Chunk current;
+    for (int i = firstChunk * ChunkSize; i < m_size; ++i) {
+        if (i == index) continue;
+        current.append(record(i));
+        if (current.size() == ChunkSize) {
+            chunks.append(std::make_shared<const Chunk>(std::move(current)));
+            current = Chunk();
+        }
+    }
+    if (!current.isEmpty()) chunks.append(std::make_shared<const Chunk>(std::move(current)));
+    m_chunks = std::move(chunks);
+    --m_size;
+    compact();
+}
+
+void StrokeList::insert(int index, const BrushStroke &stroke) {
+    if (index < 0 || index > m_size) return;
+    if (index == m_size) { append(stroke); return; }
+    Record r;
+    r.id = stroke.id;
+    r.count = quint32(stroke.points.size());
+    r.style = styleId(stroke.color, stroke.size);
+    store(stroke.points.constData(), int(stroke.points.size()), r);
+    m_livePoints += r.count;
+    // As in removeAt(): chunks before the insertion point stay shared
+    const int firstChunk = index / ChunkSize;
+    QList<std::shared_ptr<const Chunk>> chunks = m_chunks.mid(0, firstChunk);
+    Chunk current;
+    for (int i = firstChunk * ChunkSize; i <= m_size; ++i) {
+        current.append(i == index ? r : record(i < index ? i : i - 1));
+        if (current.size() == ChunkSize) {
+            chunks.append(std::make_shared<const Chunk>(std::move(current)));
+            current = Chunk();
+        }
+    }
+    if (!current.isEmpty()) chunks.append(std::make_shared<const Chunk>(std::move(current)));
+    m_chunks = std::move(chunks);
+    ++m_size;
+}
+
+void StrokeList::removeFirst(int count) {
+    count = std::min(count, m_size);
+    if (count <= 0) return;
+    if (count == m_size) { clear(); return; }
+    QList<std::shared_ptr<const Chunk>> chunks;
+    Chunk current;
+    for (int i = 0; i < m_size; ++i) {
+        if (i < count) { releasePoints(record(i)); continue; }
+        current.append(record(i));
+        if (current.size() == ChunkSize) {
+            chunks.append(std::make_shared<const Chunk>(std::move(current)));
+            current = Chunk();
+        }
+    }
+    if (!current.isEmpty()) chunks.append(std::make_shared<const Chunk>(std::move(current)));
+    m_chunks = std::move(chunks);
+    m_size -= count;
+    compact();
+}
+
+void StrokeList::compact() {
+    if (m_deadPoints <= m_livePoints || m_deadPoints < MaxBlockPoints) return;
+    rebuild(m_encoding);
+}
+
+void StrokeList::setEncoding(Encoding encoding) {
+    if (encoding != m_encoding) rebuild(encoding);
+}
+
+void StrokeList::rebuild(Encoding encoding) {
+    // Copy the live strokes into fresh blocks; copies of the list keep the old blocks
+    StrokeList fresh;
+    fresh.m_encoding = encoding;
+    fresh.m_styles = m_styles;
+    fresh.m_styleIds = m_styleIds;
+    for (int i = 0; i < m_size; ++i) {
+        Record r = record(i);
+        const StrokeView view = at(i);
+        fresh.store(view.points.data(), view.points.size(), r);
+        fresh.appendRecord(r);
+    }
+    *this = std::move(fresh);
+}
+
+void StrokeList::clear() {
+    m_chunks.clear();
+    m_points.clear();
+    m_codes.clear();
+    m_styles.clear();
+    m_styleIds.clear();
+    m_size = 0;
+    m_livePoints = 0;
+    m_deadPoints = 0;
+}
+
 void BrushEngine::beginStroke(const QVector2D &pos, const QColor &color, float size) {
-    m_currentStroke = BrushStroke{color, size, {pos}};
+    m_currentStroke = BrushStroke{color, size, {pos}, g_nextStrokeId++};
     m_drawing = true;
 }
 
@@ -11,30 +249,136 @@ void BrushEngine::addPoint(const QVector2D &pos) {
         m_currentStroke.points.append(pos);
 }
 
+void BrushEngine::addSamples(const QList<InputSample> &samples) {
+    if (!m_drawing) return;
+    m_currentStroke.points.reserve(m_currentStroke.points.size() + samples.size());
+    for (const InputSample &s : samples) m_currentStroke.points.append(s.pos);
+}
+
 void BrushEngine::endStroke() {
     if (m_drawing) {
-        // Move the current stroke into the list to avoid unnecessary copies
-        m_strokes.append(std::move(m_currentStroke));
+        // The points are copied into the layer's arena; the working list is freed
+        m_strokes.append(m_currentStroke);
         // Reset current stroke to defaults
         m_currentStroke = BrushStroke{};
         m_drawing = false;
+        ++m_revision;
+        // Bounds of the stored points, so that removal finds the same cells
+        const QRectF bounds = strokeBounds(m_strokes.size() - 1);
+        m_index.insert(m_strokes.idAt(m_strokes.size() - 1), bounds);
+        recordDamage(bounds);
     }
 }
 
 bool BrushEngine::removeLastStroke() {
-    if (m_strokes.isEmpty())
-        return false;
-    m_strokes.removeLast();
-    return true;
+    return removeStrokeAt(m_strokes.size() - 1);
 }
 
 bool BrushEngine::removeStrokeAt(int index) {
     if (index < 0 || index >= m_strokes.size())
         return false;
+    const QRectF bounds = strokeBounds(index);
+    m_index.remove(m_strokes.idAt(index), bounds);
     m_strokes.removeAt(index);
+    ++m_revision;
+    recordDamage(bounds);
     return true;
 }
 
 void BrushEngine::clearStrokes() {
+    if (m_strokes.isEmpty())
+        return;
     m_strokes.clear();
+    m_index.clear();
+    ++m_revision;
+    recordDamage(QRectF());
+}
+
+BrushStroke BrushEngine::stroke(int index) const {
+    const StrokeView view = m_strokes.at(index);
+    return BrushStroke{view.color, view.size, QList<QVector2D>(view.points.begin(), view.points.end()), view.id};
+}
+
+void BrushEngine::insertStroke(int index, const BrushStroke &stroke) {
+    if (index < 0 || index > m_strokes.size())
+        return;
+    m_strokes.insert(index, stroke);
+    ++m_revision;
+    const QRectF bounds = strokeBounds(index);
+    m_index.insert(stroke.id, bounds);
+    recordDamage(bounds);
+}
+
+void BrushEngine::restoreStrokes(const StrokeList &strokes) {
+    m_strokes = strokes;
+    m_index.clear();
+    for (int i = 0; i < m_strokes.size(); ++i) m_index.insert(m_strokes.idAt(i), strokeBounds(i));
+    ++m_revision;
+    recordDamage(QRectF());
+}
+
+void BrushEngine::dropOldestStrokes(int count) {
+    count = std::min(count, m_strokes.size());
+    if (count <= 0)
+        return;
+    m_strokes.removeFirst(count);
+    // Cheaper to index the few strokes left than to remove the many dropped ones
+    m_index.clear();
+    for (int i = 0; i < m_strokes.size(); ++i) m_index.insert(m_strokes.idAt(i), strokeBounds(i));
+    ++m_revision;
+    recordDamage(QRectF());
+}
+
+QRectF BrushEngine::strokeBounds(int index) const {
+    const StrokeView stroke = m_strokes.at(index);
+    return StrokeIndex::boundsOf(stroke.points, stroke.size);
+}
+
+QList<int> BrushEngine::strokesIntersecting(const QRectF &rect) const {
+    QList<int> indices;
+    for (quint64 id : m_index.query(rect)) {
+        const int i = m_strokes.indexOf(id);
+        if (i >= 0) indices.append(i);
+    }
+    return indices;
+}
+
+int BrushEngine::strokeAt(const QPointF &pos, float tolerance) const {
+    const QVector2D p(pos);
+    // A stroke can be within reach while its bounds miss `pos` itself
+    const QPointF slack(tolerance, tolerance);
+    const QList<quint64> ids = tolerance > 0.0f ? m_index.query(QRectF(pos - slack, pos + slack)) : m_index.query(pos);
+    // Bounds only narrow it down; test the distance to the stroke's path, topmost first
+    for (auto it = ids.crbegin(); it != ids.crend(); ++it) {
+        const int index = m_strokes.indexOf(*it);
+        if (index < 0) continue;
+        const StrokeView stroke = m_strokes.at(index);
+        const float reach = std::max(0.5f, stroke.size * 0.5f) + tolerance;
+        const float reach2 = reach * reach;
+        if ((stroke.points.first() - p).lengthSquared() <= reach2) return index;
+        for (int i = 1; i < stroke.points.size(); ++i) {
+            const QVector2D a = stroke.points[i - 1];
+            const QVector2D d = stroke.points[i] - a;
+            const float len2 = d.lengthSquared();
+            const float t = len2 > 0.0f ? std::clamp(QVector2D::dotProduct(p - a, d) / len2, 0.0f, 1.0f) : 0.0f;
+            if ((a + d * t - p).lengthSquared() <= reach2) return index;
+        }
+    }
+    return -1;
+}
+
+void BrushEngine::recordDamage(const QRectF &rect) {
+    if (m_damage.size() == MaxDamageEntries) m_damage.removeFirst();
+    m_damage.append(StrokeDamage{m_revision, rect});
+}
+
+bool BrushEngine::damageSince(const QList<StrokeDamage> &log, quint64 since, QRectF &area) {
+    area = QRectF();
+    for (auto it = log.crbegin(); it != log.crend() && it->revision > since; ++it) {
+        if (it->rect.isNull()) return false;
+        area |= it->rect;
+        // Revisions are consecutive, so reaching `since + 1` means nothing is missing
+        if (it->revision == since + 1) return true;
+    }
+    return log.isEmpty() ? false : log.last().revision == since;
 }
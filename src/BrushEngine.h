@@ -2,20 +2,208 @@
 #include <QVector2D>
 #include <QColor>
 #include <QList>
+#include <QHash>
+#include <QPointF>
+#include <QRectF>
+#include <memory>
+#include <utility>
+#include "StrokeIndex.h"
 
 struct BrushStroke {
     QColor color;
     float size;
     QList<QVector2D> points;
+    quint64 id = 0; // unique per stroke, assigned at beginStroke
+};
+
+// One pointer or tablet sample, already in document coordinates. Pressure and time are
+// carried through the input pipeline for brush dynamics; the round brush uses the
+// position only.
+struct InputSample {
+    QVector2D pos;
+    float pressure = 1.0f;  // 0..1, 1 for mice
+    quint64 timestamp = 0;  // event time in ms
+};
+
+// Points of one committed stroke: a contiguous range of its layer's point arena
+class PointSpan {
+public:
+    PointSpan() = default;
+    PointSpan(const QVector2D *data, int size) : m_data(data), m_size(size) {}
+    int size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+    const QVector2D *data() const { return m_data; }
+    const QVector2D &at(int i) const { return m_data[i]; }
+    const QVector2D &operator[](int i) const { return m_data[i]; }
+    const QVector2D &first() const { return m_data[0]; }
+    const QVector2D &last() const { return m_data[m_size - 1]; }
+    const QVector2D *begin() const { return m_data; }
+    const QVector2D *end() const { return m_data + m_size; }
+private:
+    const QVector2D *m_data = nullptr;
+    int m_size = 0;
+};
+
+// Brush parameters shared by strokes; each distinct style is stored once per list
+struct StrokeStyle {
+    QRgb color = 0; // non-premultiplied ARGB
+    float size = 0.0f;
+    bool operator==(const StrokeStyle &o) const { return color == o.color && size == o.size; }
+};
+inline size_t qHash(const StrokeStyle &s, size_t seed = 0) { return qHashMulti(seed, s.color, s.size); }
+
+// A committed stroke as returned by StrokeList::at(). The points stay valid for as long
+// as the list it came from, or any copy of that list, is alive. For an encoded list
+// they are decoded into a buffer of the calling thread instead, valid until the next
+// at() on that thread.
+struct StrokeView {
+    PointSpan points;
+    QColor color;
+    float size = 0.0f;
+    quint64 id = 0;
+};
+
+// Committed strokes of a layer, in structure-of-arrays form:
+//  - all points live in one arena of large blocks, appended in commit order, so
+//    iterating strokes walks memory linearly and committing a stroke rarely allocates;
+//  - a stroke is a 24-byte record (id, block, offset, count, style);
+//  - styles (colour, size) are deduplicated into a small table.
+// Records are kept in immutable chunks of up to ChunkSize with shared ownership, and
+// arena blocks are shared too. Copying a StrokeList therefore only copies pointers,
+// and a copy never changes afterwards: edits build new chunks for the affected range,
+// and new points only go past every range a record refers to. This lets the render
+// thread hold a snapshot across frames while the GUI keeps editing. All copies must be
+// modified from the same thread.
+// Removed strokes leave their points in the arena until the dead points outnumber the
+// live ones; the arena is then compacted into fresh blocks (copies keep the old ones).
+//
+// With Encoding::Delta (opt-in, default from TRAHERE_POINT_ENCODING=delta) points are
+// stored as PointCodec bytes instead of floats, 3-4x smaller but rounded to 1/16 px
+// (at most 1/32 px off), and at() decodes them into a per-thread buffer that is reused
+// from call to call. Use idAt() and colorAt() where the points are not needed.
+class StrokeList {
+public:
+    static constexpr int ChunkSize = 64;
+    static constexpr int MinBlockPoints = 4096;     // first arena block
+    static constexpr int MaxBlockPoints = 64 * 1024; // blocks double up to this size
+
+    enum class Encoding { Float, Delta };
+    static Encoding defaultEncoding();
+
+    struct Record {
+        quint64 id = 0;
+        quint32 block = 0;
+        quint32 offset = 0;
+        quint32 count = 0;
+        quint32 style = 0;
+    };
+    using Chunk = QList<Record>;
+
+    int size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+    StrokeView at(int index) const;
+    StrokeView last() const { return at(m_size - 1); }
+    quint64 idAt(int index) const { return record(index).id; }
+    // Position of the stroke with `id`, or -1. Ids are assigned in commit order and
+    // strokes are only ever appended, so the list is sorted by id.
+    int indexOf(quint64 id) const;
+    QColor colorAt(int index) const { return QColor::fromRgba(m_styles.at(int(record(index).style)).color); }
+
+    Encoding encoding() const { return m_encoding; }
+    // Re-store existing strokes in the new encoding (quantizing them when switching to
+    // Delta); copies of the list keep the old storage
+    void setEncoding(Encoding encoding);
+
+    void append(const BrushStroke &stroke);
+    void removeLast();
+    void removeAt(int index);
+    // Put a stroke back at `index` with its original id (undo of a removal), which
+    // keeps the list sorted by id
+    void insert(int index, const BrushStroke &stroke);
+    // Remove strokes [0, count)
+    void removeFirst(int count);
+    void clear();
+
+    // Points referenced by strokes, and arena capacity in bytes (for diagnostics)
+    qint64 pointCount() const { return m_livePoints; }
+    qint64 arenaBytes() const;
+
+    class const_iterator {
+    public:
+        const_iterator(const StrokeList *list, int index) : m_list(list), m_index(index) {}
+        StrokeView operator*() const { return m_list->at(m_index); }
+        const_iterator &operator++() { ++m_index; return *this; }
+        bool operator!=(const const_iterator &o) const { return m_index != o.m_index; }
+        bool operator==(const const_iterator &o) const { return m_index == o.m_index; }
+    private:
+        const StrokeList *m_list;
+        int m_index;
+    };
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_size); }
+
+private:
+    // Append-only storage in large blocks; blocks are shared between copies
+    template <typename T>
+    class Arena {
+    public:
+        Arena(quint32 minBlock, quint32 maxBlock) : m_minBlock(minBlock), m_maxBlock(maxBlock) {}
+        // Room for up to `count` elements at the end of the arena; commit() what was used.
+        // An entry never straddles blocks.
+        T *reserve(quint32 count, quint32 &block, quint32 &offset);
+        void commit(quint32 count) { m_blocks.last()->used += count; }
+        const T *data(quint32 block, quint32 offset) const { return m_blocks.at(int(block))->data.get() + offset; }
+        qint64 bytes() const;
+        void clear() { m_blocks.clear(); }
+    private:
+        struct Block {
+            std::unique_ptr<T[]> data;
+            quint32 capacity = 0;
+            quint32 used = 0; // shared by every list holding the block, so copies never overlap
+        };
+        QList<std::shared_ptr<Block>> m_blocks;
+        quint32 m_minBlock;
+        quint32 m_maxBlock;
+    };
+
+    const Record &record(int index) const { return m_chunks.at(index / ChunkSize)->at(index % ChunkSize); }
+    // Copy `count` points into the arena in the list's encoding; fills in r.block/r.offset
+    void store(const QVector2D *points, int count, Record &r);
+    quint32 styleId(const QColor &color, float size);
+    void appendRecord(const Record &r);
+    void releasePoints(const Record &r);
+    void compact();
+    void rebuild(Encoding encoding);
+
+    Encoding m_encoding = defaultEncoding();
+    QList<std::shared_ptr<const Chunk>> m_chunks; // all full except possibly the last
+    Arena<QVector2D> m_points{MinBlockPoints, MaxBlockPoints};
+    Arena<quint8> m_codes{MinBlockPoints * 4, MaxBlockPoints * 4}; // Encoding::Delta
+    QList<StrokeStyle> m_styles;
+    QHash<StrokeStyle, quint32> m_styleIds;
+    int m_size = 0;
+    qint64 m_livePoints = 0;
+    qint64 m_deadPoints = 0; // arena points no longer referenced by this list
+};
+
+// Document area whose pixels a stroke revision changed (the stroke's bounds for an
+// append or a removal); a null rect means everything
+struct StrokeDamage {
+    quint64 revision = 0;
+    QRectF rect;
 };
 
 class BrushEngine {
 public:
+    static constexpr int MaxDamageEntries = 64;
+
     void beginStroke(const QVector2D &pos, const QColor &color, float size);
     void addPoint(const QVector2D &pos);
+    // Append a batch of samples (all input since the previous frame) in one go
+    void addSamples(const QList<InputSample> &samples);
     void endStroke();
 
-    const QList<BrushStroke>& strokes() const { return m_strokes; }
+    const StrokeList& strokes() const { return m_strokes; }
 
     // Stroke management
     // Remove the most recently committed stroke. Returns true if removed.
@@ -24,17 +212,47 @@ public:
     bool removeStrokeAt(int index);
     // Clear all committed strokes.
     void clearStrokes();
+    // Editable copy of committed stroke `index`, keeping its id
+    BrushStroke stroke(int index) const;
+    // Re-insert a stroke taken with stroke() (undo / redo)
+    void insertStroke(int index, const BrushStroke &stroke);
+    // Replace all committed strokes with an earlier copy of strokes() (undo of a clear)
+    void restoreStrokes(const StrokeList &strokes);
+    // Forget strokes [0, count) once they have been baked into the layer raster
+    void dropOldestStrokes(int count);
     // Number of committed strokes.
     int strokeCount() const { return m_strokes.size(); }
+    // Monotonic counter bumped whenever the committed strokes change
+    quint64 revision() const { return m_revision; }
+
+    // Spatial queries over committed strokes (document coordinates)
+    const StrokeIndex &index() const { return m_index; }
+    QRectF strokeBounds(int index) const;
+    // Indices of strokes whose bounds intersect `rect`, bottom to top
+    QList<int> strokesIntersecting(const QRectF &rect) const;
+    // Topmost stroke painted within `tolerance` of `pos`, or -1
+    int strokeAt(const QPointF &pos, float tolerance = 0.0f) const;
+
+    // What the last MaxDamageEntries revisions changed, oldest first
+    const QList<StrokeDamage> &damage() const { return m_damage; }
+    // Union of the damage after revision `since` up to the newest entry of `log`.
+    // False when `log` no longer reaches back that far or some change was unbounded.
+    static bool damageSince(const QList<StrokeDamage> &log, quint64 since, QRectF &area);
 
     // Expose current drawing state so renderer can draw in-progress stroke too
     bool isDrawing() const { return m_drawing; }
     const QList<QVector2D>& currentPoints() const { return m_currentStroke.points; }
     const QColor& currentColor() const { return m_currentStroke.color; }
     float currentSize() const { return m_currentStroke.size; }
+    quint64 currentStrokeId() const { return m_currentStroke.id; }
 
 private:
-    QList<BrushStroke> m_strokes;
+    void recordDamage(const QRectF &rect);
+
+    StrokeList m_strokes;
+    StrokeIndex m_index;
+    QList<StrokeDamage> m_damage;
     BrushStroke m_currentStroke;
     bool m_drawing = false;
+    quint64 m_revision = 0;
 };
@@ -6,11 +6,25 @@
 #include <QImage>
 #include <QBuffer>
 #include <QDebug>
-#include <QPainter>
-#include <QPainterPath>
 #include <QPointF>
 #include <QMouseEvent>
+#include <QWheelEvent>
+#include <QTabletEvent>
+#include <QLoggingCategory>
+#include <QFutureWatcher>
+#include <QtConcurrent/QtConcurrentRun>
+#include <cmath>
+#include <algorithm>
+#include <QHash>
 #include "Layer.h"
+#include "PixelOps.h"
+#include "RasterEngine.h"
+#include "ResampleCache.h"
+#include "SaveJobs.h"
+// Input batches per frame (QT_LOGGING_RULES="trahere.input.debug=true")
+Q_LOGGING_CATEGORY(lcInput, "trahere.input", QtWarningMsg)
+Q_LOGGING_CATEGORY(lcBake, "trahere.bake", QtWarningMsg)
+
 Canvas::~Canvas() {
     for (Layer* l : m_layers) {
         if (l) l->deleteLater();
@@ -37,9 +51,22 @@ Canvas::Canvas(QQuickItem *parent)
     : QQuickFramebufferObject(parent),
       m_brushColor(Qt::black),
       m_brushSize(5.0f),
-      m_cursorPos(QVector2D(0,0))
+      m_cursorPos(QVector2D(0,0)),
+      m_gpuPainting(qEnvironmentVariable("TRAHERE_PAINT_BACKEND").compare(QLatin1String("gpu"), Qt::CaseInsensitive) == 0),
+      m_strokePrediction(qEnvironmentVariable("TRAHERE_PREDICT") == QLatin1String("1")),
+      m_autoBake(qEnvironmentVariable("TRAHERE_BAKE") != QLatin1String("0"))
 {
     setAcceptedMouseButtons(Qt::AllButtons);
+    // Frames are only rendered on demand (input, state changes), so the counter is
+    // sampled on a coarse timer instead of per frame. The timer only runs while frames
+    // are being rendered: the first one starts it, a second without any stops it.
+    m_fpsTimer.setInterval(1000);
+    m_fpsTimer.setTimerType(Qt::CoarseTimer);
+    connect(&m_fpsTimer, &QTimer::timeout, this, &Canvas::updateFramesPerSecond);
+    // A pen that stops sends no more events: come back once its tail has gone stale
+    m_tailTimer.setSingleShot(true);
+    m_tailTimer.setInterval(int(StrokePredictor::StaleMs) + 1);
+    connect(&m_tailTimer, &QTimer::timeout, this, [this] { polish(); });
     // Create initial base layer
     addLayer("Layer 1");
     setActiveLayerIndex(0);
@@ -53,6 +80,7 @@ void Canvas::setBrushColor(const QColor &color) {
     if (color != m_brushColor) {
         m_brushColor = color;
         emit brushColorChanged();
+        update(); // brush preview
     }
 }
 
@@ -60,63 +88,421 @@ void Canvas::setBrushSize(float size) {
     if (size != m_brushSize) {
         m_brushSize = size;
         emit brushSizeChanged();
+        update(); // brush preview
+    }
+}
+
+void Canvas::setGpuPainting(bool enabled) {
+    if (enabled != m_gpuPainting) {
+        m_gpuPainting = enabled;
+        emit gpuPaintingChanged();
+        update();
+    }
+}
+
+void Canvas::setStrokePrediction(bool enabled) {
+    if (enabled != m_strokePrediction) {
+        m_strokePrediction = enabled;
+        m_predictedTail.clear();
+        emit strokePredictionChanged();
+        update();
+    }
+}
+
+void Canvas::watchLayer(Layer *layer) {
+    // Layer content changes go through Canvas (which calls update()); visibility and
+    // opacity can also be changed directly from QML
+    connect(layer, &Layer::visibilityChanged, this, &QQuickItem::update);
+    connect(layer, &Layer::opacityChanged, this, &QQuickItem::update);
+}
+
+void Canvas::addRenderedFrames(int frames, qint64 uploadNanoseconds) {
+    m_framesSinceTick += frames;
+    m_uploadNsSinceTick += uploadNanoseconds;
+    // This is the render thread: the timer is started on the GUI thread
+    if (!m_fpsTimer.isActive())
+        QMetaObject::invokeMethod(this, [this] { startFramesPerSecond(); }, Qt::QueuedConnection);
+}
+
+void Canvas::startFramesPerSecond() {
+    if (m_fpsTimer.isActive()) return;
+    m_fpsClock.start();
+    m_fpsTimer.start();
+}
+
+void Canvas::updateFramesPerSecond() {
+    const qint64 ms = m_fpsClock.restart();
+    const qreal fps = ms > 0 ? m_framesSinceTick * 1000.0 / ms : 0.0;
+    const qreal uploadMs = m_framesSinceTick > 0 ? m_uploadNsSinceTick / 1e6 / m_framesSinceTick : 0.0;
+    if (m_framesSinceTick == 0) m_fpsTimer.stop(); // idle: reports 0 below, started again by the next frame
+    m_framesSinceTick = 0;
+    m_uploadNsSinceTick = 0;
+    if (qAbs(fps - m_framesPerSecond) > 0.05 || qAbs(uploadMs - m_uploadMilliseconds) > 0.005) {
+        m_framesPerSecond = fps;
+        m_uploadMilliseconds = uploadMs;
+        emit framesPerSecondChanged();
     }
 }
 
 void Canvas::mousePressEvent(QMouseEvent *event) {
-    m_cursorPos = QVector2D(event->position());
-    emit cursorPosChanged();
-    if (activeLayer())
-        activeLayer()->engine().beginStroke(QVector2D(event->position()), m_brushColor, m_brushSize);
-    update();
+    if (event->button() == Qt::MiddleButton) {
+        m_panning = true;
+        m_panAnchor = event->position();
+        return;
+    }
+    beginInput(event->position(), event->timestamp());
 }
 
 void Canvas::mouseMoveEvent(QMouseEvent *event) {
-    m_cursorPos = QVector2D(event->position());
+    if (m_panning) {
+        m_cursorPos = QVector2D(event->position());
+        setPan(m_pan + (event->position() - m_panAnchor));
+        m_panAnchor = event->position();
+        return;
+    }
+    queueInput(event->position(), 1.0f, event->timestamp());
+}
+
+void Canvas::mouseReleaseEvent(QMouseEvent *event) {
+    if (m_panning) {
+        m_panning = false;
+        return;
+    }
+    endInput(event->position(), 1.0f, event->timestamp());
+}
+
+bool Canvas::event(QEvent *event) {
+    // Pen input, with pressure. Accepting it stops Qt from synthesizing mouse events.
+    switch (event->type()) {
+    case QEvent::TabletPress:
+    case QEvent::TabletMove:
+    case QEvent::TabletRelease: {
+        auto *te = static_cast<QTabletEvent *>(event);
+        const float pressure = float(te->pressure());
+        if (event->type() == QEvent::TabletPress) beginInput(te->position(), te->timestamp());
+        else if (event->type() == QEvent::TabletRelease) endInput(te->position(), pressure, te->timestamp());
+        else if (m_inputActive) queueInput(te->position(), pressure, te->timestamp());
+        te->accept();
+        return true;
+    }
+    default:
+        return QQuickFramebufferObject::event(event);
+    }
+}
+
+void Canvas::beginInput(const QPointF &itemPos, quint64 timestamp) {
+    flushInput();
+    m_inputActive = true;
+    m_cursorPos = QVector2D(itemPos);
     emit cursorPosChanged();
+    const QVector2D docPos(mapToDocument(itemPos));
+    m_predictor.reset();
+    m_predictedTail.clear();
+    m_predictor.addSample(InputSample{docPos, 1.0f, timestamp});
+    m_newestSampleTime = timestamp;
+    m_newestSampleClock.start();
     if (activeLayer())
-        activeLayer()->engine().addPoint(QVector2D(event->position()));
+        activeLayer()->engine().beginStroke(docPos, m_brushColor, m_brushSize);
     update();
 }
 
-void Canvas::mouseReleaseEvent(QMouseEvent *event) {
-    m_cursorPos = QVector2D(event->position());
-    emit cursorPosChanged();
-    if (activeLayer()) {
-        activeLayer()->engine().endStroke();
+void Canvas::queueInput(const QPointF &itemPos, float pressure, quint64 timestamp) {
+    // Pens report at 200-1000 Hz: keep the samples and hand them over once per frame
+    // in updatePolish(), so a frame costs one engine update, one cursorPosChanged
+    // and one render however many events arrived
+    m_cursorPos = QVector2D(itemPos);
+    m_cursorMoved = true;
+    const InputSample sample{QVector2D(mapToDocument(itemPos)), pressure, timestamp};
+    m_pendingInput.append(sample);
+    m_predictor.addSample(sample);
+    m_newestSampleTime = timestamp;
+    m_newestSampleClock.start();
+    polish();
+}
+
+void Canvas::endInput(const QPointF &itemPos, float pressure, quint64 timestamp) {
+    if (!m_inputActive) return;
+    queueInput(itemPos, pressure, timestamp);
+    flushInput();
+    m_inputActive = false;
+    m_predictedTail.clear();
+    m_tailTimer.stop();
+    if (Layer *layer = activeLayer()) {
+        const int before = layer->engine().strokeCount();
+        layer->engine().endStroke();
+        if (layer->engine().strokeCount() > before) {
+            StrokeHistory::Command command;
+            command.kind = StrokeHistory::Command::AddStroke;
+            command.layerUid = layer->uid();
+            command.index = before;
+            m_history.push(std::move(command));
+            emit historyChanged();
+            maybeBake(layer);
+        }
         emit strokeCountChanged();
     }
     update();
 }
 
-bool Canvas::undoLastStroke() {
-    if (!activeLayer()) return false;
-    bool ok = activeLayer()->engine().removeLastStroke();
-    if (ok) {
-        emit strokeCountChanged();
+void Canvas::flushInput() {
+    if (!m_pendingInput.isEmpty()) {
+        qCDebug(lcInput) << "delivering" << m_pendingInput.size() << "samples";
+        if (activeLayer()) activeLayer()->engine().addSamples(m_pendingInput);
+        m_pendingInput.clear();
+        // The tail is recomputed from the newest samples, replacing the previous one
+        if (m_strokePrediction && m_inputActive) {
+            m_predictedTail = m_predictor.predict(PredictionHorizonMs, inputTime());
+            if (!m_predictedTail.isEmpty()) m_tailTimer.start();
+        }
         update();
     }
-    return ok;
+    if (m_cursorMoved) {
+        m_cursorMoved = false;
+        emit cursorPosChanged();
+    }
 }
 
-bool Canvas::removeStroke(int index) {
-    if (!activeLayer()) return false;
-    bool ok = activeLayer()->engine().removeStrokeAt(index);
-    if (ok) {
-        emit strokeCountChanged();
+quint64 Canvas::inputTime() const {
+    // Event timestamps have their own epoch: count on from the newest one
+    return m_newestSampleTime + quint64(m_newestSampleClock.elapsed());
+}
+
+void Canvas::updatePolish() {
+    flushInput();
+    // No new input: drop the tail once the newest sample is too old to predict from,
+    // rather than leave the overshoot on screen after the pen stopped
+    if (!m_predictedTail.isEmpty() && m_predictor.isStale(inputTime())) {
+        m_predictedTail.clear();
         update();
     }
-    return ok;
 }
 
-void Canvas::clearAllStrokes() {
-    if (!activeLayer()) return;
-    if (activeLayer()->engine().strokeCount() == 0) return;
-    activeLayer()->engine().clearStrokes();
+void Canvas::wheelEvent(QWheelEvent *event) {
+    // One notch (120) zooms by 25 %, about the cursor
+    const qreal notches = event->angleDelta().y() / 120.0;
+    if (notches != 0.0) zoomAt(std::pow(1.25, notches), event->position());
+    event->accept();
+}
+
+void Canvas::geometryChange(const QRectF &newGeometry, const QRectF &oldGeometry) {
+    QQuickFramebufferObject::geometryChange(newGeometry, oldGeometry);
+    // Without an explicit size the document takes the first non-empty item size
+    if (m_documentSize.isEmpty() && !newGeometry.size().isEmpty()) {
+        setDocumentSize(newGeometry.size().toSize());
+    } else if (m_fitView) {
+        fitToView();
+    }
+}
+
+void Canvas::setDocumentSize(const QSize &size) {
+    if (size == m_documentSize || size.isEmpty()) return;
+    m_documentSize = size;
+    emit documentSizeChanged();
+    prefetchResampled();
+    if (m_fitView) fitToView();
+    update();
+}
+
+void Canvas::setZoom(qreal zoom) {
+    zoom = qBound(MinZoom, zoom, MaxZoom);
+    m_fitView = false;
+    if (zoom == m_zoom) return;
+    m_zoom = zoom;
+    emit viewChanged();
+    update();
+}
+
+void Canvas::setPan(const QPointF &pan) {
+    m_fitView = false;
+    if (pan == m_pan) return;
+    m_pan = pan;
+    emit viewChanged();
+    update();
+}
+
+void Canvas::zoomAt(qreal factor, const QPointF &itemPos) {
+    const QPointF docPos = mapToDocument(itemPos);
+    setZoom(m_zoom * factor);
+    setPan(itemPos - docPos * m_zoom);
+}
+
+void Canvas::zoomBy(qreal factor) {
+    zoomAt(factor, QPointF(width() / 2.0, height() / 2.0));
+}
+
+void Canvas::fitToView() {
+    if (m_documentSize.isEmpty() || width() <= 0 || height() <= 0) return;
+    const qreal fit = std::min({1.0, width() / m_documentSize.width(), height() / m_documentSize.height()});
+    const QPointF pan((width() - m_documentSize.width() * fit) / 2.0, (height() - m_documentSize.height() * fit) / 2.0);
+    m_fitView = true;
+    if (fit == m_zoom && pan == m_pan) return;
+    m_zoom = fit;
+    m_pan = pan;
+    emit viewChanged();
+    update();
+}
+
+void Canvas::resetZoom() {
+    setZoom(1.0);
+    setPan(QPointF((width() - m_documentSize.width()) / 2.0, (height() - m_documentSize.height()) / 2.0));
+}
+
+void Canvas::prefetchResampled() {
+    // Rasters at the document size are what the renderer rebuilds layers from (and
+    // the base image what export composites), so scale them before they are needed
+    ResampleCache &cache = ResampleCache::instance();
+    for (const Layer *layer : std::as_const(m_layers)) {
+        if (layer && !layer->raster().isNull()) cache.prefetch(layer->raster(), m_documentSize);
+    }
+    if (!m_baseImage.isNull()) cache.prefetch(m_baseImage, m_documentSize);
+}
+
+QPointF Canvas::mapToDocument(const QPointF &itemPos) const {
+    return (itemPos - m_pan) / m_zoom;
+}
+
+Layer *Canvas::layerByUid(quint64 uid) const {
+    for (Layer *layer : m_layers) {
+        if (layer && layer->uid() == uid) return layer;
+    }
+    return nullptr;
+}
+
+void Canvas::strokesEdited() {
     emit strokeCountChanged();
+    emit historyChanged();
     update();
 }
 
+bool Canvas::undo() {
+    StrokeHistory::Command *command = m_history.undoCommand();
+    if (!command) return false;
+    if (Layer *layer = layerByUid(command->layerUid)) {
+        BrushEngine &engine = layer->engine();
+        switch (command->kind) {
+        case StrokeHistory::Command::AddStroke:
+            command->stroke = engine.stroke(command->index);
+            engine.removeStrokeAt(command->index);
+            break;
+        case StrokeHistory::Command::RemoveStroke:
+            engine.insertStroke(command->index, command->stroke);
+            command->stroke = BrushStroke{};
+            break;
+        case StrokeHistory::Command::ClearStrokes:
+            engine.restoreStrokes(command->cleared);
+            command->cleared = StrokeList();
+            break;
+        }
+    }
+    m_history.undone();
+    strokesEdited();
+    return true;
+}
+
+bool Canvas::redo() {
+    StrokeHistory::Command *command = m_history.redoCommand();
+    if (!command) return false;
+    if (Layer *layer = layerByUid(command->layerUid)) {
+        BrushEngine &engine = layer->engine();
+        switch (command->kind) {
+        case StrokeHistory::Command::AddStroke:
+            engine.insertStroke(command->index, command->stroke);
+            command->stroke = BrushStroke{};
+            break;
+        case StrokeHistory::Command::RemoveStroke:
+            command->stroke = engine.stroke(command->index);
+            engine.removeStrokeAt(command->index);
+            break;
+        case StrokeHistory::Command::ClearStrokes:
+            command->cleared = engine.strokes();
+            engine.clearStrokes();
+            break;
+        }
+    }
+    m_history.redone();
+    strokesEdited();
+    return true;
+}
+
+void Canvas::maybeBake(Layer *layer) {
+    if (!m_autoBake || !layer || m_baking.contains(layer->uid())) return;
+    const int count = StrokeBaker::strokesToBake(layer->engine().strokes(), m_bakePolicy);
+    if (count <= 0) return;
+    const StrokeBaker::Job job = StrokeBaker::makeJob(layer->uid(), layer->raster(), layer->engine().strokes(), count,
+                                                      m_documentSize);
+    m_baking.insert(job.layerUid);
+    auto *watcher = new QFutureWatcher<QImage>(this);
+    connect(watcher, &QFutureWatcher<QImage>::finished, this, [this, watcher, job]() {
+        m_baking.remove(job.layerUid);
+        finishBake(job, watcher->result());
+        watcher->deleteLater();
+    });
+    watcher->setFuture(QtConcurrent::run(&StrokeBaker::bake, job));
+}
+
+void Canvas::finishBake(const StrokeBaker::Job &job, const QImage &baked) {
+    Layer *layer = layerByUid(job.layerUid);
+    if (!layer) return;
+    BrushEngine &engine = layer->engine();
+    // Discard the result if the baked strokes are no longer the layer's oldest ones or
+    // the raster or document size changed meanwhile; the next commit tries again
+    const bool current = job.size == m_documentSize && layer->raster().cacheKey() == job.rasterKey
+        && engine.strokeCount() >= job.count && engine.strokes().idAt(job.count - 1) == job.lastId;
+    if (!current) {
+        qCDebug(lcBake) << "layer" << job.layerUid << "changed while baking; result discarded";
+        return;
+    }
+    layer->setRaster(baked);
+    engine.dropOldestStrokes(job.count);
+    m_history.strokesBaked(job.layerUid, job.count);
+    qCDebug(lcBake) << "layer" << job.layerUid << ": baked" << job.count << "strokes," << engine.strokeCount()
+                    << "left as vectors";
+    strokesEdited();
+}
+
+void Canvas::setHistoryLimit(int megabytes) {
+    megabytes = std::max(0, megabytes);
+    if (megabytes == historyLimit()) return;
+    m_historyLimitBytes = qint64(megabytes) * 1024 * 1024;
+    m_history.setLimit(m_historyLimitBytes / HistoryShare);
+    emit historyLimitChanged();
+    emit historyChanged();
+    update(); // the renderer picks up the new checkpoint budget
+}
+
+bool Canvas::removeStroke(int index) {
+    Layer *layer = activeLayer();
+    if (!layer || index < 0 || index >= layer->engine().strokeCount()) return false;
+    StrokeHistory::Command command;
+    command.kind = StrokeHistory::Command::RemoveStroke;
+    command.layerUid = layer->uid();
+    command.index = index;
+    command.stroke = layer->engine().stroke(index);
+    layer->engine().removeStrokeAt(index);
+    m_history.push(std::move(command));
+    strokesEdited();
+    return true;
+}
+
+int Canvas::strokeAt(qreal x, qreal y) const {
+    if (!activeLayer()) return -1;
+    // A few screen pixels of slack, whatever the zoom
+    return activeLayer()->engine().strokeAt(mapToDocument(QPointF(x, y)), float(2.0 / m_zoom));
+}
+
+void Canvas::clearAllStrokes() {
+    Layer *layer = activeLayer();
+    if (!layer) return;
+    if (layer->engine().strokeCount() == 0) return;
+    StrokeHistory::Command command;
+    command.kind = StrokeHistory::Command::ClearStrokes;
+    command.layerUid = layer->uid();
+    command.cleared = layer->engine().strokes();
+    layer->engine().clearStrokes();
+    m_history.push(std::move(command));
+    strokesEdited();
+}
+
 int Canvas::strokeCount() const {
     if (!activeLayer()) return 0;
     return activeLayer()->engine().strokeCount();
@@ -125,6 +511,7 @@ int Canvas::strokeCount() const {
 int Canvas::addLayer(const QString &name) {
     auto *layer = new Layer(const_cast<Canvas*>(this));
     if (!name.isEmpty()) layer->setName(name);
+    watchLayer(layer);
     m_layers.append(layer);
     emit layerCountChanged();
     return m_layers.size() - 1;
@@ -133,7 +520,11 @@ int Canvas::addLayer(const QString &name) {
 bool Canvas::removeLayer(int index) {
     if (index < 0 || index >= m_layers.size()) return false;
     Layer* l = m_layers.takeAt(index);
-    if (l) l->deleteLater();
+    if (l) {
+        m_history.removeLayer(l->uid());
+        emit historyChanged();
+        l->deleteLater();
+    }
     if (m_activeLayerIndex == index) {
         m_activeLayerIndex = m_layers.isEmpty() ? -1 : 0;
         emit activeLayerIndexChanged();
@@ -153,6 +544,53 @@ void Canvas::setActiveLayerIndex(int idx) {
     update();
 }
 
+std::shared_ptr<const DocumentSnapshot> Canvas::documentSnapshot() {
+    // Cheap check first: same size, layers, revisions, visibility and base image
+    bool unchanged = m_snapshot && m_snapshot->layers.size() == m_layers.size()
+        && m_snapshot->size == m_documentSize
+        && m_snapshot->baseImage.cacheKey() == m_baseImage.cacheKey();
+    for (int i = 0; unchanged && i < m_layers.size(); ++i) {
+        const Layer *layer = m_layers.at(i);
+        const LayerSnapshot &ls = *m_snapshot->layers.at(i);
+        unchanged = layer && ls.uid == layer->uid() && ls.revision == layer->revision()
+            && ls.visible == layer->isVisible() && ls.opacity == float(layer->opacity());
+    }
+    if (unchanged) return m_snapshot;
+
+    // Rebuild, reusing the snapshot of every layer whose content did not change
+    QHash<quint64, std::shared_ptr<const LayerSnapshot>> previous;
+    if (m_snapshot) {
+        for (const auto &ls : m_snapshot->layers) previous.insert(ls->uid, ls);
+    }
+    auto doc = std::make_shared<DocumentSnapshot>();
+    doc->generation = ++m_snapshotGeneration;
+    doc->size = m_documentSize;
+    doc->baseImage = m_baseImage;
+    doc->layers.reserve(m_layers.size());
+    for (Layer *layer : std::as_const(m_layers)) {
+        if (!layer) continue;
+        std::shared_ptr<const LayerSnapshot> old = previous.value(layer->uid());
+        if (old && old->revision == layer->revision() && old->visible == layer->isVisible()
+            && old->opacity == float(layer->opacity())) {
+            doc->layers.append(old);
+            continue;
+        }
+        auto ls = std::make_shared<LayerSnapshot>();
+        ls->uid = layer->uid();
+        ls->revision = layer->revision();
+        ls->visible = layer->isVisible();
+        ls->opacity = float(layer->opacity());
+        ls->raster = layer->raster();
+        ls->strokes = layer->engine().strokes();
+        ls->index = layer->engine().index();
+        ls->strokeRevision = layer->engine().revision();
+        ls->damage = layer->engine().damage();
+        doc->layers.append(std::move(ls));
+    }
+    m_snapshot = std::move(doc);
+    return m_snapshot;
+}
+
 Layer* Canvas::activeLayer() const {
     if (m_activeLayerIndex < 0 || m_activeLayerIndex >= m_layers.size()) return nullptr;
     return m_layers[m_activeLayerIndex];
@@ -165,44 +603,22 @@ bool Canvas::loadBaseImage(const QUrl &imageUrl) {
         qWarning() << "Canvas.loadBaseImage: failed to load" << local;
         return false;
     }
-    m_baseImage = img.convertToFormat(QImage::Format_RGBA8888);
+    m_baseImage = PixelOps::toSurface(img);
+    setDocumentSize(m_baseImage.size()); // an opened image defines the document
     update();
     return true;
 }
 
-// Duplicate lightweight rasterization similar to GLRenderer (white bg + base image + strokes)
-QImage Canvas::compositedImage() const {
-    // Use window size if available otherwise base image size
-    QSize targetSize = QSize(int(width()), int(height()));
-    if (targetSize.width() <= 0 || targetSize.height() <= 0) {
-        if (!m_baseImage.isNull()) targetSize = m_baseImage.size();
-        else targetSize = QSize(512, 512);
-    }
-    QImage buffer(targetSize, QImage::Format_RGBA8888);
-    buffer.fill(Qt::white);
-    if (!m_baseImage.isNull()) {
-        QImage scaled = (m_baseImage.size() == targetSize) ? m_baseImage : m_baseImage.scaled(targetSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
-        QPainter p(&buffer);
-        p.drawImage(0, 0, scaled);
-        p.end();
-    }
-    // Simple stroke rendering using QPainter path (does not perfectly match GL stamping but acceptable)
-    QPainter painter(&buffer);
-    painter.setRenderHint(QPainter::Antialiasing, true);
-    if (activeLayer()) {
-        for (const auto &stroke : activeLayer()->engine().strokes()) {
-            if (stroke.points.isEmpty()) continue;
-            QPen pen(stroke.color, stroke.size, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
-            painter.setPen(pen);
-            QPainterPath path(QPointF(stroke.points.first().x(), stroke.points.first().y()));
-            for (int i=1;i<stroke.points.size();++i) {
-                path.lineTo(stroke.points[i].x(), stroke.points[i].y());
-            }
-            painter.drawPath(path);
-        }
-    }
-    painter.end();
-    return buffer;
+DocumentSnapshot Canvas::exportSnapshot() {
+    DocumentSnapshot doc = *documentSnapshot();
+    // Before the item has a size: the base image size, otherwise a default
+    if (doc.size.isEmpty()) doc.size = !m_baseImage.isNull() ? m_baseImage.size() : QSize(512, 512);
+    return doc;
+}
+
+QImage Canvas::compositedImage() {
+    // White background, base image and every visible layer, as on screen
+    return RasterEngine::renderDocument(exportSnapshot());
 }
 
 bool Canvas::saveOra(const QUrl &destinationUrl) {
@@ -216,110 +632,58 @@ bool Canvas::saveOra(const QUrl &destinationUrl) {
 }
 
 bool Canvas::saveOraStrokesOnly(const QUrl &destinationUrl) {
-    // Determine size from existing base image or current item size
-    QSize targetSize = !m_baseImage.isNull() ? m_baseImage.size() : QSize(int(width()), int(height()));
-    if (targetSize.width() <= 0 || targetSize.height() <= 0) targetSize = QSize(512, 512);
-    QImage buffer(targetSize, QImage::Format_RGBA8888);
-    buffer.fill(Qt::transparent); // start transparent
-    // Preserve previously saved content (flattened strokes) if base image exists
-    if (!m_baseImage.isNull()) {
-        QImage base = m_baseImage;
-        if (base.size() != targetSize) {
-            base = base.scaled(targetSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
-        }
-        QPainter basePainter(&buffer);
-        basePainter.drawImage(0, 0, base);
-        basePainter.end();
-    }
-    QPainter painter(&buffer);
-    painter.setRenderHint(QPainter::Antialiasing, true);
-    if (activeLayer()) {
-        for (const auto &stroke : activeLayer()->engine().strokes()) {
-            if (stroke.points.isEmpty()) continue;
-            QPen pen(stroke.color, stroke.size, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
-            painter.setPen(pen);
-            QPainterPath path(QPointF(stroke.points.first().x(), stroke.points.first().y()));
-            for (int i=1;i<stroke.points.size();++i) {
-                path.lineTo(stroke.points[i].x(), stroke.points[i].y());
-            }
-            painter.drawPath(path);
-        }
-    }
-    painter.end();
-    OraCreator creator;
-    bool ok = creator.saveOra(destinationUrl, buffer);
-    if (!ok) {
-        qWarning() << "Canvas.saveOraStrokesOnly: failed" << destinationUrl;
-    }
-    return ok;
+    if (!destinationUrl.isValid() || isSaving()) return false;
+    // Transparent background. The base image stays: it holds previously saved
+    // (flattened) content.
+    RasterEngine::Options options;
+    options.background = Qt::transparent;
+    startSave(destinationUrl, QtConcurrent::run(&SaveJobs::saveFlattened, destinationUrl, exportSnapshot(), options));
+    return true;
 }
 
 bool Canvas::saveOraAllLayers(const QUrl &destinationUrl) {
-    if (!destinationUrl.isValid()) return false;
-    // Determine target size (use base image size if available else canvas item size else fallback)
-    QSize targetSize = !m_baseImage.isNull() ? m_baseImage.size() : QSize(int(width()), int(height()));
-    if (targetSize.width() <= 0 || targetSize.height() <= 0) targetSize = QSize(512, 512);
-
-    QList<QImage> layerImages; // first element will be top-most for ORA
-    QStringList layerNames;
-    QList<bool> visibilityFlags;
-
-    // Build per-layer images. Internal m_layers is assumed bottom->top (new appended layers over earlier ones)
-    // For ORA we need top-most first, so iterate reversed.
-    for (int li = m_layers.size() - 1; li >= 0; --li) {
-        Layer* layer = m_layers.at(li);
-        if (!layer) continue;
-        QImage img(targetSize, QImage::Format_RGBA8888);
-        img.fill(Qt::transparent);
-        QPainter painter(&img);
-        painter.setRenderHint(QPainter::Antialiasing, true);
-        const auto &strokes = layer->engine().strokes();
-        for (const auto &stroke : strokes) {
-            if (stroke.points.isEmpty()) continue;
-            QPen pen(stroke.color, stroke.size, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
-            painter.setPen(pen);
-            QPainterPath path(QPointF(stroke.points.first().x(), stroke.points.first().y()));
-            for (int i=1;i<stroke.points.size();++i) {
-                path.lineTo(stroke.points[i].x(), stroke.points[i].y());
-            }
-            painter.drawPath(path);
-        }
-        painter.end();
-        layerImages.append(img);
-        layerNames.append(layer->name());
-        visibilityFlags.append(layer->isVisible());
-    }
-
-    // Optionally include base image as bottom-most layer (appears last in stack.xml, so push back now)
-    if (!m_baseImage.isNull()) {
-        QImage base = m_baseImage;
-        if (base.size() != targetSize) {
-            base = base.scaled(targetSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
-        }
-        // Base image should be bottom layer => appears last in stack.xml; since we added top-first previously,
-        // we append it now so it is logically at the end of <stack>.
-        layerImages.append(base);
-        layerNames.append(QStringLiteral("Base"));
-        visibilityFlags.append(true);
+    if (!destinationUrl.isValid() || isSaving()) return false;
+    const DocumentSnapshot doc = exportSnapshot();
+    QStringList names; // bottom -> top, like doc.layers
+    for (const auto &ls : doc.layers) {
+        const Layer *layer = layerByUid(ls->uid);
+        names.append(layer ? layer->name() : QString());
     }
+    startSave(destinationUrl, QtConcurrent::run(&SaveJobs::saveLayers, destinationUrl, doc, names, m_saveMergedImage));
+    return true;
+}
 
-    if (layerImages.isEmpty()) {
-        qWarning() << "Canvas.saveOraAllLayers: no layers to save";
-        return false;
-    }
+void Canvas::startSave(const QUrl &destinationUrl, const QFuture<bool> &future) {
+    auto *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::progressValueChanged, this, [this, watcher](int value) {
+        const int range = watcher->progressMaximum() - watcher->progressMinimum();
+        if (range > 0) emit saveProgress(qreal(value - watcher->progressMinimum()) / range);
+    });
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher, destinationUrl]() {
+        const QFuture<bool> done = watcher->future();
+        // A cancelled job has no result (SaveJobs)
+        const bool ok = done.resultCount() > 0 && done.result();
+        if (!ok && done.isCanceled()) qCDebug(lcSave) << "cancelled" << destinationUrl;
+        watcher->deleteLater();
+        m_saveWatcher = nullptr;
+        emit savingChanged();
+        emit saveFinished(ok, destinationUrl);
+    });
+    m_saveWatcher = watcher;
+    watcher->setFuture(future);
+    emit savingChanged();
+}
 
-    // Debug listing
-    qWarning() << "Canvas.saveOraAllLayers: preparing" << layerImages.size() << "layers";
-    for (int i=0;i<layerNames.size();++i) {
-        qWarning() << "  Layer" << i << ": name=" << layerNames[i] << " visible=" << visibilityFlags[i];
-    }
+void Canvas::cancelSave() {
+    // The job stops at its next tile or layer; saveFinished follows once it has
+    if (m_saveWatcher) m_saveWatcher->cancel();
+}
 
-    OraCreator creator;
-    bool ok = creator.saveOraMulti(destinationUrl, layerImages, layerNames, visibilityFlags);
-    if (!ok) {
-        qWarning() << "Canvas.saveOraAllLayers: failed" << destinationUrl;
+void Canvas::setSaveMergedImage(bool enabled) {
+    if (enabled != m_saveMergedImage) {
+        m_saveMergedImage = enabled;
+        emit saveMergedImageChanged();
     }
-    return ok;
 }
 
 bool Canvas::loadOraLayers(const QStringList &layerImagePaths) {
@@ -330,8 +694,10 @@ bool Canvas::loadOraLayers(const QStringList &layerImagePaths) {
         if (l) l->deleteLater();
     }
     m_activeLayerIndex = -1;
+    m_history.clear();
     emit layerCountChanged();
     emit activeLayerIndexChanged();
+    emit historyChanged();
 
     // According to spec, first layer in stack.xml is top-most.
     // We need to append bottom-first so stacking in m_layers is bottom->top.
@@ -342,12 +708,15 @@ bool Canvas::loadOraLayers(const QStringList &layerImagePaths) {
             qWarning() << "Canvas.loadOraLayers: failed to load layer image" << path;
             continue;
         }
+        if (m_layers.isEmpty()) setDocumentSize(img.size()); // layers of an ORA share its size
         Layer* layer = new Layer(const_cast<Canvas*>(this));
         layer->setName(QString("Layer %1").arg(m_layers.size()));
-        layer->setRaster(img.convertToFormat(QImage::Format_RGBA8888));
+        layer->setRaster(PixelOps::toSurface(img));
+        watchLayer(layer);
         m_layers.append(layer);
     }
     emit layerCountChanged();
+    prefetchResampled();
     if (!m_layers.isEmpty()) {
         setActiveLayerIndex(m_layers.size() - 1); // top layer active
     }
@@ -5,8 +5,18 @@
 #include <QList>
 #include <QQmlListProperty>
 #include <QImage>
+#include <QPointF>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QFutureWatcher>
+#include <QUrl>
 
 #include "BrushEngine.h"
+#include "DocumentSnapshot.h"
+#include "StrokePredictor.h"
+#include "StrokeHistory.h"
+#include "StrokeBaker.h"
 
 class GLRenderer;
 
@@ -21,8 +31,40 @@ class Canvas : public QQuickFramebufferObject {
     Q_PROPERTY(int layerCount READ layerCount NOTIFY layerCountChanged)
     Q_PROPERTY(int activeLayerIndex READ activeLayerIndex WRITE setActiveLayerIndex NOTIFY activeLayerIndexChanged)
     Q_PROPERTY(QQmlListProperty<Layer> layers READ layers NOTIFY layerCountChanged)
+    // Fixed pixel size of the document. Strokes are stored in document pixels and
+    // the item shows a zoomed / panned view of it.
+    Q_PROPERTY(QSize documentSize READ documentSize WRITE setDocumentSize NOTIFY documentSizeChanged)
+    // View transform: item position = pan + document position * zoom (logical pixels)
+    Q_PROPERTY(qreal zoom READ zoom WRITE setZoom NOTIFY viewChanged)
+    Q_PROPERTY(QPointF pan READ pan WRITE setPan NOTIFY viewChanged)
+    // Paint with instanced GPU dabs instead of the CPU kernel (default from
+    // TRAHERE_PAINT_BACKEND=gpu); falls back to the CPU when unsupported
+    Q_PROPERTY(bool gpuPainting READ gpuPainting WRITE setGpuPainting NOTIFY gpuPaintingChanged)
+    // Draw a short extrapolated tail ahead of the delivered input while painting
+    // (default from TRAHERE_PREDICT=1); the tail never becomes part of the stroke
+    Q_PROPERTY(bool strokePrediction READ strokePrediction WRITE setStrokePrediction NOTIFY strokePredictionChanged)
+    // Stroke edits (draw, remove, clear) on any layer can be undone and redone
+    Q_PROPERTY(bool canUndo READ canUndo NOTIFY historyChanged)
+    Q_PROPERTY(bool canRedo READ canRedo NOTIFY historyChanged)
+    // Memory cap in MB for undo as a whole: a quarter for the stroke history, the rest
+    // for the renderer's pixel checkpoints that make undo fast. The oldest entries of
+    // each are dropped first.
+    Q_PROPERTY(int historyLimit READ historyLimit WRITE setHistoryLimit NOTIFY historyLimitChanged)
+    // Frames the renderer actually produced over the last second (0 while idle)
+    Q_PROPERTY(qreal framesPerSecond READ framesPerSecond NOTIFY framesPerSecondChanged)
+    // Render thread time per frame spent issuing texture uploads, over the same second
+    Q_PROPERTY(qreal uploadMilliseconds READ uploadMilliseconds NOTIFY framesPerSecondChanged)
+    // A save started by saveOraStrokesOnly / saveOraAllLayers is still running
+    Q_PROPERTY(bool saving READ isSaving NOTIFY savingChanged)
+    // saveOraAllLayers also stores mergedimage.png, the flattened visible layers. On by
+    // default: OpenRaster 0.0.5 requires it and readers use it as a preview.
+    Q_PROPERTY(bool saveMergedImage READ saveMergedImage WRITE setSaveMergedImage NOTIFY saveMergedImageChanged)
 
 public:
+    static constexpr float PredictionHorizonMs = 16.0f; // about one frame ahead
+    static constexpr qreal MinZoom = 1.0 / 64.0;
+    static constexpr qreal MaxZoom = 64.0;
+
     explicit Canvas(QQuickItem *parent = nullptr);
 
     Renderer *createRenderer() const override;
@@ -49,8 +91,27 @@ public:
 
     QVector2D cursorPos() const { return m_cursorPos; }
 
-    Q_INVOKABLE bool undoLastStroke();
+    QSize documentSize() const { return m_documentSize; }
+    void setDocumentSize(const QSize &size);
+    qreal zoom() const { return m_zoom; }
+    void setZoom(qreal zoom);
+    QPointF pan() const { return m_pan; }
+    void setPan(const QPointF &pan);
+    // Zoom by `factor` keeping the document point under `itemPos` in place
+    Q_INVOKABLE void zoomAt(qreal factor, const QPointF &itemPos);
+    Q_INVOKABLE void zoomBy(qreal factor); // about the item centre
+    // Centre the document, scaled down (never up) to fit the item; kept fitted on
+    // resize until the view is zoomed or panned
+    Q_INVOKABLE void fitToView();
+    Q_INVOKABLE void resetZoom(); // 100 %, centred
+    Q_INVOKABLE QPointF mapToDocument(const QPointF &itemPos) const;
+
+    Q_INVOKABLE bool undo();
+    Q_INVOKABLE bool redo();
     Q_INVOKABLE bool removeStroke(int index);
+    // Topmost stroke of the active layer painted under item position (x, y), or -1.
+    // A stroke eraser removes removeStroke(strokeAt(x, y)).
+    Q_INVOKABLE int strokeAt(qreal x, qreal y) const;
     Q_INVOKABLE void clearAllStrokes();
     Q_INVOKABLE int addLayer(const QString &name = QString()); // returns new layer index
     Q_INVOKABLE bool removeLayer(int index);
@@ -59,17 +120,49 @@ public:
     Q_INVOKABLE bool loadBaseImage(const QUrl &imageUrl);
     // Save current composited canvas (base + strokes) to .ora
     Q_INVOKABLE bool saveOra(const QUrl &destinationUrl);
-    // Save only the painted strokes (transparent background, no base image)
+    // The two saves below run in the background on the document as it is when called;
+    // painting goes on meanwhile. They return false without saving if the URL is
+    // invalid or another save is still running. saveProgress reports progress,
+    // saveFinished the outcome; cancelSave() abandons the save and leaves the
+    // destination file as it was.
+    // Save the document without its white background (transparent)
     Q_INVOKABLE bool saveOraStrokesOnly(const QUrl &destinationUrl);
     // Save all layers individually into a multi-layer .ora (OpenRaster) file.
     // Each layer becomes data/layerN.png with N matching its index in internal list.
     // Layer stacking: top-most layer first in stack.xml (reverse of storage order if appended).
     Q_INVOKABLE bool saveOraAllLayers(const QUrl &destinationUrl);
-    // Export composited image as QImage (for testing / other saves)
-    Q_INVOKABLE QImage compositedImage() const;
+    Q_INVOKABLE void cancelSave();
+    bool isSaving() const { return m_saveWatcher != nullptr; }
+    bool saveMergedImage() const { return m_saveMergedImage; }
+    void setSaveMergedImage(bool enabled);
+    // Export composited image as QImage (for testing / other saves): the pixels shown on screen
+    Q_INVOKABLE QImage compositedImage();
     // Load raster layers from extracted ORA layer image paths (absolute).
     Q_INVOKABLE bool loadOraLayers(const QStringList &layerImagePaths);
 
+    bool gpuPainting() const { return m_gpuPainting; }
+    void setGpuPainting(bool enabled);
+
+    bool canUndo() const { return m_history.canUndo(); }
+    bool canRedo() const { return m_history.canRedo(); }
+    int historyLimit() const { return int(m_historyLimitBytes / (1024 * 1024)); }
+    void setHistoryLimit(int megabytes);
+    // The part of historyLimit the stroke history does not get
+    qint64 checkpointLimitBytes() const { return m_historyLimitBytes - m_history.limit(); }
+
+    bool strokePrediction() const { return m_strokePrediction; }
+    void setStrokePrediction(bool enabled);
+    // Provisional tail of the stroke in progress (document coordinates), for the renderer
+    const QList<QVector2D> &predictedTail() const { return m_predictedTail; }
+
+    qreal framesPerSecond() const { return m_framesPerSecond; }
+    qreal uploadMilliseconds() const { return m_uploadMilliseconds; }
+    // Called by the renderer from synchronize() (GUI thread blocked), once per frame
+    void addRenderedFrames(int frames, qint64 uploadNanoseconds);
+
+    // Current document for the renderer; only changed layers are re-snapshotted
+    std::shared_ptr<const DocumentSnapshot> documentSnapshot();
+
     const QImage &baseImage() const { return m_baseImage; }
     bool hasBaseImage() const { return !m_baseImage.isNull(); }
 
@@ -80,17 +173,87 @@ signals:
     void cursorPosChanged();
     void layerCountChanged();
     void activeLayerIndexChanged();
+    void documentSizeChanged();
+    void viewChanged();
+    void gpuPaintingChanged();
+    void strokePredictionChanged();
+    void historyChanged();
+    void historyLimitChanged();
+    void framesPerSecondChanged();
+    void savingChanged();
+    void saveMergedImageChanged();
+    void saveProgress(qreal fraction); // 0..1
+    void saveFinished(bool ok, const QUrl &destinationUrl); // ok is false when cancelled
 
 protected:
     void mousePressEvent(QMouseEvent *event) override;
     void mouseMoveEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    bool event(QEvent *event) override; // tablet events
+    void updatePolish() override;       // delivers the input batched since the last frame
+    void geometryChange(const QRectF &newGeometry, const QRectF &oldGeometry) override;
 
 private:
+    void watchLayer(Layer *layer); // repaint when the layer's look changes
+    void updateFramesPerSecond();
+    void startFramesPerSecond(); // sample the frame counter again, from an idle start
+    void prefetchResampled(); // start scaling rasters to the document size in the background
+    // Pointer / tablet input in item coordinates. Moves are batched until the next frame.
+    void beginInput(const QPointF &itemPos, quint64 timestamp);
+    void queueInput(const QPointF &itemPos, float pressure, quint64 timestamp);
+    void endInput(const QPointF &itemPos, float pressure, quint64 timestamp);
+    void flushInput();
+    quint64 inputTime() const; // now, on the clock of the input event timestamps
+    Layer *layerByUid(quint64 uid) const;
+    // Current document for the export paths, with a fallback size before the item has one
+    DocumentSnapshot exportSnapshot();
+    // Track a background save job (see saveOraAllLayers)
+    void startSave(const QUrl &destinationUrl, const QFuture<bool> &future);
+    // Bake the layer's oldest strokes into its raster in the background when it has
+    // grown past m_bakePolicy (disabled with TRAHERE_BAKE=0)
+    void maybeBake(Layer *layer);
+    void finishBake(const StrokeBaker::Job &job, const QImage &baked);
+    void strokesEdited(); // after any stroke edit: notify and repaint
+
     QColor m_brushColor;
     float m_brushSize;
     QVector2D m_cursorPos;
     QList<Layer*> m_layers;
     int m_activeLayerIndex = -1;
     QImage m_baseImage;
+    QSize m_documentSize;
+    qreal m_zoom = 1.0;
+    QPointF m_pan;
+    bool m_fitView = true;   // refit on resize (until the user zooms or pans)
+    bool m_panning = false;  // middle-button drag in progress
+    QPointF m_panAnchor;     // item position of the last drag event
+    bool m_inputActive = false;       // pen or button down
+    QList<InputSample> m_pendingInput; // samples not yet given to the engine
+    bool m_cursorMoved = false;       // cursorPosChanged pending for the next frame
+    bool m_strokePrediction = false;
+    StrokePredictor m_predictor;
+    QList<QVector2D> m_predictedTail;
+    QTimer m_tailTimer;                 // clears a stale tail when input stops
+    quint64 m_newestSampleTime = 0;     // timestamp of the newest sample
+    QElapsedTimer m_newestSampleClock;  // started when it arrived
+    bool m_gpuPainting = false;
+    // Strokes are small next to the pixels kept for them: the stroke history gets
+    // 1 / HistoryShare of historyLimit, the tile checkpoints the rest
+    static constexpr int HistoryShare = 4;
+    qint64 m_historyLimitBytes = 256 * 1024 * 1024;
+    StrokeHistory m_history{m_historyLimitBytes / HistoryShare};
+    bool m_autoBake = true;
+    StrokeBaker::Policy m_bakePolicy;
+    QSet<quint64> m_baking; // layers with a bake job in flight
+    QFutureWatcher<bool> *m_saveWatcher = nullptr; // save in progress
+    bool m_saveMergedImage = true;
+    QTimer m_fpsTimer;
+    QElapsedTimer m_fpsClock;
+    int m_framesSinceTick = 0;
+    qreal m_framesPerSecond = 0.0;
+    qint64 m_uploadNsSinceTick = 0;
+    qreal m_uploadMilliseconds = 0.0;
+    std::shared_ptr<const DocumentSnapshot> m_snapshot;
+    quint64 m_snapshotGeneration = 0;
 };
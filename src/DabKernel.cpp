@@ -0,0 +1,332 @@
+#include "DabKernel.h"
+#include "DabMaskCache.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DAB_KERNEL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define DAB_TARGET(features)
+#else
+#define DAB_TARGET(features) __attribute__((target(features)))
+#endif
+#endif
+
+namespace DabKernel {
+
+namespace {
+
+// Per-dab constants shared by every row implementation. All blending is integer:
+// srcA = cov * alpha / 16, out = colour * srcA / 255 + dst * (255 - srcA) / 255, each
+// rounded. Taking srcA straight from the sample count rounds it only once, which is
+// what keeps the result within 1 LSB of blending in floating point.
+struct DabParams {
+    float cx, cy;
+    float r;             // radius, at least 0.5
+    uint16_t alpha;      // brush alpha 0..255
+    uint16_t color[4];   // straight source colour 0..255, alpha slot fixed at 255
+};
+
+// n pixels starting at `px` with coverage (0..Samples) from a mask row
+using MaskRowFn = void (*)(uint32_t *px, int n, const uint8_t *cov, const DabParams &p);
+
+// Exact x / 255 rounded, for x in 0..255*255
+inline uint32_t div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Source alpha for a coverage of `cov` samples: cov * alpha / 16 rounded
+inline uint32_t sourceAlpha(uint32_t cov, uint32_t alpha) {
+    return (cov * alpha + Samples / 2) >> 4;
+}
+
+void maskRowScalar(uint32_t *px, int n, const uint8_t *cov, const DabParams &p) {
+    for (int i = 0; i < n; ++i) {
+        if (cov[i] == 0) continue;
+        const uint32_t a = sourceAlpha(cov[i], p.alpha);
+        if (a == 0) continue;
+        const uint32_t inv = 255 - a;
+        uint8_t *c = reinterpret_cast<uint8_t *>(px + i); // RGBA8888 byte order
+        c[0] = uint8_t(div255(p.color[0] * a + c[0] * inv));
+        c[1] = uint8_t(div255(p.color[1] * a + c[1] * inv));
+        c[2] = uint8_t(div255(p.color[2] * a + c[2] * inv));
+        c[3] = uint8_t(div255(255 * a + c[3] * inv));
+    }
+}
+
+#ifdef DAB_KERNEL_X86
+
+// Pixels are widened to 16 bits per channel (two pixels per 128 bits); every product
+// and sum stays below 65536, so unsigned 16-bit lanes hold them exactly.
+
+DAB_TARGET("sse4.1")
+inline __m128i div255x8(__m128i x) {
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// sourceAlpha() for 8 coverage counts
+DAB_TARGET("sse4.1")
+inline __m128i sourceAlphax8(__m128i cov, __m128i alpha) {
+    return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(cov, alpha), _mm_set1_epi16(Samples / 2)), 4);
+}
+
+DAB_TARGET("avx2")
+inline __m256i div255x16(__m256i x) {
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+// srcA for up to 8 coverage bytes, each repeated 4 times (one per channel):
+// returns bytes a0 a0 a0 a0 a1 ... for pixels [first, first + 4)
+DAB_TARGET("sse4.1")
+inline __m128i expandAlpha(__m128i alphaBytes, int first) {
+    const __m128i pattern = _mm_add_epi8(_mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3),
+                                         _mm_set1_epi8(char(first)));
+    return _mm_shuffle_epi8(alphaBytes, pattern);
+}
+
+DAB_TARGET("sse4.1")
+void maskRowSse41(uint32_t *px, int n, const uint8_t *cov, const DabParams &p) {
+    const __m128i alpha = _mm_set1_epi16(short(p.alpha));
+    const __m128i color = _mm_setr_epi16(short(p.color[0]), short(p.color[1]), short(p.color[2]), 255,
+                                         short(p.color[0]), short(p.color[1]), short(p.color[2]), 255);
+    const __m128i full = _mm_set1_epi16(255);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint32_t c4;
+        std::memcpy(&c4, cov + i, 4);
+        if (c4 == 0) continue;
+        const __m128i a16 = sourceAlphax8(_mm_cvtepu8_epi16(_mm_cvtsi32_si128(int(c4))), alpha);
+        const __m128i aRep = expandAlpha(_mm_packus_epi16(a16, a16), 0);
+        const __m128i aLo = _mm_cvtepu8_epi16(aRep);
+        const __m128i aHi = _mm_cvtepu8_epi16(_mm_srli_si128(aRep, 8));
+
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(px + i));
+        const __m128i dLo = _mm_cvtepu8_epi16(d);
+        const __m128i dHi = _mm_cvtepu8_epi16(_mm_srli_si128(d, 8));
+        const __m128i oLo = div255x8(_mm_add_epi16(_mm_mullo_epi16(color, aLo), _mm_mullo_epi16(dLo, _mm_sub_epi16(full, aLo))));
+        const __m128i oHi = div255x8(_mm_add_epi16(_mm_mullo_epi16(color, aHi), _mm_mullo_epi16(dHi, _mm_sub_epi16(full, aHi))));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(px + i), _mm_packus_epi16(oLo, oHi));
+    }
+    if (i < n) maskRowScalar(px + i, n - i, cov + i, p);
+}
+
+DAB_TARGET("avx2")
+void maskRowAvx2(uint32_t *px, int n, const uint8_t *cov, const DabParams &p) {
+    const __m128i alpha = _mm_set1_epi16(short(p.alpha));
+    const __m256i color = _mm256_setr_epi16(short(p.color[0]), short(p.color[1]), short(p.color[2]), 255,
+                                            short(p.color[0]), short(p.color[1]), short(p.color[2]), 255,
+                                            short(p.color[0]), short(p.color[1]), short(p.color[2]), 255,
+                                            short(p.color[0]), short(p.color[1]), short(p.color[2]), 255);
+    const __m256i full = _mm256_set1_epi16(255);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t c8;
+        std::memcpy(&c8, cov + i, 8);
+        if (c8 == 0) continue;
+        const __m128i c16 = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(cov + i)));
+        const __m128i a16 = sourceAlphax8(c16, alpha);
+        const __m128i aBytes = _mm_packus_epi16(a16, a16);
+        const __m256i aLo = _mm256_cvtepu8_epi16(expandAlpha(aBytes, 0)); // pixels 0..3
+        const __m256i aHi = _mm256_cvtepu8_epi16(expandAlpha(aBytes, 4)); // pixels 4..7
+
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(px + i));
+        const __m256i dLo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(d));
+        const __m256i dHi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(d, 1));
+        const __m256i oLo = div255x16(_mm256_add_epi16(_mm256_mullo_epi16(color, aLo), _mm256_mullo_epi16(dLo, _mm256_sub_epi16(full, aLo))));
+        const __m256i oHi = div255x16(_mm256_add_epi16(_mm256_mullo_epi16(color, aHi), _mm256_mullo_epi16(dHi, _mm256_sub_epi16(full, aHi))));
+        // packus works per 128-bit lane; restore pixel order afterwards
+        const __m256i packed = _mm256_packus_epi16(oLo, oHi);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(px + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    if (i < n) maskRowSse41(px + i, n - i, cov + i, p);
+}
+
+bool cpuHasSse41() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 19)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+bool cpuHasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx) return false;
+    if ((_xgetbv(0) & 0x6) != 0x6) return false; // OS saves YMM state
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // DAB_KERNEL_X86
+
+Isa detectIsa() {
+    Isa best = Isa::Scalar;
+    if (isSupported(Isa::AVX2)) best = Isa::AVX2;
+    else if (isSupported(Isa::SSE41)) best = Isa::SSE41;
+    // Optional override, never above what the CPU supports
+    if (const char *env = std::getenv("TRAHERE_DAB_ISA")) {
+        Isa wanted = best;
+        if (std::strcmp(env, "scalar") == 0) wanted = Isa::Scalar;
+        else if (std::strcmp(env, "sse41") == 0) wanted = Isa::SSE41;
+        else if (std::strcmp(env, "avx2") == 0) wanted = Isa::AVX2;
+        if (static_cast<int>(wanted) < static_cast<int>(best)) best = wanted;
+    }
+    return best;
+}
+
+MaskRowFn maskRowFunction(Isa isa) {
+    switch (isa) {
+#ifdef DAB_KERNEL_X86
+    case Isa::AVX2: return maskRowAvx2;
+    case Isa::SSE41: return maskRowSse41;
+#endif
+    default: return maskRowScalar;
+    }
+}
+
+DabParams makeParams(float cx, float cy, float radius, const Color &color) {
+    auto to8 = [](float v) { return uint16_t(std::lround(std::clamp(v, 0.0f, 1.0f) * 255.0f)); };
+    DabParams p;
+    p.cx = cx;
+    p.cy = cy;
+    p.r = std::max(0.5f, radius);
+    p.alpha = to8(color.a);
+    p.color[0] = to8(color.r);
+    p.color[1] = to8(color.g);
+    p.color[2] = to8(color.b);
+    p.color[3] = 255;
+    return p;
+}
+
+} // namespace
+
+Isa activeIsa() {
+    static const Isa isa = detectIsa();
+    return isa;
+}
+
+bool isSupported(Isa isa) {
+    switch (isa) {
+#ifdef DAB_KERNEL_X86
+    case Isa::AVX2: return cpuHasAvx2();
+    case Isa::SSE41: return cpuHasSse41();
+#endif
+    case Isa::Scalar: return true;
+    default: return false;
+    }
+}
+
+const char *isaName(Isa isa) {
+    switch (isa) {
+    case Isa::AVX2: return "avx2";
+    case Isa::SSE41: return "sse4.1";
+    default: return "scalar";
+    }
+}
+
+QRect stampCircle(const Surface &dst, float cx, float cy, float radius, const Color &color, Isa isa) {
+    if (radius > DabMaskCache::MaxRadius) return stampCircleExact(dst, cx, cy, radius, color, isa);
+    const MaskRowFn maskRowFn = maskRowFunction(isa);
+
+    const DabParams p = makeParams(cx, cy, radius, color);
+    if (p.alpha == 0 || !dst.bits) return QRect();
+
+    // Split the centre into its pixel and a quantized phase inside that pixel
+    constexpr int steps = DabMaskCache::PhaseSteps;
+    int ix = static_cast<int>(std::floor(cx));
+    int iy = static_cast<int>(std::floor(cy));
+    int phaseX = static_cast<int>(std::lround((cx - ix) * steps));
+    int phaseY = static_cast<int>(std::lround((cy - iy) * steps));
+    if (phaseX == steps) { ++ix; phaseX = 0; }
+    if (phaseY == steps) { ++iy; phaseY = 0; }
+    const std::shared_ptr<const DabMaskCache::Mask> mask = DabMaskCache::instance().mask(radius, phaseX, phaseY);
+
+    const int left = ix - mask->origin;
+    const int top = iy - mask->origin;
+    const int clipX1 = dst.originX + dst.width - 1;
+    const int clipY1 = dst.originY + dst.height - 1;
+    int x0 = INT_MAX, x1 = INT_MIN, y0 = INT_MAX, y1 = INT_MIN;
+    for (int j = 0; j < mask->size; ++j) {
+        const int y = top + j;
+        if (y < dst.originY || y > clipY1) continue;
+        const int xs = std::max(left + mask->spanStart[j], dst.originX);
+        const int xe = std::min(left + mask->spanEnd[j], clipX1);
+        if (xs > xe) continue;
+        uint32_t *row = reinterpret_cast<uint32_t *>(dst.bits + static_cast<size_t>(y - dst.originY) * dst.bytesPerLine);
+        const uint8_t *cov = mask->coverage.data() + size_t(j) * size_t(mask->size) + size_t(xs - left);
+        maskRowFn(row + (xs - dst.originX), xe - xs + 1, cov, p);
+        x0 = std::min(x0, xs);
+        x1 = std::max(x1, xe);
+        y0 = std::min(y0, y);
+        y1 = y;
+    }
+    if (x0 > x1) return QRect();
+    return QRect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+QRect stampCircleExact(const Surface &dst, float cx, float cy, float radius, const Color &color, Isa isa) {
+    const MaskRowFn maskRowFn = maskRowFunction(isa);
+
+    const DabParams p = makeParams(cx, cy, radius, color);
+    if (p.alpha == 0 || !dst.bits) return QRect();
+
+    // Samples lie within 0.375 px of their pixel centre (on each axis), so pixel
+    // centres further than r + 0.375 from the dab centre on either axis stay untouched
+    const float reach = p.r + 0.375f;
+    const int x0 = std::max(dst.originX, static_cast<int>(std::floor(cx - reach - 0.5f)));
+    const int x1 = std::min(dst.originX + dst.width - 1, static_cast<int>(std::ceil(cx + reach - 0.5f)));
+    const int y0 = std::max(dst.originY, static_cast<int>(std::floor(cy - reach - 0.5f)));
+    const int y1 = std::min(dst.originY + dst.height - 1, static_cast<int>(std::ceil(cy + reach - 0.5f)));
+    if (x0 > x1 || y0 > y1) return QRect();
+
+    // Coverage for one row at a time. Pixels whose centre lies inside r - 0.54 have
+    // every sample inside: they are filled without testing (pixelCoverage() would
+    // give the same), the rest of the row's chord goes through pixelCoverage().
+    thread_local std::vector<uint8_t> cov;
+    const float full = p.r - 0.54f; // beyond the sample farthest from the centre, 0.375 * sqrt(2)
+    const float fullSq = full > 0.0f ? full * full : -1.0f;
+    const float outer = p.r + 0.70710678f; // pixelCoverage() is 0 from there on
+    const float outerSq = outer * outer;
+    for (int y = y0; y <= y1; ++y) {
+        const float py = (float)y + 0.5f;
+        const float dy = py - cy;
+        const float dy2 = dy * dy;
+        if (dy2 >= outerSq) continue;
+        // Tighten the span to this row's chord of the outer circle
+        const float half = std::sqrt(outerSq - dy2);
+        const int xs = std::max(x0, static_cast<int>(std::floor(cx - half - 0.5f)));
+        const int xe = std::min(x1, static_cast<int>(std::ceil(cx + half - 0.5f)));
+        if (xs > xe) continue;
+        cov.resize(size_t(xe - xs + 1));
+        for (int x = xs; x <= xe; ++x) {
+            const float px = (float)x + 0.5f;
+            const float dx = px - cx;
+            cov[x - xs] = dx * dx + dy2 < fullSq ? uint8_t(Samples) : uint8_t(pixelCoverage(px, py, cx, cy, p.r));
+        }
+        uint32_t *row = reinterpret_cast<uint32_t *>(dst.bits + static_cast<size_t>(y - dst.originY) * dst.bytesPerLine);
+        maskRowFn(row + (xs - dst.originX), xe - xs + 1, cov.data(), p);
+    }
+    return QRect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+} // namespace DabKernel
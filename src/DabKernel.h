@@ -0,0 +1,92 @@
+#pragma once
+#include <QRect>
+#include <cstdint>
+
+// Round brush dab rasterizer used for all CPU stamping.
+//
+// Coverage is that of the original renderer: the number of samples of a 4x4 grid in
+// the pixel that lie inside the circle, so stampCircleExact() stays within 1 LSB of
+// it. Only the thin ring of pixels straddling the edge is sampled; the signed distance
+// of the pixel centre settles every other pixel as fully inside or outside. Dabs up to
+// DabMaskCache::MaxRadius reuse that coverage from cached masks (radius and subpixel
+// phase quantized, see stampCircle() for what that changes), so stamping is a
+// mask-times-colour blend. The source is blended
+// premultiplied source-over into an RGBA8888 surface, which may be premultiplied
+// (layer surfaces) or opaque (display buffer; alpha stays 255).
+//
+// Rows are processed 8 pixels at a time with AVX2 or 4 at a time with SSE4.1; the
+// implementation is chosen once at runtime from the CPU features, with a scalar
+// fallback. All of them write the same bytes. TRAHERE_DAB_ISA=scalar|sse41|avx2
+// forces a specific path (capped to what the CPU supports) for comparisons.
+namespace DabKernel {
+
+enum class Isa { Scalar, SSE41, AVX2 };
+
+// Pixel rectangle of a larger canvas: bits[0] is canvas pixel (originX, originY).
+// Dab centres are always given in canvas coordinates, so stamping through a sub-view
+// (e.g. one tile) writes exactly the same values as stamping the whole canvas.
+struct Surface {
+    uint8_t *bits = nullptr;
+    int width = 0;
+    int height = 0;
+    int bytesPerLine = 0;
+    int originX = 0;
+    int originY = 0;
+};
+
+// Straight (non-premultiplied) colour, components in 0..1
+struct Color {
+    float r = 0.0f, g = 0.0f, b = 0.0f, a = 1.0f;
+};
+
+// Coverage is counted in samples, 0..Samples
+constexpr int Samples = 16;
+
+// Samples of the pixel centred at (px, py) inside the circle of radius `r` (at least
+// 0.5) centred at (cx, cy). Centres within r - sqrt(2)/2 are fully covered and
+// centres beyond r + sqrt(2)/2 not at all; the rest are sampled on a 4x4 grid.
+inline int pixelCoverage(float px, float py, float cx, float cy, float r) {
+    constexpr float root2over2 = 0.70710678f;
+    static constexpr float offs[4] = {-0.375f, -0.125f, 0.125f, 0.375f};
+    const float dxc = px - cx;
+    const float dyc = py - cy;
+    const float centerDistSq = dxc * dxc + dyc * dyc;
+    const float inner = r > root2over2 ? r - root2over2 : 0.0f;
+    if (centerDistSq <= inner * inner) return Samples;
+    const float outer = r + root2over2;
+    if (centerDistSq >= outer * outer) return 0;
+    const float rSq = r * r;
+    int inside = 0;
+    for (float oy : offs) {
+        const float dy = (py + oy) - cy;
+        for (float ox : offs) {
+            const float dx = (px + ox) - cx;
+            if (dx * dx + dy * dy <= rSq) ++inside;
+        }
+    }
+    return inside;
+}
+
+// Implementation picked for this process
+Isa activeIsa();
+// Whether this CPU can run `isa`
+bool isSupported(Isa isa);
+const char *isaName(Isa isa);
+
+// Blend one dab centred at (cx, cy) in canvas pixel coordinates. Returns the rectangle
+// (canvas coordinates) of pixels that may have changed, empty when the dab misses the surface.
+// `isa` must be supported; other implementations than the active one are for comparisons.
+//
+// Up to DabMaskCache::MaxRadius this writes exactly what stampCircleExact() writes for
+// the centre rounded to the nearest 1 / DabMaskCache::PhaseSteps px and the radius to
+// the nearest 1 / DabMaskCache::RadiusSteps px. Dab centres are sub-pixel, so that
+// moves each axis of the centre and the radius by up to 1/8 px: the edge shifts by up
+// to about 0.3 px, which can change the coverage of an edge pixel by up to half its
+// samples (Samples / 2, half the dab's alpha). Pixels away from the edge are the same.
+QRect stampCircle(const Surface &dst, float cx, float cy, float radius, const Color &color, Isa isa = activeIsa());
+// Same dab with pixelCoverage() evaluated per pixel at the exact centre and radius (no
+// mask cache)
+QRect stampCircleExact(const Surface &dst, float cx, float cy, float radius, const Color &color,
+                       Isa isa = activeIsa());
+
+} // namespace DabKernel
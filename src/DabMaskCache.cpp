@@ -0,0 +1,111 @@
+#include "DabMaskCache.h"
+#include "DabKernel.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <utility>
+
+DabMaskCache &DabMaskCache::instance() {
+    static DabMaskCache cache;
+    return cache;
+}
+
+DabMaskCache::DabMaskCache(size_t budgetBytes)
+    : m_budget(budgetBytes)
+{
+}
+
+std::shared_ptr<const DabMaskCache::Mask> DabMaskCache::mask(float radius, int phaseX, int phaseY) {
+    const int radiusQ = std::max(1, static_cast<int>(std::lround(radius * RadiusSteps)));
+    const uint64_t key = (uint64_t(radiusQ) << 16) | (uint64_t(phaseX & 0xFF) << 8) | uint64_t(phaseY & 0xFF);
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        auto it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            // Skip the store when it would not change anything, which keeps the entry's
+            // cache line shared between threads stamping the same dab
+            const uint64_t now = m_clock.load(std::memory_order_relaxed);
+            if (it->second.lastUse.load(std::memory_order_relaxed) != now)
+                it->second.lastUse.store(now, std::memory_order_relaxed);
+            return it->second.mask;
+        }
+    }
+    // Build outside the lock; a concurrent miss on the same key just builds it twice
+    std::shared_ptr<const Mask> built = build(radiusQ, phaseX, phaseY);
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    auto [it, inserted] = m_entries.try_emplace(key);
+    if (!inserted) return it->second.mask;
+    it->second.mask = built;
+    it->second.lastUse.store(m_clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_bytes += built->bytes();
+    evictLocked(key);
+    return built;
+}
+
+std::shared_ptr<const DabMaskCache::Mask> DabMaskCache::build(int radiusQ, int phaseX, int phaseY) {
+    auto m = std::make_shared<Mask>();
+    const float r = std::max(0.5f, float(radiusQ) / RadiusSteps);
+    // Centre position inside its pixel
+    const float qx = float(phaseX) / PhaseSteps;
+    const float qy = float(phaseY) / PhaseSteps;
+    // Covered pixel centres lie within r + sqrt(2)/2 of the dab centre
+    const int reach = static_cast<int>(std::ceil(r + 0.70710678f)) + 1;
+    m->origin = reach;
+    m->size = 2 * reach + 1;
+    m->coverage.assign(size_t(m->size) * size_t(m->size), 0);
+    m->spanStart.assign(m->size, m->size);
+    m->spanEnd.assign(m->size, -1);
+    for (int j = 0; j < m->size; ++j) {
+        const float py = float(j - reach) + 0.5f;
+        uint8_t *row = m->coverage.data() + size_t(j) * size_t(m->size);
+        for (int i = 0; i < m->size; ++i) {
+            const int c = DabKernel::pixelCoverage(float(i - reach) + 0.5f, py, qx, qy, r);
+            if (c == 0) continue;
+            row[i] = static_cast<uint8_t>(c);
+            m->spanStart[j] = std::min(m->spanStart[j], i);
+            m->spanEnd[j] = std::max(m->spanEnd[j], i);
+        }
+    }
+    return m;
+}
+
+void DabMaskCache::evictLocked(uint64_t keep) {
+    if (m_bytes <= m_budget || m_entries.size() <= 1) return;
+    // Oldest first; ties go by key so that eviction does not depend on hash order
+    std::vector<std::pair<uint64_t, uint64_t>> byUse; // (last use, key)
+    byUse.reserve(m_entries.size());
+    for (const auto &[key, entry] : m_entries) byUse.emplace_back(entry.lastUse.load(std::memory_order_relaxed), key);
+    std::sort(byUse.begin(), byUse.end());
+    // Go an eighth below the budget, so that the misses that follow do not each sort
+    // the whole cache again. Keep at least `keep` even if it alone exceeds the budget.
+    const size_t target = m_budget - m_budget / 8;
+    if (keep == NoKey) keep = byUse.back().second;
+    for (size_t i = 0; m_bytes > target && i < byUse.size(); ++i) {
+        if (byUse[i].second == keep) continue;
+        auto it = m_entries.find(byUse[i].second);
+        m_bytes -= it->second.mask->bytes();
+        m_entries.erase(it);
+    }
+}
+
+void DabMaskCache::setBudget(size_t budgetBytes) {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    m_budget = budgetBytes;
+    evictLocked(NoKey);
+}
+
+size_t DabMaskCache::budget() const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_budget;
+}
+
+size_t DabMaskCache::bytesUsed() const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+void DabMaskCache::clear() {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    m_entries.clear();
+    m_bytes = 0;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+// Precomputed coverage masks for round dabs.
+//
+// A stroke stamps the same radius thousands of times, so coverage is computed once per
+// (quantized radius, quantized subpixel phase) and reused. Radii are quantized to
+// 1/RadiusSteps px and the dab centre's fractional position to PhaseSteps x PhaseSteps
+// phases. Masks are built lazily and the cache evicts least-recently-used masks once
+// the byte budget is exceeded. Lookups are thread-safe; a returned mask stays valid
+// for as long as the caller holds it, even if it is evicted meanwhile.
+// Hits, by far the common case, only take a shared lock: recency is a per-entry use
+// tick written atomically, so every thread stamping dabs can look masks up at once.
+// Misses and eviction take the lock exclusively.
+class DabMaskCache {
+public:
+    static constexpr int PhaseSteps = 4;
+    static constexpr int RadiusSteps = 4;
+    // Larger dabs are sampled pixel by pixel (DabKernel::stampCircleExact()): at this
+    // radius a mask is already 517 x 517 bytes (about 267 KB) per phase, 16 phases per
+    // radius step
+    static constexpr float MaxRadius = 256.0f;
+
+    struct Mask {
+        int size = 0;    // masks are square: size x size pixels
+        int origin = 0;  // mask pixel (origin, origin) is the pixel containing the dab centre
+        std::vector<uint8_t> coverage;     // size * size, row-major, DabKernel::pixelCoverage()
+        std::vector<int> spanStart;        // per row: first covered column (or size if none)
+        std::vector<int> spanEnd;          // per row: last covered column (or -1 if none)
+        size_t bytes() const { return coverage.size() + (spanStart.size() + spanEnd.size()) * sizeof(int); }
+    };
+
+    static DabMaskCache &instance();
+
+    explicit DabMaskCache(size_t budgetBytes = 64u * 1024u * 1024u);
+
+    // Mask for radius `radius` with the centre at fractional pixel offset (phaseX, phaseY),
+    // given in PhaseSteps units (0..PhaseSteps-1).
+    std::shared_ptr<const Mask> mask(float radius, int phaseX, int phaseY);
+
+    void setBudget(size_t budgetBytes);
+    size_t budget() const;
+    size_t bytesUsed() const;
+    void clear();
+
+private:
+    static std::shared_ptr<const Mask> build(int radiusQ, int phaseX, int phaseY);
+    static constexpr uint64_t NoKey = ~uint64_t(0);
+    // Once over budget, evict least recently used masks down to 7/8 of it, sparing
+    // `keep` (the most recently used one for NoKey)
+    void evictLocked(uint64_t keep);
+
+    struct Entry {
+        std::shared_ptr<const Mask> mask;
+        std::atomic<uint64_t> lastUse{0}; // m_clock at the latest lookup
+    };
+
+    mutable std::shared_mutex m_mutex;
+    size_t m_budget;
+    size_t m_bytes = 0;
+    // Advanced by every insertion, so hits only read it; entries used since the same
+    // insertion count as equally recent
+    std::atomic<uint64_t> m_clock{0};
+    std::unordered_map<uint64_t, Entry> m_entries;
+};
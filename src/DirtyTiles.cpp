@@ -0,0 +1,126 @@
+#include "DirtyTiles.h"
+#include <algorithm>
+
+void DirtyTiles::resize(const QSize &surfaceSize) {
+    m_size = surfaceSize;
+    m_cols = (std::max(0, surfaceSize.width()) + TileSize - 1) / TileSize;
+    m_rows = (std::max(0, surfaceSize.height()) + TileSize - 1) / TileSize;
+    m_bits.assign(size_t(m_cols) * size_t(m_rows), 0);
+    m_dirtyCount = 0;
+}
+
+void DirtyTiles::markRect(const QRect &pixelRect) {
+    const QRect r = pixelRect.intersected(QRect(QPoint(0, 0), m_size));
+    if (r.isEmpty()) return;
+    const int c0 = r.left() / TileSize;
+    const int c1 = r.right() / TileSize;
+    const int r0 = r.top() / TileSize;
+    const int r1 = r.bottom() / TileSize;
+    for (int ty = r0; ty <= r1; ++ty) {
+        unsigned char *row = m_bits.data() + size_t(ty) * size_t(m_cols);
+        for (int tx = c0; tx <= c1; ++tx) {
+            if (!row[tx]) { row[tx] = 1; ++m_dirtyCount; }
+        }
+    }
+}
+
+void DirtyTiles::markAll() {
+    std::fill(m_bits.begin(), m_bits.end(), 1);
+    m_dirtyCount = int(m_bits.size());
+}
+
+void DirtyTiles::merge(const DirtyTiles &other) {
+    if (other.m_size != m_size || other.isEmpty()) return;
+    for (size_t i = 0; i < m_bits.size(); ++i) {
+        if (other.m_bits[i] && !m_bits[i]) { m_bits[i] = 1; ++m_dirtyCount; }
+    }
+}
+
+void DirtyTiles::clear() {
+    if (m_dirtyCount == 0) return;
+    std::fill(m_bits.begin(), m_bits.end(), 0);
+    m_dirtyCount = 0;
+}
+
+QRect DirtyTiles::tileRectToPixels(const QRect &tiles) const {
+    return QRect(tiles.left() * TileSize, tiles.top() * TileSize,
+                 tiles.width() * TileSize, tiles.height() * TileSize)
+        .intersected(QRect(QPoint(0, 0), m_size));
+}
+
+QList<QRect> DirtyTiles::rects(int maxRects) const {
+    QList<QRect> result;
+    if (m_dirtyCount == 0) return result;
+    if (m_dirtyCount == int(m_bits.size())) {
+        result.append(QRect(QPoint(0, 0), m_size));
+        return result;
+    }
+
+    // 1) Horizontal runs of dirty tiles per row; a run continues the rectangle above
+    //    it when both cover exactly the same columns.
+    QList<QRect> tiles;   // finished rectangles, tile units
+    QList<QRect> open;    // rectangles ending on the previous row
+    for (int ty = 0; ty < m_rows; ++ty) {
+        const unsigned char *row = m_bits.data() + size_t(ty) * size_t(m_cols);
+        QList<QRect> next;
+        int tx = 0;
+        while (tx < m_cols) {
+            if (!row[tx]) { ++tx; continue; }
+            const int c0 = tx;
+            while (tx < m_cols && row[tx]) ++tx;
+            const int c1 = tx - 1;
+            bool extended = false;
+            for (int i = 0; i < open.size(); ++i) {
+                if (open[i].left() == c0 && open[i].right() == c1) {
+                    QRect grown = open.takeAt(i);
+                    grown.setBottom(ty);
+                    next.append(grown);
+                    extended = true;
+                    break;
+                }
+            }
+            if (!extended) next.append(QRect(c0, ty, c1 - c0 + 1, 1));
+        }
+        tiles.append(open);
+        open = next;
+    }
+    tiles.append(open);
+
+    // 2) Merge down to maxRects. Pathological patterns are first halved by pairing
+    //    neighbours, then the pair whose bounding box wastes the fewest tiles is joined.
+    maxRects = std::max(1, maxRects);
+    auto area = [](const QRect &r) { return r.width() * r.height(); };
+    while (tiles.size() > 64) {
+        QList<QRect> halved;
+        for (int i = 0; i < tiles.size(); i += 2) {
+            halved.append(i + 1 < tiles.size() ? tiles[i].united(tiles[i + 1]) : tiles[i]);
+        }
+        tiles.swap(halved);
+    }
+    while (tiles.size() > maxRects) {
+        int bestI = 0, bestJ = 1;
+        int bestWaste = -1;
+        for (int i = 0; i < tiles.size(); ++i) {
+            for (int j = i + 1; j < tiles.size(); ++j) {
+                const int waste = area(tiles[i].united(tiles[j])) - area(tiles[i]) - area(tiles[j]);
+                if (bestWaste < 0 || waste < bestWaste) {
+                    bestWaste = waste;
+                    bestI = i;
+                    bestJ = j;
+                }
+            }
+        }
+        tiles[bestI] = tiles[bestI].united(tiles[bestJ]);
+        tiles.removeAt(bestJ);
+    }
+
+    result.reserve(tiles.size());
+    for (const QRect &t : tiles) result.append(tileRectToPixels(t));
+    return result;
+}
+
+QList<QRect> DirtyTiles::takeRects(int maxRects) {
+    QList<QRect> r = rects(maxRects);
+    clear();
+    return r;
+}
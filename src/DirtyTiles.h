@@ -0,0 +1,41 @@
+#pragma once
+#include <QRect>
+#include <QSize>
+#include <QList>
+#include <vector>
+
+// Tracks which fixed-size tiles of a CPU surface changed since the last GPU upload.
+// Painting code marks pixel rectangles; the uploader takes back a handful of
+// coalesced rectangles so upload cost follows the touched area, not the surface size.
+class DirtyTiles {
+public:
+    static constexpr int TileSize = 64;
+
+    // Reset the grid for a surface of the given pixel size (clears all marks).
+    void resize(const QSize &surfaceSize);
+    QSize surfaceSize() const { return m_size; }
+
+    void markRect(const QRect &pixelRect);
+    void markAll();
+    // Mark every tile that is dirty in `other` (must cover the same surface size).
+    void merge(const DirtyTiles &other);
+    void clear();
+
+    bool isEmpty() const { return m_dirtyCount == 0; }
+    int dirtyTileCount() const { return m_dirtyCount; }
+
+    // Dirty area as at most `maxRects` pixel rectangles clipped to the surface.
+    // Rectangles may include some clean tiles when merging was needed.
+    QList<QRect> rects(int maxRects = 8) const;
+    // rects() followed by clear().
+    QList<QRect> takeRects(int maxRects = 8);
+
+private:
+    QRect tileRectToPixels(const QRect &tiles) const;
+
+    QSize m_size;
+    int m_cols = 0;
+    int m_rows = 0;
+    std::vector<unsigned char> m_bits; // one byte per tile, row-major
+    int m_dirtyCount = 0;
+};
@@ -0,0 +1,28 @@
+#pragma once
+#include <QImage>
+#include <QList>
+#include <memory>
+#include "BrushEngine.h"
+
+// Immutable view of the document handed from the GUI thread to the render thread.
+// Canvas::documentSnapshot() returns the previous snapshot when nothing changed and
+// otherwise builds a new one that shares every unchanged layer, so synchronize() takes
+// a pointer and the renderer compares generations instead of copying layer contents.
+struct LayerSnapshot {
+    quint64 uid = 0;       // Layer::uid()
+    quint64 revision = 0;  // Layer::revision() at snapshot time
+    bool visible = true;
+    float opacity = 1.0f;
+    QImage raster;         // optional raster content (implicitly shared)
+    StrokeList strokes;    // committed strokes (chunks shared with the layer)
+    StrokeIndex index;     // spatial index over `strokes` (cells shared with the layer)
+    quint64 strokeRevision = 0;  // BrushEngine::revision() at snapshot time
+    QList<StrokeDamage> damage;  // BrushEngine::damage(): lets a removal redraw just its area
+};
+
+struct DocumentSnapshot {
+    quint64 generation = 0; // bumped for every distinct snapshot
+    QSize size;             // document pixel size; layers are rasterized at this size
+    QList<std::shared_ptr<const LayerSnapshot>> layers; // stacking order: bottom -> top
+    QImage baseImage;       // premultiplied, may be null
+};
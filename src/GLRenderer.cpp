@@ -1,10 +1,18 @@
 #include "GLRenderer.h"
 #include "Canvas.h"
 #include "Layer.h" // ensure complete type for method calls
+#include "DabKernel.h"
+#include "PixelOps.h"
+#include "RasterEngine.h"
+#include "StrokeRasterizer.h"
+#include <QDebug>
 #include <QOpenGLFramebufferObjectFormat>
 #include <QQuickWindow>
-#include <QPainter>
+#include <QOpenGLContext>
+#include <QSet>
+#include <QVector4D>
 #include <cmath>
+#include <cstring>
 #include <algorithm>
 
 GLRenderer::GLRenderer(Canvas *canvas)
@@ -24,36 +32,45 @@ void GLRenderer::synchronize(QQuickFramebufferObject *item) {
     // Called on render thread while GUI thread is blocked; safe to read item state
     auto *canvas = static_cast<Canvas*>(item);
 
-    // Snapshot per-layer content in stacking order (bottom -> top)
-    m_layersSnap.clear();
-    const QList<Layer*> &raw = canvas->rawLayers();
-    for (int li = 0; li < raw.size(); ++li) {
-        Layer* layer = raw.at(li);
-        if (!layer) continue;
-        LayerSnap snap;
-        snap.visible = layer->isVisible();
-        if (snap.visible && layer->hasRaster()) snap.raster = layer->raster();
-        snap.strokes = layer->engine().strokes();
-        m_layersSnap.append(std::move(snap));
-    }
+    // Document content: a shared immutable snapshot, O(1) when nothing changed
+    m_doc = canvas->documentSnapshot();
 
-    // Snapshot active layer in-progress stroke if any
+    // In-progress stroke of the active layer. Only points appended since the last
+    // frame are copied; the renderer keeps its own copy of the points so the GUI
+    // thread's list is never shared (and never detached on the next addPoint).
     Layer* active = canvas->activeLayer();
-    if (active) {
-        m_isDrawingSnap = active->engine().isDrawing();
-        m_currentPointsSnap = active->engine().currentPoints();
-        m_currentColorSnap = active->engine().currentColor();
-        m_currentSizeSnap = active->engine().currentSize();
+    m_isDrawingSnap = active && active->engine().isDrawing();
+    if (m_isDrawingSnap) {
+        const BrushEngine &engine = active->engine();
+        if (m_currentStrokeIdSnap != engine.currentStrokeId()) {
+            m_currentStrokeIdSnap = engine.currentStrokeId();
+            m_currentPointsSnap.clear();
+        }
+        const QList<QVector2D> &pts = engine.currentPoints();
+        for (int i = m_currentPointsSnap.size(); i < pts.size(); ++i) m_currentPointsSnap.append(pts.at(i));
+        m_currentColorSnap = engine.currentColor();
+        m_currentSizeSnap = engine.currentSize();
+        // The live stroke belongs to the active layer and is composited like it
+        m_activeOpacitySnap = active->isVisible() ? float(active->opacity()) : 0.0f;
+        m_predictedTailSnap = canvas->predictedTail();
     } else {
-        m_isDrawingSnap = false;
         m_currentPointsSnap.clear();
+        m_currentStrokeIdSnap = 0;
+        m_predictedTailSnap.clear();
     }
 
     // Snapshot UI-related values
     m_cursorPosSnap = canvas->cursorPos();
     m_brushColorSnap = canvas->brushColor();
     m_brushSizeSnap = canvas->brushSize();
+    m_gpuPaintingSnap = canvas->gpuPainting();
+    m_zoomSnap = canvas->zoom();
+    m_panSnap = canvas->pan();
+    m_checkpoints.setBudget(canvas->checkpointLimitBytes());
     m_dpr = (canvas->window() ? canvas->window()->effectiveDevicePixelRatio() : 1.0);
+
+    canvas->addRenderedFrames(m_framesRendered, m_uploader.takeUploadNanoseconds());
+    m_framesRendered = 0;
 }
 
 void GLRenderer::render() {
@@ -61,26 +78,37 @@ void GLRenderer::render() {
     if (!m_initialized) {
         initializeOpenGLFunctions();
 
-        // Shader for textured quad
-        m_program.addShaderFromSourceCode(QOpenGLShader::Vertex,
+        // Layer compositing: CompositeUnits premultiplied textures blended source-over
+        // in one pass. Opacity 0 disables a unit (hidden layers are simply not bound).
+        m_compositeProgram.addShaderFromSourceCode(QOpenGLShader::Vertex,
             R"(
             attribute vec2 a_pos;
-            attribute vec2 a_uv;
             varying vec2 v_uv;
             void main(){
-                v_uv = a_uv;
+                v_uv = a_pos * 0.5 + 0.5;
                 gl_Position = vec4(a_pos, 0.0, 1.0);
             })");
-        m_program.addShaderFromSourceCode(QOpenGLShader::Fragment,
-            R"(
-            varying vec2 v_uv;
-            uniform sampler2D u_tex;
-            void main(){
-                gl_FragColor = texture2D(u_tex, v_uv);
-            })");
-        m_program.bindAttributeLocation("a_pos", 0);
-        m_program.bindAttributeLocation("a_uv", 1);
-        m_program.link();
+        QString compositeSource = QStringLiteral(
+            "#ifdef GL_ES\n"
+            "precision mediump float;\n"
+            "#endif\n"
+            "varying vec2 v_uv;\n"
+            "uniform float u_opacity[%1];\n").arg(CompositeUnits);
+        for (int unit = 0; unit < CompositeUnits; ++unit)
+            compositeSource += QStringLiteral("uniform sampler2D u_layer%1;\n").arg(unit);
+        compositeSource += QStringLiteral("void main(){\n    vec4 acc = vec4(0.0);\n    vec4 src;\n");
+        for (int unit = 0; unit < CompositeUnits; ++unit) {
+            compositeSource += QStringLiteral("    src = texture2D(u_layer%1, v_uv) * u_opacity[%1];\n"
+                                              "    acc = src + acc * (1.0 - src.a);\n").arg(unit);
+        }
+        compositeSource += QStringLiteral("    gl_FragColor = acc;\n}\n");
+        m_compositeProgram.addShaderFromSourceCode(QOpenGLShader::Fragment, compositeSource);
+        m_compositeProgram.bindAttributeLocation("a_pos", 0);
+        m_compositeProgram.link();
+        m_compositeProgram.bind();
+        for (int unit = 0; unit < CompositeUnits; ++unit)
+            m_compositeProgram.setUniformValue(QStringLiteral("u_layer%1").arg(unit).toLatin1().constData(), unit);
+        m_compositeProgram.release();
 
         // Overlay shader for preview outline (solid color)
         m_overlayProgram.addShaderFromSourceCode(QOpenGLShader::Vertex,
@@ -97,242 +125,114 @@ void GLRenderer::render() {
             })");
         m_overlayProgram.bindAttributeLocation("a_pos", 0);
         m_overlayProgram.link();
-        m_initialized = true;
-    }
 
-    glViewport(0, 0, m_viewportSize.width(), m_viewportSize.height());
-    glClearColor(1.f, 1.f, 1.f, 1.f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    // Prepare CPU buffer if needed (pixel size)
-    if (m_buffer.size() != m_viewportSize) {
-        m_buffer = QImage(m_viewportSize, QImage::Format_RGBA8888);
-        m_buffer.fill(Qt::white);
-        m_rebuildVersion = -1; // force rebuild
-        m_bufferDirty = true;
-    }
-
-    const qreal dpr = m_dpr;
+        // Document view: the composited document as a textured quad at the view transform
+        m_viewProgram.addShaderFromSourceCode(QOpenGLShader::Vertex,
+            R"(
+            attribute vec2 a_pos;
+            attribute vec2 a_uv;
+            varying vec2 v_uv;
+            void main(){
+                v_uv = a_uv;
+                gl_Position = vec4(a_pos, 0.0, 1.0);
+            })");
+        m_viewProgram.addShaderFromSourceCode(QOpenGLShader::Fragment,
+            R"(
+            #ifdef GL_ES
+            precision mediump float;
+            #endif
+            varying vec2 v_uv;
+            uniform sampler2D u_tex;
+            void main(){
+                gl_FragColor = texture2D(u_tex, v_uv);
+            })");
+        m_viewProgram.bindAttributeLocation("a_pos", 0);
+        m_viewProgram.bindAttributeLocation("a_uv", 1);
+        m_viewProgram.link();
 
-    // Paint a filled circle into the CPU buffer at pixel coordinates, skipping pixels already equal to color
-    auto paintCirclePix = [&](float cxPix, float cyPix, const QColor &color, float radiusPix){
-        // Antialiased stamp: per-pixel coverage with fast accept/reject, supersample on edges.
-        const float r = std::max(0.5f, radiusPix);
-        const int rPix = static_cast<int>(std::ceil(r));
-        const int w = m_buffer.width();
-        const int h = m_buffer.height();
-        const int x0 = std::max(0, static_cast<int>(std::floor(cxPix - rPix)));
-        const int x1 = std::min(w - 1, static_cast<int>(std::ceil(cxPix + rPix)));
-        const int y0 = std::max(0, static_cast<int>(std::floor(cyPix - rPix)));
-        const int y1 = std::min(h - 1, static_cast<int>(std::ceil(cyPix + rPix)));
-
-        const float rSq = r * r;
-        constexpr float root2over2 = 0.70710678f;
-        const float inner = std::max(0.0f, r - root2over2);
-        const float innerSq = inner * inner;
-        const float outer = r + root2over2;
-        const float outerSq = outer * outer;
-
-        // Brush color as floats
-        const float sr = color.redF();
-        const float sg = color.greenF();
-        const float sb = color.blueF();
-        const float saBrush = color.alphaF();
-
-        // Supersample grid (4x4) offsets relative to pixel center
-        static const float offs[4] = { -0.375f, -0.125f, 0.125f, 0.375f };
-
-        for (int y = y0; y <= y1; ++y) {
-            QRgb *scan = reinterpret_cast<QRgb*>(m_buffer.scanLine(y));
-            const float pyCenter = (float)y + 0.5f;
-            const float dyc = pyCenter - cyPix;
-            const float dycSq = dyc * dyc;
-            for (int x = x0; x <= x1; ++x) {
-                const float pxCenter = (float)x + 0.5f;
-                const float dxc = pxCenter - cxPix;
-                const float centerDistSq = dxc * dxc + dycSq;
-
-                float coverage = 0.0f;
-                if (centerDistSq <= innerSq) {
-                    coverage = 1.0f; // fully inside
-                } else if (centerDistSq >= outerSq) {
-                    continue; // fully outside
-                } else {
-                    // Edge pixel: 4x4 supersampling
-                    int inside = 0;
-                    for (int jy = 0; jy < 4; ++jy) {
-                        const float oy = offs[jy];
-                        const float sy = pyCenter + oy;
-                        const float dy = sy - cyPix;
-                        for (int ix = 0; ix < 4; ++ix) {
-                            const float ox = offs[ix];
-                            const float sx = pxCenter + ox;
-                            const float dx = sx - cxPix;
-                            const float dsq = dx * dx + dy * dy;
-                            if (dsq <= rSq) ++inside;
-                        }
+        // Predicted stroke tail: one quad per dab with the brush kernel's 4x4 sampled
+        // coverage (DabKernel::pixelCoverage), evaluated in device pixels
+        // (gl_FragCoord uses the same y convention as the NDC mapping here)
+        m_tailProgram.addShaderFromSourceCode(QOpenGLShader::Vertex,
+            R"(
+            attribute vec2 a_pos;
+            attribute vec3 a_dab;
+            varying vec3 v_dab;
+            void main(){
+                v_dab = a_dab;
+                gl_Position = vec4(a_pos, 0.0, 1.0);
+            })");
+        m_tailProgram.addShaderFromSourceCode(QOpenGLShader::Fragment,
+            R"(
+            #ifdef GL_ES
+            precision highp float;
+            #endif
+            varying vec3 v_dab;
+            uniform vec4 u_color;
+            void main(){
+                float r = max(v_dab.z, 0.5);
+                float inside = 0.0;
+                for (int j = 0; j < 4; ++j) {
+                    float dy = (gl_FragCoord.y + (float(j) - 1.5) * 0.25) - v_dab.y;
+                    for (int i = 0; i < 4; ++i) {
+                        float dx = (gl_FragCoord.x + (float(i) - 1.5) * 0.25) - v_dab.x;
+                        inside += dx * dx + dy * dy <= r * r ? 1.0 : 0.0;
                     }
-                    coverage = inside / 16.0f;
-                    if (coverage <= 0.0f) continue;
-                }
-
-                // Blend new color over existing pixel using straight alpha compositing.
-                const float srcA = std::clamp(coverage * saBrush, 0.0f, 1.0f);
-                if (srcA <= 0.0f) continue;
-
-                const QRgb dst = scan[x];
-                const float dr = qRed(dst) / 255.0f;
-                const float dg = qGreen(dst) / 255.0f;
-                const float db = qBlue(dst) / 255.0f;
-                // Destination is opaque (background is opaque white), keep alpha at 1.0
-                const float outR = sr * srcA + dr * (1.0f - srcA);
-                const float outG = sg * srcA + dg * (1.0f - srcA);
-                const float outB = sb * srcA + db * (1.0f - srcA);
-
-                const int ir = (int)std::lround(std::clamp(outR * 255.0f, 0.0f, 255.0f));
-                const int ig = (int)std::lround(std::clamp(outG * 255.0f, 0.0f, 255.0f));
-                const int ib = (int)std::lround(std::clamp(outB * 255.0f, 0.0f, 255.0f));
-                const QRgb out = qRgba(ir, ig, ib, 255);
-                if (out != dst) scan[x] = out;
-            }
-        }
-        m_bufferDirty = true;
-    };
-
-    // Helper to draw a stroke by interpolating between points in pixel space
-    auto drawStrokeInterpolated = [&](const QList<QVector2D>& ptsLogical, const QColor& col, float sizeLogical){
-        const int n = ptsLogical.size();
-        if (n == 0) return;
-        float radiusPix = std::max(0.5f, sizeLogical * 0.5f * (float)dpr);
-        // Always stamp first point
-        {
-            QVector2D p0 = ptsLogical.first() * (float)dpr;
-            paintCirclePix(p0.x(), p0.y(), col, radiusPix);
-        }
-        for (int i = 1; i < n; ++i) {
-            QVector2D a = ptsLogical[i-1] * (float)dpr;
-            QVector2D b = ptsLogical[i] * (float)dpr;
-            QVector2D d = b - a;
-            float len = std::sqrt(d.lengthSquared());
-            if (len < 1e-3f) {
-                paintCirclePix(b.x(), b.y(), col, radiusPix);
-                continue;
-            }
-            QVector2D dir = d / len;
-            float step = std::max(1.0f, radiusPix * 0.5f); // dense enough to avoid gaps
-            float t = 0.0f;
-            while (t <= len) {
-                QVector2D p = a + dir * t;
-                paintCirclePix(p.x(), p.y(), col, radiusPix);
-                t += step;
-            }
-            // Ensure we hit the exact end point
-            paintCirclePix(b.x(), b.y(), col, radiusPix);
-        }
-    };
-
-    // Rebuild buffer from all committed strokes only if stroke count changed or forced
-    // Compute a simple version stamp from visible raster count + total strokes
-    int totalStrokes = 0;
-    int rasterCount = 0;
-    for (const auto &ls : m_layersSnap) {
-        totalStrokes += ls.strokes.size();
-        if (ls.visible && !ls.raster.isNull()) ++rasterCount;
-    }
-    int contentVersion = totalStrokes + rasterCount * 1000003;
-    if (m_rebuildVersion != contentVersion) {
-        // Start with background (white or base image if set)
-        if (m_canvas && m_canvas->hasBaseImage()) {
-            QImage base = m_canvas->baseImage();
-            if (base.size() != m_buffer.size()) {
-                base = base.scaled(m_buffer.size(), Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
-            }
-            if (base.format() != QImage::Format_RGBA8888) {
-                base = base.convertToFormat(QImage::Format_RGBA8888);
-            }
-            m_buffer = base;
-        } else {
-            m_buffer.fill(Qt::white);
-        }
-        // Draw per layer: raster first, then its strokes
-        QPainter imgPainter(&m_buffer);
-        for (const auto &ls : m_layersSnap) {
-            if (!ls.visible) continue;
-            if (!ls.raster.isNull()) {
-                QImage r = ls.raster;
-                if (r.size() != m_buffer.size()) {
-                    r = r.scaled(m_buffer.size(), Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
                 }
-                imgPainter.drawImage(0, 0, r);
-            }
-            // Draw this layer's strokes
-            imgPainter.end(); // ensure no pending state before direct pixel ops
-            for (int i = 0; i < ls.strokes.size(); ++i) {
-                const BrushStroke &stroke = ls.strokes.at(i);
-                drawStrokeInterpolated(stroke.points, stroke.color, stroke.size);
-            }
-            imgPainter.begin(&m_buffer);
-        }
-        imgPainter.end();
-        m_rebuildVersion = contentVersion;
-        m_bufferDirty = true;
-    }
-    // Add in-progress stroke on top (not yet committed)
-    if (m_isDrawingSnap) {
-        drawStrokeInterpolated(m_currentPointsSnap, m_currentColorSnap, m_currentSizeSnap);
+                gl_FragColor = u_color * (inside / 16.0);
+            })");
+        m_tailProgram.bindAttributeLocation("a_pos", 0);
+        m_tailProgram.bindAttributeLocation("a_dab", 1);
+        m_tailProgram.link();
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &m_maxTextureSize);
+        m_uploader.initialize();
+        m_initialized = true;
     }
 
-    // Upload to texture
-    if (m_texture == 0) {
-        glGenTextures(1, &m_texture);
-        glBindTexture(GL_TEXTURE_2D, m_texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_buffer.width(), m_buffer.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, m_buffer.constBits());
-        m_textureSize = m_buffer.size();
-        m_bufferDirty = false;
-    } else {
-        glBindTexture(GL_TEXTURE_2D, m_texture);
-        if (m_textureSize != m_buffer.size()) {
-            // Reallocate texture on size change (e.g., fullscreen)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_buffer.width(), m_buffer.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, m_buffer.constBits());
-            m_textureSize = m_buffer.size();
-            m_bufferDirty = false;
-        } else if (m_bufferDirty) {
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_buffer.width(), m_buffer.height(), GL_RGBA, GL_UNSIGNED_BYTE, m_buffer.constBits());
-            m_bufferDirty = false;
+    // Painting backend (Canvas::gpuPainting). Switching drops the other backend's
+    // caches; the GPU backend falls back to the CPU one when the context lacks instancing.
+    bool useGpu = m_gpuPaintingSnap;
+    if (useGpu && !m_gpu.isInitialized() && !m_gpuUnavailable) {
+        m_gpuUnavailable = !m_gpu.initialize();
+        if (m_gpuUnavailable) qWarning() << "GLRenderer: GPU painting unavailable, using the CPU backend";
+    }
+    useGpu = useGpu && !m_gpuUnavailable;
+    if (useGpu != m_usingGpu) {
+        m_usingGpu = useGpu;
+        for (LayerCache &cache : m_layerCache) {
+            if (cache.texture) glDeleteTextures(1, &cache.texture);
         }
+        m_layerCache.clear();
+        m_gpuLayers.clear();
+        m_gpuLive.reset();
+        m_gpuSize = QSize();
+        m_liveSurface = QImage();
+        m_renderedGeneration = 0;
+        m_liveStrokeId = 0;
     }
+    // Texture uploads of this frame share one streaming buffer, fenced at the end
+    m_uploader.beginFrame();
+    if (m_usingGpu) paintGpu();
+    else paintCpu();
+    m_uploader.endFrame();
 
-    // Draw textured quad covering viewport
-    m_program.bind();
-    glBindTexture(GL_TEXTURE_2D, m_texture);
-    // Quad with UVs matching QImage's top-left origin (no vertical flip)
-    GLfloat verts[] = {
-        //  x     y      u    v
-        -1.f, -1.f,   0.f, 0.f, // bottom-left maps to (0,0)
-         1.f, -1.f,   1.f, 0.f, // bottom-right maps to (1,0)
-        -1.f,  1.f,   0.f, 1.f, // top-left maps to (0,1)
-         1.f,  1.f,   1.f, 1.f  // top-right maps to (1,1)
-    };
-    // position (vec2) + uv (vec2)
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), verts);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), verts + 2);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+    // The view only samples the composited document, so resizing, zooming and
+    // panning cost this pass alone
+    framebufferObject()->bind();
+    glViewport(0, 0, m_viewportSize.width(), m_viewportSize.height());
+    glClearColor(0.82f, 0.82f, 0.83f, 1.f); // workspace around the document
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    drawDocumentView();
+    drawPredictedTail();
 
+    const qreal dpr = m_dpr;
     // Brush preview circle: outline-only (1px), center transparent
     // Show only while drawing (mouse pressed)
     QVector2D cursorLogical = m_cursorPosSnap;
     if (m_isDrawingSnap && cursorLogical.x() >= 0 && cursorLogical.y() >= 0) {
         // Convert to pixel space for mapping, then to NDC; flip Y for GL
         QVector2D cursorPix = cursorLogical * (float)dpr;
-        float radiusPix = std::max(0.5f, m_canvas->brushSize() * 0.5f * (float)dpr);
+        float radiusPix = std::max(0.5f, m_brushSizeSnap * 0.5f * float(m_zoomSnap * dpr));
         const int SEG = 64;
         QVector<GLfloat> ringNdc;
         ringNdc.reserve(SEG * 2);
@@ -361,6 +261,444 @@ void GLRenderer::render() {
         m_overlayProgram.release();
     }
 
-    m_program.release();
-    update(); // continuous repaint while drawing
+    ++m_framesRendered;
+    // No unconditional update(): Canvas schedules a frame for every input event and
+    // state change, and all pending work above is finished within this frame, so an
+    // idle canvas renders nothing.
+}
+
+void GLRenderer::paintCpu() {
+    const QSize size = m_doc ? m_doc->size : QSize();
+    if (size.isEmpty()) return;
+    constexpr float scale = 1.0f; // strokes are in document pixels
+    if (m_liveSurface.size() != size) {
+        m_liveSurface = PixelOps::makeSurface(size);
+        m_liveDirty.resize(size);
+        m_liveTiles.resize(size);
+        m_liveTextureSize = QSize(); // reallocate on next upload
+        m_liveStrokeId = 0;
+        m_renderedGeneration = 0; // layer surfaces are rebuilt at the new size
+    }
+
+    // Bring each visible layer's cached surface up to date. Only layers whose revision
+    // changed are touched: appended strokes are stamped onto the existing surface
+    // (keeping the tiles under them as checkpoints), undoing the newest strokes copies
+    // those tiles back, any other removal restores and redraws just the area the
+    // removed strokes covered (found through the layer's stroke index), and anything
+    // else (clear, new raster, document resize) re-rasterizes that layer alone. Window
+    // resizes never reach this point.
+    // Visibility, opacity and order changes need no CPU work: they only change the
+    // composite pass below. Nothing here runs while the snapshot is unchanged.
+    if (m_doc && m_doc->generation != m_renderedGeneration) {
+        QSet<quint64> liveUids;
+        for (const auto &layerSnap : m_doc->layers) {
+            const LayerSnapshot &ls = *layerSnap;
+            liveUids.insert(ls.uid);
+            if (!ls.visible) continue; // hidden layers are brought up to date when shown again
+            LayerCache &cache = m_layerCache[ls.uid];
+            if (cache.revision == ls.revision && cache.surface.size() == size) continue;
+
+            const bool sameBase = cache.surface.size() == size && cache.rasterKey == ls.raster.cacheKey();
+            const bool appendOnly = sameBase
+                && cache.strokeCount <= ls.strokes.size()
+                && (cache.strokeCount == 0 || ls.strokes.idAt(cache.strokeCount - 1) == cache.lastStrokeId);
+            const int removed = cache.strokeCount - ls.strokes.size();
+            const quint64 newTopId = ls.strokes.isEmpty() ? 0 : ls.strokes.idAt(ls.strokes.size() - 1);
+            QRect restored;
+            // One revision per removed stroke: nothing else changed in between
+            const bool undoTop = sameBase && removed > 0
+                && ls.strokeRevision - cache.strokeRevision == quint64(removed)
+                && m_checkpoints.restore(ls.uid, removed, cache.lastStrokeId, newTopId, cache.surface, restored);
+            if (undoTop) {
+                cache.dirty.markRect(restored);
+            } else if (appendOnly && ls.strokes.size() - cache.strokeCount <= MaxCheckpointedStrokes) {
+                // Keep the tiles under each new stroke before stamping it, for undo
+                for (int i = cache.strokeCount; i < ls.strokes.size(); ++i) {
+                    const auto dabs = StrokeRasterizer::dabsFor(ls.strokes, i, scale, &m_dabCache);
+                    m_checkpoints.save(ls.uid, ls.strokes.idAt(i), i > 0 ? ls.strokes.idAt(i - 1) : 0, cache.surface, *dabs);
+                    cache.dirty.markRect(StrokeRasterizer::rasterizeStrokes(cache.surface, ls.strokes, QList<int>{i},
+                                                                            cache.surface.rect(), scale, &m_dabCache));
+                }
+            } else {
+                m_checkpoints.dropLayer(ls.uid); // they no longer match the surface
+                QRectF damaged;
+                QRect area;
+                if (!appendOnly && sameBase && BrushEngine::damageSince(ls.damage, cache.strokeRevision, damaged))
+                    area = damaged.toAlignedRect() & QRect(QPoint(0, 0), size);
+                // Past half the layer, a full rebuild (tiled over all threads) is no slower
+                const bool regional = !area.isNull() && qint64(area.width()) * area.height() * 2 <= qint64(size.width()) * size.height();
+                if (regional) {
+                    cache.dirty.markRect(RasterEngine::redrawLayerArea(cache.surface, ls, area, &m_dabCache));
+                } else if (appendOnly) {
+                    // A large batch (file load) is spread over worker threads by tile
+                    cache.dirty.markRect(StrokeRasterizer::rasterizeStrokes(cache.surface, ls.strokes, cache.strokeCount,
+                                                                            scale, &m_dabCache));
+                } else {
+                    // Same pixels as the exports; reuses the dabs interpolated when the
+                    // strokes were first stamped
+                    cache.surface = RasterEngine::renderLayer(ls, size, &m_dabCache);
+                    cache.dirty.resize(size);
+                    cache.dirty.markAll();
+                }
+            }
+            cache.revision = ls.revision;
+            cache.strokeRevision = ls.strokeRevision;
+            cache.rasterKey = ls.raster.cacheKey();
+            cache.strokeCount = ls.strokes.size();
+            cache.lastStrokeId = newTopId;
+        }
+        // Drop surfaces and textures of layers that no longer exist
+        for (auto it = m_layerCache.begin(); it != m_layerCache.end(); ) {
+            if (liveUids.contains(it.key())) { ++it; continue; }
+            if (it->texture) glDeleteTextures(1, &it->texture);
+            m_checkpoints.dropLayer(it.key());
+            it = m_layerCache.erase(it);
+        }
+        m_renderedGeneration = m_doc->generation;
+    }
+
+    // In-progress stroke (not yet committed) on its own surface. Only segments appended
+    // since the previous frame are stamped; a new stroke first erases the previous one.
+    auto clearLive = [&]() {
+        for (const QRect &r : m_liveTiles.rects()) {
+            for (int y = r.top(); y <= r.bottom(); ++y)
+                std::memset(m_liveSurface.scanLine(y) + size_t(r.left()) * 4, 0, size_t(r.width()) * 4);
+            m_liveDirty.markRect(r);
+        }
+        m_liveTiles.clear();
+    };
+    if (m_isDrawingSnap) {
+        if (m_liveStrokeId != m_currentStrokeIdSnap) {
+            clearLive();
+            m_liveCursor = StrokeRasterizer::Cursor{};
+            m_liveStrokeId = m_currentStrokeIdSnap;
+        }
+        const float radiusPix = StrokeRasterizer::dabRadius(m_currentSizeSnap, scale);
+        QList<QVector2D> dabs;
+        StrokeRasterizer::interpolate(m_currentPointsSnap, scale, StrokeRasterizer::dabSpacing(radiusPix), m_liveCursor, dabs);
+        if (!dabs.isEmpty()) {
+            DabKernel::Surface surface;
+            surface.bits = m_liveSurface.bits();
+            surface.width = m_liveSurface.width();
+            surface.height = m_liveSurface.height();
+            surface.bytesPerLine = int(m_liveSurface.bytesPerLine());
+            const DabKernel::Color c{m_currentColorSnap.redF(), m_currentColorSnap.greenF(), m_currentColorSnap.blueF(), m_currentColorSnap.alphaF()};
+            for (const QVector2D &p : std::as_const(dabs)) {
+                const QRect dab = DabKernel::stampCircle(surface, p.x(), p.y(), radiusPix, c);
+                if (dab.isEmpty()) continue;
+                m_liveDirty.markRect(dab);
+                m_liveTiles.markRect(dab);
+            }
+        }
+    } else if (m_liveStrokeId != 0) {
+        clearLive();
+        m_liveStrokeId = 0;
+    }
+
+    // Upload the changed tiles of each texture, then composite the stack on the GPU.
+    // The live texture stays in the stack between strokes (cleared) so that ending a
+    // stroke only recomposites the tiles it touched.
+    QList<CompositeInput> stack = baseInputs();
+    for (const auto &ls : m_doc->layers) {
+        if (!ls->visible) continue;
+        auto it = m_layerCache.find(ls->uid);
+        if (it == m_layerCache.end()) continue;
+        m_composeDirty |= syncTexture(it->texture, it->textureSize, it->surface, it->dirty);
+        stack.append({it->texture, ls->opacity});
+    }
+    m_composeDirty |= syncTexture(m_liveTexture, m_liveTextureSize, m_liveSurface, m_liveDirty);
+    stack.append({m_liveTexture, m_activeOpacitySnap});
+    composeDocument(stack);
+}
+
+void GLRenderer::paintGpu() {
+    const QSize size = m_doc ? m_doc->size : QSize();
+    if (size.isEmpty()) return;
+    constexpr float scale = 1.0f; // strokes are in document pixels
+    if (size != m_gpuSize) {
+        m_gpuSize = size;
+        m_renderedGeneration = 0; // layer targets are recreated at the new size
+        m_gpuLive = m_gpu.createTarget(size);
+        m_gpuLiveBounds = QRect();
+        m_liveStrokeId = 0;
+    }
+
+    // Same bookkeeping as the CPU backend, with a framebuffer object per layer:
+    // appended strokes are drawn onto it, anything else clears and redraws it.
+    if (m_doc && m_doc->generation != m_renderedGeneration) {
+        QSet<quint64> liveUids;
+        for (const auto &layerSnap : m_doc->layers) {
+            const LayerSnapshot &ls = *layerSnap;
+            liveUids.insert(ls.uid);
+            if (!ls.visible) continue;
+            GpuLayerCache &cache = m_gpuLayers[ls.uid];
+            const bool sized = cache.target && cache.target->size() == size;
+            if (cache.revision == ls.revision && sized) continue;
+
+            const bool appendOnly = sized
+                && cache.rasterKey == ls.raster.cacheKey()
+                && cache.strokeCount <= ls.strokes.size()
+                && (cache.strokeCount == 0 || ls.strokes.idAt(cache.strokeCount - 1) == cache.lastStrokeId);
+            int firstStroke = cache.strokeCount;
+            if (!appendOnly) {
+                if (sized) m_gpu.clear(cache.target.get());
+                else cache.target = m_gpu.createTarget(size);
+                if (!ls.raster.isNull()) m_gpu.drawImage(cache.target.get(), ls.raster);
+                firstStroke = 0;
+                m_composeDirty = QRect(QPoint(0, 0), size);
+            }
+            // All new dabs of the layer go out in as few instanced draws as possible
+            QList<GpuPainter::Dab> dabs;
+            for (int i = firstStroke; i < ls.strokes.size(); ++i) {
+                const auto strokeDabs = StrokeRasterizer::dabsFor(ls.strokes, i, scale, &m_dabCache);
+                GpuPainter::appendDabs(dabs, strokeDabs->centres, strokeDabs->radius, ls.strokes.colorAt(i));
+            }
+            m_gpu.drawDabs(cache.target.get(), dabs);
+            m_composeDirty |= GpuPainter::bounds(dabs);
+            cache.revision = ls.revision;
+            cache.rasterKey = ls.raster.cacheKey();
+            cache.strokeCount = ls.strokes.size();
+            cache.lastStrokeId = ls.strokes.isEmpty() ? 0 : ls.strokes.idAt(ls.strokes.size() - 1);
+        }
+        for (auto it = m_gpuLayers.begin(); it != m_gpuLayers.end(); ) {
+            if (!liveUids.contains(it.key())) it = m_gpuLayers.erase(it);
+            else ++it;
+        }
+        m_renderedGeneration = m_doc->generation;
+    }
+
+    // In-progress stroke goes into its own target, drawn over the layers; like the
+    // CPU backend, it stays in the stack (cleared) between strokes
+    auto clearLive = [&]() {
+        m_gpu.clear(m_gpuLive.get());
+        m_composeDirty |= m_gpuLiveBounds;
+        m_gpuLiveBounds = QRect();
+    };
+    if (m_isDrawingSnap) {
+        if (m_liveStrokeId != m_currentStrokeIdSnap) {
+            clearLive();
+            m_liveCursor = StrokeRasterizer::Cursor{};
+            m_liveStrokeId = m_currentStrokeIdSnap;
+        }
+        const float radiusPix = StrokeRasterizer::dabRadius(m_currentSizeSnap, scale);
+        QList<QVector2D> centres;
+        StrokeRasterizer::interpolate(m_currentPointsSnap, scale, StrokeRasterizer::dabSpacing(radiusPix), m_liveCursor, centres);
+        QList<GpuPainter::Dab> dabs;
+        GpuPainter::appendDabs(dabs, centres, radiusPix, m_currentColorSnap);
+        m_gpu.drawDabs(m_gpuLive.get(), dabs);
+        const QRect touched = GpuPainter::bounds(dabs);
+        m_gpuLiveBounds |= touched;
+        m_composeDirty |= touched;
+    } else if (m_liveStrokeId != 0) {
+        clearLive();
+        m_liveStrokeId = 0;
+    }
+
+    QList<CompositeInput> stack = baseInputs();
+    for (const auto &ls : m_doc->layers) {
+        if (!ls->visible) continue;
+        const auto it = m_gpuLayers.constFind(ls->uid);
+        if (it != m_gpuLayers.constEnd() && it->target) stack.append({it->target->texture(), ls->opacity});
+    }
+    stack.append({m_gpuLive->texture(), m_activeOpacitySnap});
+    composeDocument(stack);
+}
+
+QList<GLRenderer::CompositeInput> GLRenderer::baseInputs() {
+    QList<CompositeInput> stack;
+    const qint64 baseKey = (m_doc && !m_doc->baseImage.isNull()) ? m_doc->baseImage.cacheKey() : 0;
+    if (baseKey != m_baseKey) {
+        m_baseKey = baseKey;
+        m_baseTextureSize = QSize(); // new image: full upload
+        if (m_doc) m_composeDirty = QRect(QPoint(0, 0), m_doc->size); // stretched over the document
+    }
+    if (baseKey != 0) {
+        DirtyTiles none;
+        syncTexture(m_baseTexture, m_baseTextureSize, m_doc->baseImage, none);
+        stack.append({m_baseTexture, 1.0f});
+    }
+    return stack;
+}
+
+void GLRenderer::composeDocument(const QList<CompositeInput> &stack) {
+    const QSize size = m_doc->size;
+    const QRect docRect(QPoint(0, 0), size);
+    if (!m_docTarget || m_docTarget->size() != size) {
+        if (size.width() > m_maxTextureSize || size.height() > m_maxTextureSize)
+            qWarning() << "GLRenderer: document" << size << "exceeds the maximum texture size" << m_maxTextureSize;
+        QOpenGLFramebufferObjectFormat format;
+        format.setMipmap(true);
+        m_docTarget = std::make_unique<QOpenGLFramebufferObject>(size, format);
+        m_composeDirty = docRect;
+    }
+    // Visibility, opacity, order or texture changes affect every pixel
+    if (stack != m_composedStack) {
+        m_composedStack = stack;
+        m_composeDirty = docRect;
+    }
+    const QRect dirty = m_composeDirty & docRect;
+    m_composeDirty = QRect();
+    if (dirty.isEmpty()) return;
+
+    // Document row 0 is framebuffer row 0, so the scissor box is the dirty rect as is
+    m_docTarget->bind();
+    glViewport(0, 0, size.width(), size.height());
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(dirty.x(), dirty.y(), dirty.width(), dirty.height());
+    glClearColor(1.f, 1.f, 1.f, 1.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    compositeLayers(stack);
+    glDisable(GL_SCISSOR_TEST);
+    m_docMipsStale = true;
+}
+
+void GLRenderer::drawDocumentView() {
+    if (!m_docTarget) return;
+    const QSize doc = m_docTarget->size();
+    const float zoomPix = float(m_zoomSnap * m_dpr); // device pixels per document pixel
+
+    // Zoomed-out views sample the mip pyramid. It is only rebuilt when a minified
+    // view needs it, so painting at 100 % or closer never pays for it.
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_docTarget->texture());
+    const bool minified = zoomPix < 1.0f;
+    if (minified && m_docMipsStale) {
+        glGenerateMipmap(GL_TEXTURE_2D);
+        m_docMipsStale = false;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minified ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    // Show individual pixels once they are large enough to tell apart
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, zoomPix >= 2.0f ? GL_NEAREST : GL_LINEAR);
+
+    // Document rectangle in device pixels, then NDC (same y convention as the overlay)
+    const float x0 = float(m_panSnap.x() * m_dpr);
+    const float y0 = float(m_panSnap.y() * m_dpr);
+    const float x1 = x0 + doc.width() * zoomPix;
+    const float y1 = y0 + doc.height() * zoomPix;
+    const float w = float(m_viewportSize.width());
+    const float h = float(m_viewportSize.height());
+    auto nx = [w](float x) { return x / w * 2.f - 1.f; };
+    auto ny = [h](float y) { return y / h * 2.f - 1.f; };
+    const GLfloat verts[] = {
+        nx(x0), ny(y0), 0.f, 0.f,
+        nx(x1), ny(y0), 1.f, 0.f,
+        nx(x0), ny(y1), 0.f, 1.f,
+        nx(x1), ny(y1), 1.f, 1.f,
+    };
+    m_viewProgram.bind();
+    m_viewProgram.setUniformValue("u_tex", 0);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), verts);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), verts + 2);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glDisableVertexAttribArray(1);
+    glDisableVertexAttribArray(0);
+    m_viewProgram.release();
+}
+
+void GLRenderer::drawPredictedTail() {
+    if (!m_isDrawingSnap || m_predictedTailSnap.isEmpty() || m_currentPointsSnap.isEmpty() || m_activeOpacitySnap <= 0.0f) return;
+    // Continue the live stroke's dab spacing from its last delivered point, so the
+    // tail looks like the stroke it stands in for
+    const float radius = StrokeRasterizer::dabRadius(m_currentSizeSnap, 1.0f);
+    QList<QVector2D> path;
+    path.reserve(m_predictedTailSnap.size() + 1);
+    path.append(m_currentPointsSnap.last());
+    path.append(m_predictedTailSnap);
+    StrokeRasterizer::Cursor cursor;
+    cursor.nextPoint = 1;
+    cursor.carry = m_liveCursor.carry;
+    QList<QVector2D> dabs;
+    StrokeRasterizer::interpolate(path, 1.0f, StrokeRasterizer::dabSpacing(radius), cursor, dabs);
+    if (dabs.isEmpty()) return;
+
+    // Document -> device pixels -> NDC, as in drawDocumentView()
+    const float zoomPix = float(m_zoomSnap * m_dpr);
+    const QVector2D pan(float(m_panSnap.x() * m_dpr), float(m_panSnap.y() * m_dpr));
+    const float w = float(m_viewportSize.width());
+    const float h = float(m_viewportSize.height());
+    const float r = radius * zoomPix;
+    QList<GLfloat> verts;
+    verts.reserve(dabs.size() * 6 * 5);
+    static const float corners[6][2] = { {-1, -1}, {1, -1}, {-1, 1}, {-1, 1}, {1, -1}, {1, 1} };
+    for (const QVector2D &d : std::as_const(dabs)) {
+        const QVector2D c = pan + d * zoomPix;
+        for (const auto &k : corners) {
+            const float px = c.x() + k[0] * (r + 1.0f);
+            const float py = c.y() + k[1] * (r + 1.0f);
+            verts << px / w * 2.f - 1.f << py / h * 2.f - 1.f << c.x() << c.y() << r;
+        }
+    }
+
+    // Premultiplied brush colour at the active layer's opacity, as the live stroke is composited
+    const float a = float(m_currentColorSnap.alphaF()) * m_activeOpacitySnap;
+    m_tailProgram.bind();
+    m_tailProgram.setUniformValue("u_color", QVector4D(float(m_currentColorSnap.redF()) * a, float(m_currentColorSnap.greenF()) * a,
+                                                       float(m_currentColorSnap.blueF()) * a, a));
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA); // premultiplied, like the stamped dabs
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), verts.constData());
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), verts.constData() + 2);
+    glDrawArrays(GL_TRIANGLES, 0, GLsizei(dabs.size() * 6));
+    glDisableVertexAttribArray(1);
+    glDisableVertexAttribArray(0);
+    glDisable(GL_BLEND);
+    m_tailProgram.release();
+}
+
+void GLRenderer::compositeLayers(const QList<CompositeInput> &stack) {
+    if (stack.isEmpty()) return;
+    static const GLfloat verts[] = { -1.f, -1.f,  1.f, -1.f,  -1.f, 1.f,  1.f, 1.f };
+    m_compositeProgram.bind();
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA); // premultiplied source-over onto the background
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
+    for (int first = 0; first < stack.size(); first += CompositeUnits) {
+        GLfloat opacity[CompositeUnits] = {};
+        for (int unit = 0; unit < CompositeUnits; ++unit) {
+            const int i = first + unit;
+            glActiveTexture(GL_TEXTURE0 + unit);
+            // Units past the end sample the first texture at zero opacity
+            glBindTexture(GL_TEXTURE_2D, stack.at(i < stack.size() ? i : first).texture);
+            if (i < stack.size()) opacity[unit] = stack.at(i).opacity;
+        }
+        m_compositeProgram.setUniformValueArray("u_opacity", opacity, CompositeUnits, 1);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    glDisableVertexAttribArray(0);
+    glActiveTexture(GL_TEXTURE0);
+    glDisable(GL_BLEND);
+    m_compositeProgram.release();
+}
+
+QRect GLRenderer::syncTexture(GLuint &texture, QSize &textureSize, const QImage &surface, DirtyTiles &dirty) {
+    if (texture == 0) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        textureSize = QSize();
+    }
+    if (textureSize != surface.size()) {
+        // (Re)allocate storage, then stream the full contents like any other update
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surface.width(), surface.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        textureSize = surface.size();
+        dirty.clear();
+        m_uploader.upload(texture, surface, {surface.rect()});
+        return surface.rect();
+    }
+    if (dirty.isEmpty()) return QRect();
+    // Only the touched tiles, coalesced into a few rectangles
+    const QList<QRect> rects = dirty.takeRects();
+    m_uploader.upload(texture, surface, rects);
+    QRect bounds;
+    for (const QRect &r : rects) bounds |= r;
+    return bounds;
 }
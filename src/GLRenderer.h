@@ -3,9 +3,17 @@
 #include <QOpenGLFunctions>
 #include <QOpenGLShaderProgram>
 #include <QImage>
-// Needed for BrushStroke definition used in snapshots
+#include <QOpenGLFramebufferObject>
+// Needed for the StrokeList in snapshots
 #include "BrushEngine.h"
+#include "DocumentSnapshot.h"
+#include "DirtyTiles.h"
+#include "StrokeRasterizer.h"
+#include "GpuPainter.h"
+#include "TextureUploader.h"
+#include "TileCheckpoints.h"
 #include <QList>
+#include <QHash>
 
 class Canvas;
 
@@ -17,30 +25,114 @@ public:
     void synchronize(QQuickFramebufferObject *item) override;
 
 private:
+    // One entry of the layer stack for compositeLayers(): a premultiplied texture
+    struct CompositeInput {
+        GLuint texture = 0;
+        float opacity = 1.0f;
+        bool operator==(const CompositeInput &o) const { return texture == o.texture && opacity == o.opacity; }
+    };
+    static constexpr int CompositeUnits = 8; // textures blended per shader pass
+    // New strokes of a layer stamped one by one with undo checkpoints; larger batches
+    // (file loads) are stamped together without
+    static constexpr int MaxCheckpointedStrokes = 8;
+
+    void paintCpu(); // CPU rasterization into per-layer surfaces, each uploaded to its own texture
+    void paintGpu(); // instanced dabs into per-layer framebuffers
+    // Re-composite the m_composeDirty part of the document into m_docTarget (whole
+    // document when the stack itself changed)
+    void composeDocument(const QList<CompositeInput> &stack);
+    // Draw m_docTarget into the item framebuffer at the view transform
+    void drawDocumentView();
+    // Canvas::predictedTail() as dabs over the view; redrawn from scratch every frame
+    // and never stamped onto a surface
+    void drawPredictedTail();
+    // Blend the stack (bottom -> top) over the bound framebuffer in ceil(n / CompositeUnits) passes
+    void compositeLayers(const QList<CompositeInput> &stack);
+    // Bring `texture` up to date with `surface`: (re)allocate on size change, else
+    // stream the dirty tiles only (through m_uploader). Returns the uploaded area.
+    QRect syncTexture(GLuint &texture, QSize &textureSize, const QImage &surface, DirtyTiles &dirty);
+    QList<CompositeInput> baseInputs(); // base image texture (if any), kept in sync with m_doc
+
     Canvas *m_canvas;
-    QOpenGLShaderProgram m_program;
+    QOpenGLShaderProgram m_compositeProgram;
     QOpenGLShaderProgram m_overlayProgram;
+    QOpenGLShaderProgram m_viewProgram;
+    QOpenGLShaderProgram m_tailProgram;
+    GLint m_maxTextureSize = 0;
+    TextureUploader m_uploader;
     QSize m_viewportSize;
     bool m_initialized = false;
-    QImage m_buffer; // CPU canvas buffer
-    GLuint m_texture = 0; // GL texture backing the buffer
-    int m_rebuildVersion = -1; // track content version processed
-    QSize m_textureSize; // track texture allocation size
-    bool m_bufferDirty = false; // track whether CPU buffer changed and needs GPU upload
-
-    // Snapshots synchronized from GUI thread to render thread
-    struct LayerSnap {
-        QImage raster;                // optional raster image of this layer
-        QList<BrushStroke> strokes;   // committed strokes for this layer
-        bool visible = true;
+
+    // In-progress stroke: stamped onto its own transparent surface, composited on top
+    QImage m_liveSurface;
+    GLuint m_liveTexture = 0;
+    QSize m_liveTextureSize;
+    DirtyTiles m_liveDirty; // tiles of m_liveSurface changed since the last upload
+    DirtyTiles m_liveTiles; // tiles covered by the in-progress stroke (cleared for the next one)
+    StrokeRasterizer::Cursor m_liveCursor; // progress of the in-progress stroke
+    quint64 m_liveStrokeId = 0; // stroke the live cursor belongs to (0 = none)
+
+    // Document synchronized from the GUI thread (shared, immutable)
+    std::shared_ptr<const DocumentSnapshot> m_doc;
+    quint64 m_renderedGeneration = 0; // m_doc generation the layer caches reflect
+
+    // Composited document (white background + stack) at document resolution, with
+    // a mip pyramid for zoomed-out views
+    std::unique_ptr<QOpenGLFramebufferObject> m_docTarget;
+    QList<CompositeInput> m_composedStack; // stack m_docTarget was composited from
+    QRect m_composeDirty;                  // document pixels to re-composite
+    bool m_docMipsStale = true;
+
+    // Per-layer rasterized surface (premultiplied, transparent background) and its texture,
+    // keyed by layer uid. Rebuilt only when the layer's revision changes; appended strokes
+    // are stamped incrementally and only their tiles re-uploaded.
+    struct LayerCache {
+        QImage surface;
+        GLuint texture = 0;
+        QSize textureSize;
+        DirtyTiles dirty;         // tiles of surface not yet uploaded
+        quint64 revision = 0;
+        qint64 rasterKey = 0;     // cacheKey() of the raster the surface was built from
+        int strokeCount = 0;      // strokes already stamped onto the surface
+        quint64 lastStrokeId = 0; // id of the last stamped stroke (detects append-only changes)
+        quint64 strokeRevision = 0; // BrushEngine revision the surface shows
     };
-    QList<LayerSnap> m_layersSnap;    // stacking order: bottom -> top
-    QList<QVector2D> m_currentPointsSnap;
+    QHash<quint64, LayerCache> m_layerCache;
+    StrokeRasterizer::DabCache m_dabCache; // dab centres of committed strokes, by stroke id
+    TileCheckpoints m_checkpoints;         // pixels under recent strokes, for undo
+
+    // GPU backend state: one target per layer (same append-only rules as LayerCache)
+    struct GpuLayerCache {
+        std::shared_ptr<QOpenGLFramebufferObject> target;
+        quint64 revision = 0;
+        qint64 rasterKey = 0;
+        int strokeCount = 0;
+        quint64 lastStrokeId = 0;
+    };
+    GpuPainter m_gpu;
+    QHash<quint64, GpuLayerCache> m_gpuLayers;
+    std::shared_ptr<QOpenGLFramebufferObject> m_gpuLive; // in-progress stroke
+    QRect m_gpuLiveBounds; // area drawn into m_gpuLive since it was cleared
+    QSize m_gpuSize;
+    bool m_gpuUnavailable = false; // initialization failed; stay on the CPU backend
+    bool m_usingGpu = false;
+    bool m_gpuPaintingSnap = false;
+
+    GLuint m_baseTexture = 0; // base image, uploaded once per image
+    QSize m_baseTextureSize;
+    qint64 m_baseKey = 0;
+    QList<QVector2D> m_currentPointsSnap; // renderer-owned copy, grown incrementally
+    QList<QVector2D> m_predictedTailSnap;
     QColor m_currentColorSnap;
     float m_currentSizeSnap = 0.0f;
+    float m_activeOpacitySnap = 1.0f; // opacity of the layer the live stroke is drawn on (0 when hidden)
+    quint64 m_currentStrokeIdSnap = 0;
     bool m_isDrawingSnap = false;
     QVector2D m_cursorPosSnap;
     QColor m_brushColorSnap;
     float m_brushSizeSnap = 0.0f;
+    qreal m_zoomSnap = 1.0;
+    QPointF m_panSnap;
     qreal m_dpr = 1.0;
+    int m_framesRendered = 0; // since the last synchronize(), reported to Canvas
 };
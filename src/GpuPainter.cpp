@@ -0,0 +1,246 @@
+#include "GpuPainter.h"
+#include "PixelOps.h"
+#include <QOpenGLContext>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+namespace {
+
+// initialize() only accepts contexts with GLSL 3.30 / ES 3.00, and core profiles
+// reject the older dialects, so the shaders are written for those
+QByteArray shaderSource(bool es, const char *body) {
+    return QByteArray(es ? "#version 300 es\nprecision highp float;\n" : "#version 330 core\n") + body;
+}
+
+} // namespace
+
+GpuPainter::~GpuPainter() {
+    if (m_dabVao.isCreated()) m_dabVao.destroy();
+    if (m_quadVao.isCreated()) m_quadVao.destroy();
+    if (m_instanceBuffer.isCreated()) m_instanceBuffer.destroy();
+    if (m_quadBuffer.isCreated()) m_quadBuffer.destroy();
+}
+
+bool GpuPainter::initialize() {
+    if (m_initialized) return true;
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+    if (!ctx) return false;
+    const QSurfaceFormat fmt = ctx->format();
+    const bool instancing = ctx->isOpenGLES() ? fmt.majorVersion() >= 3
+                                              : (fmt.majorVersion() > 3 || (fmt.majorVersion() == 3 && fmt.minorVersion() >= 3));
+    if (!instancing) {
+        qWarning() << "GpuPainter: instanced drawing needs OpenGL 3.3 / ES 3.0, context is"
+                   << fmt.majorVersion() << "." << fmt.minorVersion();
+        return false;
+    }
+    initializeOpenGLFunctions();
+
+    // One quad per dab, covering the radius plus a pixel of antialiasing. The viewport
+    // maps canvas pixels 1:1, so gl_FragCoord is the pixel centre in canvas coordinates.
+    // Coverage is counted on the same 4x4 sample grid as DabKernel::pixelCoverage().
+    const bool es = ctx->isOpenGLES();
+    m_dabProgram.addShaderFromSourceCode(QOpenGLShader::Vertex, shaderSource(es,
+        R"(
+        in vec2 a_corner;
+        in vec3 a_dab;
+        in vec4 a_color;
+        uniform vec2 u_size;
+        out vec3 v_dab;
+        out vec4 v_color;
+        void main(){
+            vec2 p = a_dab.xy + a_corner * (a_dab.z + 1.0);
+            v_dab = a_dab;
+            v_color = a_color;
+            gl_Position = vec4(p / u_size * 2.0 - 1.0, 0.0, 1.0);
+        })"));
+    m_dabProgram.addShaderFromSourceCode(QOpenGLShader::Fragment, shaderSource(es,
+        R"(
+        in vec3 v_dab;
+        in vec4 v_color;
+        out vec4 fragColor;
+        void main(){
+            float r = max(v_dab.z, 0.5);
+            float inside = 0.0;
+            for (int j = 0; j < 4; ++j) {
+                float dy = (gl_FragCoord.y + (float(j) - 1.5) * 0.25) - v_dab.y;
+                for (int i = 0; i < 4; ++i) {
+                    float dx = (gl_FragCoord.x + (float(i) - 1.5) * 0.25) - v_dab.x;
+                    inside += dx * dx + dy * dy <= r * r ? 1.0 : 0.0;
+                }
+            }
+            fragColor = v_color * (inside / 16.0);
+        })"));
+    m_dabProgram.bindAttributeLocation("a_corner", 0);
+    m_dabProgram.bindAttributeLocation("a_dab", 1);
+    m_dabProgram.bindAttributeLocation("a_color", 2);
+    if (!m_dabProgram.link()) {
+        qWarning() << "GpuPainter: dab shader failed:" << m_dabProgram.log();
+        return false;
+    }
+
+    m_imageProgram.addShaderFromSourceCode(QOpenGLShader::Vertex, shaderSource(es,
+        R"(
+        in vec2 a_pos;
+        out vec2 v_uv;
+        void main(){
+            v_uv = a_pos * 0.5 + 0.5;
+            gl_Position = vec4(a_pos, 0.0, 1.0);
+        })"));
+    m_imageProgram.addShaderFromSourceCode(QOpenGLShader::Fragment, shaderSource(es,
+        R"(
+        in vec2 v_uv;
+        uniform sampler2D u_tex;
+        out vec4 fragColor;
+        void main(){
+            fragColor = texture(u_tex, v_uv);
+        })"));
+    m_imageProgram.bindAttributeLocation("a_pos", 0);
+    if (!m_imageProgram.link()) {
+        qWarning() << "GpuPainter: image shader failed:" << m_imageProgram.log();
+        return false;
+    }
+
+    if (!m_quadBuffer.create() || !m_instanceBuffer.create() || !m_quadVao.create() || !m_dabVao.create()) {
+        qWarning() << "GpuPainter: cannot create vertex buffers";
+        return false;
+    }
+    static const GLfloat corners[] = { -1.f, -1.f,  1.f, -1.f,  -1.f, 1.f,  1.f, 1.f };
+    m_quadBuffer.bind();
+    m_quadBuffer.allocate(corners, int(sizeof(corners)));
+    {
+        // Attribute pointers below source the buffer bound when they are set
+        QOpenGLVertexArrayObject::Binder vao(&m_quadVao);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+    }
+    {
+        // The same corners for every instance, then one Dab per instance
+        QOpenGLVertexArrayObject::Binder vao(&m_dabVao);
+        m_quadBuffer.bind();
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+        m_instanceBuffer.setUsagePattern(QOpenGLBuffer::StreamDraw);
+        m_instanceBuffer.bind();
+        m_instanceBuffer.allocate(BatchSize * int(sizeof(Dab)));
+        glEnableVertexAttribArray(1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Dab), reinterpret_cast<const void *>(offsetof(Dab, x)));
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Dab), reinterpret_cast<const void *>(offsetof(Dab, r)));
+        glVertexAttribDivisor(1, 1);
+        glVertexAttribDivisor(2, 1);
+    }
+    m_instanceBuffer.release(); // the array buffer binding is not part of the VAOs
+    m_initialized = true;
+    return true;
+}
+
+std::shared_ptr<QOpenGLFramebufferObject> GpuPainter::createTarget(const QSize &size) {
+    auto target = std::make_shared<QOpenGLFramebufferObject>(size);
+    clear(target.get());
+    return target;
+}
+
+void GpuPainter::clear(QOpenGLFramebufferObject *target) {
+    target->bind();
+    glViewport(0, 0, target->width(), target->height());
+    glClearColor(0.f, 0.f, 0.f, 0.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+void GpuPainter::drawQuad() {
+    QOpenGLVertexArrayObject::Binder vao(&m_quadVao);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+GLuint GpuPainter::uploadTexture(const QImage &surface, GLuint texture) {
+    if (texture == 0) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    } else {
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+    const QImage src = surface.format() == PixelOps::SurfaceFormat ? surface : PixelOps::toSurface(surface);
+    // Rows are tightly packed for RGBA8 (bytesPerLine is a multiple of 4)
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, src.width(), src.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, src.constBits());
+    return texture;
+}
+
+void GpuPainter::drawTexture(GLuint texture) {
+    m_imageProgram.bind();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    m_imageProgram.setUniformValue("u_tex", 0);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA); // premultiplied source-over
+    drawQuad();
+    glDisable(GL_BLEND);
+    m_imageProgram.release();
+}
+
+void GpuPainter::drawImage(QOpenGLFramebufferObject *target, const QImage &surface) {
+    if (surface.isNull()) return;
+    const GLuint texture = uploadTexture(surface);
+    target->bind();
+    glViewport(0, 0, target->width(), target->height());
+    drawTexture(texture);
+    glDeleteTextures(1, &texture);
+}
+
+void GpuPainter::appendDabs(QList<Dab> &out, const QList<QVector2D> &centres, float radius, const QColor &color) {
+    const float a = float(color.alphaF());
+    const float r = float(color.redF()) * a;
+    const float g = float(color.greenF()) * a;
+    const float b = float(color.blueF()) * a;
+    out.reserve(out.size() + centres.size());
+    for (const QVector2D &c : centres) out.append(Dab{c.x(), c.y(), radius, r, g, b, a});
+}
+
+QRect GpuPainter::bounds(const QList<Dab> &dabs) {
+    if (dabs.isEmpty()) return QRect();
+    float x0 = dabs.first().x, y0 = dabs.first().y, x1 = x0, y1 = y0;
+    for (const Dab &d : dabs) {
+        const float reach = d.radius + 1.0f; // quad size in the vertex shader
+        x0 = std::min(x0, d.x - reach);
+        y0 = std::min(y0, d.y - reach);
+        x1 = std::max(x1, d.x + reach);
+        y1 = std::max(y1, d.y + reach);
+    }
+    return QRectF(QPointF(x0, y0), QPointF(x1, y1)).toAlignedRect();
+}
+
+void GpuPainter::drawDabs(QOpenGLFramebufferObject *target, const QList<Dab> &dabs) {
+    if (dabs.isEmpty()) return;
+    target->bind();
+    glViewport(0, 0, target->width(), target->height());
+    m_dabProgram.bind();
+    m_dabProgram.setUniformValue("u_size", QVector2D(float(target->width()), float(target->height())));
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    QOpenGLVertexArrayObject::Binder vao(&m_dabVao);
+    m_instanceBuffer.bind();
+    for (qsizetype first = 0; first < dabs.size(); first += BatchSize) {
+        const int count = int(std::min<qsizetype>(BatchSize, dabs.size() - first));
+        // Orphan the previous batch's storage so the driver need not wait for it
+        m_instanceBuffer.allocate(nullptr, BatchSize * int(sizeof(Dab)));
+        m_instanceBuffer.write(0, dabs.constData() + first, count * int(sizeof(Dab)));
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    }
+    m_instanceBuffer.release();
+    glDisable(GL_BLEND);
+    m_dabProgram.release();
+}
+
+QImage GpuPainter::readback(QOpenGLFramebufferObject *target) {
+    QImage image(target->size(), PixelOps::SurfaceFormat);
+    target->bind();
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, target->width(), target->height(), GL_RGBA, GL_UNSIGNED_BYTE, image.bits());
+    return image;
+}
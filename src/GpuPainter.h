@@ -0,0 +1,70 @@
+#pragma once
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
+#include <QImage>
+#include <QColor>
+#include <QList>
+#include <QVector2D>
+#include <memory>
+
+// GPU painting backend: draws round dabs into premultiplied RGBA8 framebuffer objects.
+//
+// Each dab is one instance of a quad (centre, radius and colour are per-instance
+// attributes); the fragment shader counts coverage on the same 4x4 sample grid as the
+// CPU kernel (DabKernel::pixelCoverage) and blends premultiplied source-over. Dabs are submitted in batches of BatchSize per draw call.
+//
+// Targets use the canvas orientation of the display quad: framebuffer row 0 is canvas
+// row 0, so textures sample like an uploaded QImage and readback needs no flip.
+// Vertex state lives in vertex array objects over buffers, so the painter works in
+// core profiles too; no vertex array object is left bound after a call.
+// All calls need the render thread's context to be current. Calls that draw into a
+// target leave that target bound and the viewport set to its size.
+class GpuPainter : protected QOpenGLExtraFunctions {
+public:
+    static constexpr int BatchSize = 4096; // dabs per instanced draw call
+
+    // One dab: centre and radius in target pixels, premultiplied colour
+    struct Dab {
+        float x, y, radius;
+        float r, g, b, a;
+    };
+
+    GpuPainter() = default;
+    ~GpuPainter();
+
+    // Compile shaders and buffers. False when instanced drawing is unavailable
+    // (needs OpenGL 3.3 or OpenGL ES 3.0).
+    bool initialize();
+    bool isInitialized() const { return m_initialized; }
+
+    // New render target of `size`, cleared to transparent
+    std::shared_ptr<QOpenGLFramebufferObject> createTarget(const QSize &size);
+    void clear(QOpenGLFramebufferObject *target);
+    // Stretch a premultiplied surface (PixelOps::SurfaceFormat) over the target
+    void drawImage(QOpenGLFramebufferObject *target, const QImage &surface);
+    void drawDabs(QOpenGLFramebufferObject *target, const QList<Dab> &dabs);
+    static void appendDabs(QList<Dab> &out, const QList<QVector2D> &centres, float radius, const QColor &color);
+    // Pixels the dabs may touch
+    static QRect bounds(const QList<Dab> &dabs);
+
+    // Upload a premultiplied surface into `texture` (created when 0); returns the texture
+    GLuint uploadTexture(const QImage &surface, GLuint texture = 0);
+    // Draw a premultiplied texture over the currently bound framebuffer's viewport
+    void drawTexture(GLuint texture);
+    // Target contents as a premultiplied surface
+    QImage readback(QOpenGLFramebufferObject *target);
+
+private:
+    void drawQuad(); // full-viewport quad for the image program (program bound)
+
+    bool m_initialized = false;
+    QOpenGLShaderProgram m_dabProgram;
+    QOpenGLShaderProgram m_imageProgram;
+    QOpenGLBuffer m_quadBuffer{QOpenGLBuffer::VertexBuffer};     // corners of a unit quad
+    QOpenGLBuffer m_instanceBuffer{QOpenGLBuffer::VertexBuffer}; // one batch of Dabs
+    QOpenGLVertexArrayObject m_quadVao; // image program: corners
+    QOpenGLVertexArrayObject m_dabVao;  // dab program: corners plus per-instance dabs
+};
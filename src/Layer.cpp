@@ -1,2 +1,4 @@
 #include "Layer.h"
-// Empty translation unit: all inline for now.
+// Mostly inline; only static state lives here.
+
+quint64 Layer::s_nextUid = 1;
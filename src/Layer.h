@@ -8,9 +8,16 @@ class Layer : public QObject {
     Q_OBJECT
     Q_PROPERTY(QString name READ name WRITE setName NOTIFY nameChanged)
     Q_PROPERTY(bool visible READ isVisible WRITE setVisible NOTIFY visibilityChanged)
+    Q_PROPERTY(qreal opacity READ opacity WRITE setOpacity NOTIFY opacityChanged)
 public:
     explicit Layer(QObject* parent = nullptr)
-        : QObject(parent), m_name("Unnamed"), m_visible(true) {}
+        : QObject(parent), m_name("Unnamed"), m_visible(true), m_uid(s_nextUid++) {}
+
+    // Process-unique identity (survives reordering, never reused)
+    quint64 uid() const { return m_uid; }
+    // Monotonic content revision: changes whenever strokes or raster change.
+    // Visibility and opacity are not part of it (they only affect compositing).
+    quint64 revision() const { return m_engine.revision() + m_rasterRevision; }
 
     QString name() const { return m_name; }
     void setName(const QString &n) { if (n != m_name) { m_name = n; emit nameChanged(); } }
@@ -18,22 +25,31 @@ public:
     bool isVisible() const { return m_visible; }
     void setVisible(bool v) { if (v != m_visible) { m_visible = v; emit visibilityChanged(); } }
 
+    qreal opacity() const { return m_opacity; }
+    void setOpacity(qreal o) { o = qBound(0.0, o, 1.0); if (o != m_opacity) { m_opacity = o; emit opacityChanged(); } }
+
     BrushEngine& engine() { return m_engine; }
     const BrushEngine& engine() const { return m_engine; }
 
     // Optional raster content for this layer (used when importing ORA)
     bool hasRaster() const { return !m_raster.isNull(); }
     const QImage& raster() const { return m_raster; }
-    void setRaster(const QImage &img) { m_raster = img; }
-    void clearRaster() { m_raster = QImage(); }
+    void setRaster(const QImage &img) { m_raster = img; ++m_rasterRevision; }
+    void clearRaster() { m_raster = QImage(); ++m_rasterRevision; }
 
 signals:
     void nameChanged();
     void visibilityChanged();
+    void opacityChanged();
 
 private:
     QString m_name;
     bool m_visible;
+    qreal m_opacity = 1.0;
     BrushEngine m_engine;
     QImage m_raster;
+    quint64 m_uid;
+    quint64 m_rasterRevision = 0;
+
+    static quint64 s_nextUid;
 };
@@ -0,0 +1,62 @@
+#include "PixelOps.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace PixelOps {
+
+namespace {
+
+// Exact x / 255 rounded, for x in 0..255*255
+inline uint32_t div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+} // namespace
+
+QImage makeSurface(const QSize &size, const QColor &fill) {
+    QImage img(size, SurfaceFormat);
+    img.fill(fill);
+    return img;
+}
+
+QImage toSurface(const QImage &img) {
+    if (img.isNull() || img.format() == SurfaceFormat) return img;
+    return img.convertToFormat(SurfaceFormat);
+}
+
+void compositeOver(QImage &dst, const QImage &src, const QRect &rect, int opacity) {
+    if (dst.isNull() || src.isNull() || opacity <= 0) return;
+    if (dst.format() != SurfaceFormat || src.format() != SurfaceFormat || dst.size() != src.size()) return;
+    const QRect bounds(QPoint(0, 0), dst.size());
+    const QRect r = rect.isNull() ? bounds : rect.intersected(bounds);
+    if (r.isEmpty()) return;
+    const uint32_t op = uint32_t(qMin(opacity, 255));
+
+    for (int y = r.top(); y <= r.bottom(); ++y) {
+        const uint8_t *s = src.constScanLine(y) + size_t(r.left()) * 4;
+        uint8_t *d = dst.scanLine(y) + size_t(r.left()) * 4;
+        for (int x = 0; x < r.width(); ++x, s += 4, d += 4) {
+            uint32_t sa = s[3];
+            if (sa == 0) continue;                     // transparent source: nothing to do
+            if (sa == 255 && op == 255) {              // opaque source replaces destination
+                std::memcpy(d, s, 4);
+                continue;
+            }
+            uint32_t sc[4] = { s[0], s[1], s[2], sa };
+            if (op != 255) {
+                for (uint32_t &c : sc) c = div255(c * op);
+                sa = sc[3];
+            }
+            // Clamp guards against colour > alpha in malformed premultiplied input
+            const uint32_t inv = 255 - sa;
+            d[0] = uint8_t(std::min<uint32_t>(255, sc[0] + div255(d[0] * inv)));
+            d[1] = uint8_t(std::min<uint32_t>(255, sc[1] + div255(d[1] * inv)));
+            d[2] = uint8_t(std::min<uint32_t>(255, sc[2] + div255(d[2] * inv)));
+            d[3] = uint8_t(std::min<uint32_t>(255, sa + div255(d[3] * inv)));
+        }
+    }
+}
+
+} // namespace PixelOps
@@ -0,0 +1,22 @@
+#pragma once
+#include <QImage>
+#include <QRect>
+#include <QColor>
+
+// Premultiplied RGBA8888 surface helpers shared by GLRenderer and the CPU export paths.
+// Surfaces use the same byte order as the GL texture (R, G, B, A) and integer arithmetic
+// throughout; DabKernel stamps into the same format.
+namespace PixelOps {
+
+constexpr QImage::Format SurfaceFormat = QImage::Format_RGBA8888_Premultiplied;
+
+// New surface of `size` filled with `fill` (transparent by default)
+QImage makeSurface(const QSize &size, const QColor &fill = Qt::transparent);
+// `img` in SurfaceFormat (shares data when it already is)
+QImage toSurface(const QImage &img);
+
+// dst = src * opacity over dst, inside `rect` (whole image when null). Both images must be
+// SurfaceFormat and the same size; opacity is 0..255.
+void compositeOver(QImage &dst, const QImage &src, const QRect &rect = QRect(), int opacity = 255);
+
+} // namespace PixelOps
@@ -0,0 +1,72 @@
+#include "PointCodec.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Keeps deltas well inside 32 bits for any document size the canvas allows
+constexpr qint32 Limit = 1 << 28;
+
+qint32 quantizeCoord(float v) {
+    const float q = std::nearbyint(v * PointCodec::Scale);
+    return qint32(std::clamp(q, float(-Limit), float(Limit)));
+}
+
+quint8 *putVarint(quint8 *out, qint32 v) {
+    quint32 z = (quint32(v) << 1) ^ quint32(v >> 31); // zigzag: small magnitudes, small codes
+    while (z >= 0x80) {
+        *out++ = quint8(z | 0x80);
+        z >>= 7;
+    }
+    *out++ = quint8(z);
+    return out;
+}
+
+const quint8 *getVarint(const quint8 *in, qint32 &v) {
+    quint32 z = 0;
+    int shift = 0;
+    quint8 b;
+    do {
+        b = *in++;
+        z |= quint32(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    v = qint32(z >> 1) ^ -qint32(z & 1);
+    return in;
+}
+
+} // namespace
+
+namespace PointCodec {
+
+QVector2D quantize(const QVector2D &p) {
+    return QVector2D(float(quantizeCoord(p.x())) / Scale, float(quantizeCoord(p.y())) / Scale);
+}
+
+int encode(const QVector2D *points, int count, quint8 *out) {
+    quint8 *p = out;
+    qint32 px = 0, py = 0;
+    for (int i = 0; i < count; ++i) {
+        const qint32 x = quantizeCoord(points[i].x());
+        const qint32 y = quantizeCoord(points[i].y());
+        p = putVarint(p, x - px);
+        p = putVarint(p, y - py);
+        px = x;
+        py = y;
+    }
+    return int(p - out);
+}
+
+void decode(const quint8 *data, int count, QVector2D *out) {
+    qint32 x = 0, y = 0;
+    for (int i = 0; i < count; ++i) {
+        qint32 dx, dy;
+        data = getVarint(data, dx);
+        data = getVarint(data, dy);
+        x += dx;
+        y += dy;
+        out[i] = QVector2D(float(x) / Scale, float(y) / Scale);
+    }
+}
+
+} // namespace PointCodec
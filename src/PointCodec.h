@@ -0,0 +1,28 @@
+#pragma once
+#include <QVector2D>
+#include <QtGlobal>
+
+// Compact encoding of a committed stroke's points.
+//
+// The encoding is lossy: coordinates are rounded to the nearest 1/16 px, so a decoded
+// coordinate differs from the original by at most 1/32 px (coordinates beyond
+// +-2^24 px are clamped). That is far below what a dab can show. Each point is then
+// stored as the difference from the previous one, zigzag-mapped and written as two
+// LEB128 varints. Neighbouring input samples lie a few pixels apart, so a point
+// usually takes 2 to 4 bytes instead of 8. Decoding gives back exactly the rounded
+// coordinates, so encoding the decoded points again yields the same bytes.
+namespace PointCodec {
+
+constexpr float Scale = 16.0f;      // steps per pixel
+constexpr int MaxBytesPerPoint = 10; // two 5-byte varints
+
+// Nearest representable position
+QVector2D quantize(const QVector2D &p);
+
+// Encode `count` points into `out`, which must have room for count * MaxBytesPerPoint
+// bytes. Returns the number of bytes written.
+int encode(const QVector2D *points, int count, quint8 *out);
+// Decode `count` points written by encode()
+void decode(const quint8 *data, int count, QVector2D *out);
+
+} // namespace PointCodec
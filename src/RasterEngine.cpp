@@ -0,0 +1,100 @@
+#include "RasterEngine.h"
+#include "PixelOps.h"
+#include "ResampleCache.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace RasterEngine {
+
+namespace {
+
+constexpr float Scale = 1.0f; // strokes are in document pixels
+
+// Layer raster at the document size, shared with the renderer and other exports
+QImage layerBase(const QImage &raster, const QSize &size) {
+    return raster.isNull() ? QImage() : ResampleCache::instance().resampled(raster, size);
+}
+
+// `rect` of `img` (no copy when it is the whole image)
+QImage crop(const QImage &img, const QRect &rect) {
+    return rect == img.rect() ? img : img.copy(rect);
+}
+
+// Indices (ascending, i.e. stacking order) of the strokes touching `rect`
+QList<int> strokesIn(const LayerSnapshot &layer, const QRect &rect) {
+    QList<int> indices;
+    for (quint64 id : layer.index.query(QRectF(rect))) {
+        const int i = layer.strokes.indexOf(id);
+        if (i >= 0) indices.append(i);
+    }
+    return indices;
+}
+
+} // namespace
+
+QImage renderLayer(const QImage &raster, const StrokeList &strokes, const QSize &size, int strokeCount,
+                   StrokeRasterizer::DabCache *cache) {
+    if (size.isEmpty()) return QImage();
+    const QImage base = layerBase(raster, size);
+    // Stamping detaches the surface from the cached raster
+    QImage surface = base.isNull() ? PixelOps::makeSurface(size) : base;
+    const int count = strokeCount < 0 ? strokes.size() : std::min(strokeCount, strokes.size());
+    QList<int> indices;
+    indices.reserve(count);
+    for (int i = 0; i < count; ++i) indices.append(i);
+    // Spread over worker threads by tile when large
+    StrokeRasterizer::rasterizeStrokes(surface, strokes, indices, surface.rect(), Scale, cache);
+    return surface;
+}
+
+QImage renderLayer(const LayerSnapshot &layer, const QSize &size, StrokeRasterizer::DabCache *cache) {
+    return renderLayer(layer.raster, layer.strokes, size, -1, cache);
+}
+
+QImage renderLayer(const LayerSnapshot &layer, const QSize &size, const QRect &rect, StrokeRasterizer::DabCache *cache) {
+    if (size.isEmpty() || rect.isEmpty()) return QImage();
+    const QImage base = layerBase(layer.raster, size);
+    QImage surface = base.isNull() ? PixelOps::makeSurface(rect.size()) : base.copy(rect);
+    StrokeRasterizer::rasterizeStrokes(surface, rect.topLeft(), layer.strokes, strokesIn(layer, rect), rect, Scale, cache);
+    return surface;
+}
+
+QRect redrawLayerArea(QImage &surface, const LayerSnapshot &layer, const QRect &area, StrokeRasterizer::DabCache *cache) {
+    const QRect r = area & surface.rect();
+    if (r.isEmpty()) return QRect();
+    // Put back what lies under the strokes, then replay every stroke touching the
+    // area, in order, clipped to it
+    const QImage base = layerBase(layer.raster, surface.size());
+    for (int y = r.top(); y <= r.bottom(); ++y) {
+        uchar *dst = surface.scanLine(y) + size_t(r.left()) * 4;
+        if (base.isNull()) std::memset(dst, 0, size_t(r.width()) * 4);
+        else std::memcpy(dst, base.constScanLine(y) + size_t(r.left()) * 4, size_t(r.width()) * 4);
+    }
+    StrokeRasterizer::rasterizeStrokes(surface, layer.strokes, strokesIn(layer, r), r, Scale, cache);
+    return r;
+}
+
+QImage renderDocument(const DocumentSnapshot &doc, const Options &options) {
+    return renderDocument(doc, QRect(QPoint(0, 0), doc.size), options);
+}
+
+QImage renderDocument(const DocumentSnapshot &doc, const QRect &rect, const Options &options) {
+    const QRect r = rect & QRect(QPoint(0, 0), doc.size);
+    if (r.isEmpty()) return QImage();
+    const bool whole = r.size() == doc.size;
+    QImage out = PixelOps::makeSurface(r.size(), options.background);
+    if (options.baseImage && !doc.baseImage.isNull())
+        PixelOps::compositeOver(out, crop(ResampleCache::instance().resampled(doc.baseImage, doc.size), r));
+    for (const auto &layer : doc.layers) {
+        if (!layer->visible && !options.hiddenLayers) continue;
+        const int opacity = int(std::lround(std::clamp(layer->opacity, 0.0f, 1.0f) * 255.0f));
+        if (opacity <= 0) continue;
+        // A whole layer is stamped tile-parallel without consulting the index
+        const QImage pixels = whole ? renderLayer(*layer, doc.size) : renderLayer(*layer, doc.size, r);
+        PixelOps::compositeOver(out, pixels, QRect(), opacity);
+    }
+    return out;
+}
+
+} // namespace RasterEngine
@@ -0,0 +1,45 @@
+#pragma once
+#include <QImage>
+#include <QColor>
+#include <QRect>
+#include "DocumentSnapshot.h"
+#include "StrokeRasterizer.h"
+
+// Renders document snapshots to premultiplied images (PixelOps::SurfaceFormat): one
+// layer or the flattened document, whole or one tile of it.
+//
+// This is the one place that turns a layer (raster plus strokes) into pixels. The CPU
+// display backend builds and repairs its layer surfaces here, and the bakers and all
+// export paths render here too, so a saved file has exactly the pixels shown on screen.
+// Holds no QObject or GL state. Every function may run on any thread, concurrently,
+// as long as each call gets its own DabCache (or none).
+namespace RasterEngine {
+
+struct Options {
+    QColor background = Qt::white; // under everything; transparent for none
+    bool baseImage = true;         // include DocumentSnapshot::baseImage
+    bool hiddenLayers = false;     // include layers that are not visible
+};
+
+// A layer as the display shows it: `raster` resampled to `size` (transparent without
+// one) with strokes [0, strokeCount) stamped on top in order; all strokes when
+// strokeCount is negative
+QImage renderLayer(const QImage &raster, const StrokeList &strokes, const QSize &size, int strokeCount = -1,
+                   StrokeRasterizer::DabCache *cache = nullptr);
+QImage renderLayer(const LayerSnapshot &layer, const QSize &size, StrokeRasterizer::DabCache *cache = nullptr);
+// Only the `rect` part of that layer (document pixels), as an image of rect's size.
+// The strokes to replay come from the layer's spatial index.
+QImage renderLayer(const LayerSnapshot &layer, const QSize &size, const QRect &rect,
+                   StrokeRasterizer::DabCache *cache = nullptr);
+// Render `area` of `surface`, a whole layer surface of the document size, again from
+// scratch. Returns the part of `area` inside the surface.
+QRect redrawLayerArea(QImage &surface, const LayerSnapshot &layer, const QRect &area,
+                      StrokeRasterizer::DabCache *cache = nullptr);
+
+// The flattened document at doc.size: background, base image, then the layers bottom
+// to top at their opacity
+QImage renderDocument(const DocumentSnapshot &doc, const Options &options = Options());
+// Only the `rect` part of it, as an image of rect's size
+QImage renderDocument(const DocumentSnapshot &doc, const QRect &rect, const Options &options = Options());
+
+} // namespace RasterEngine
@@ -0,0 +1,110 @@
+#include "ResampleCache.h"
+#include <QtConcurrent/QtConcurrentRun>
+
+ResampleCache &ResampleCache::instance() {
+    static ResampleCache cache;
+    return cache;
+}
+
+ResampleCache::ResampleCache(size_t budgetBytes)
+    : m_budget(budgetBytes)
+{
+}
+
+QImage ResampleCache::resampled(const QImage &src, const QSize &size, QImage::Format format) {
+    if (src.isNull() || size.isEmpty()) return QImage();
+    if (src.size() == size && src.format() == format) return src;
+    const Key key{src.cacheKey(), size.width(), size.height(), int(format)};
+    QFuture<QImage> pending;
+    bool inFlight = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            m_lru.splice(m_lru.begin(), m_lru, it->second.lruPos);
+            return it->second.image;
+        }
+        auto p = m_pending.find(key);
+        if (p != m_pending.end()) {
+            pending = p->second;
+            inFlight = true;
+        }
+    }
+    if (inFlight) return pending.result(); // prefetch already under way
+    // Build outside the lock; a concurrent miss on the same key just builds it twice
+    const QImage image = build(src, size, format);
+    insert(key, image);
+    return image;
+}
+
+void ResampleCache::prefetch(const QImage &src, const QSize &size, QImage::Format format) {
+    if (src.isNull() || size.isEmpty()) return;
+    if (src.size() == size && src.format() == format) return;
+    const Key key{src.cacheKey(), size.width(), size.height(), int(format)};
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_entries.count(key) || m_pending.count(key)) return;
+    // The task needs the lock to finish, so it cannot remove its own m_pending
+    // entry before the entry is stored here
+    m_pending[key] = QtConcurrent::run([this, src, size, format, key]() {
+        const QImage image = build(src, size, format);
+        insert(key, image);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.erase(key);
+        return image;
+    });
+}
+
+QImage ResampleCache::build(const QImage &src, const QSize &size, QImage::Format format) {
+    // Filter in the target format: for premultiplied targets this keeps transparent
+    // edges from darkening
+    QImage converted = src.format() == format ? src : src.convertToFormat(format);
+    if (converted.size() != size)
+        converted = converted.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    if (converted.format() != format) converted = converted.convertToFormat(format);
+    return converted;
+}
+
+void ResampleCache::insert(const Key &key, const QImage &image) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_entries.count(key)) return;
+    m_lru.push_front(key);
+    m_entries.emplace(key, Entry{image, m_lru.begin()});
+    m_bytes += size_t(image.sizeInBytes());
+    evictLocked();
+}
+
+void ResampleCache::evictLocked() {
+    // Keep at least the most recent entry even if it alone exceeds the budget
+    while (m_bytes > m_budget && m_lru.size() > 1) {
+        const Key key = m_lru.back();
+        m_lru.pop_back();
+        auto it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            m_bytes -= size_t(it->second.image.sizeInBytes());
+            m_entries.erase(it);
+        }
+    }
+}
+
+void ResampleCache::setBudget(size_t budgetBytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_budget = budgetBytes;
+    evictLocked();
+}
+
+size_t ResampleCache::budget() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_budget;
+}
+
+size_t ResampleCache::bytesUsed() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+void ResampleCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_lru.clear();
+    m_bytes = 0;
+}
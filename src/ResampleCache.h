@@ -0,0 +1,72 @@
+#pragma once
+#include <QImage>
+#include <QFuture>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "PixelOps.h"
+
+// Resampled copies of document images (base image, raster layers) at the sizes the
+// renderer and the export paths need them.
+//
+// Smoothly scaling a large photo takes hundreds of milliseconds, and the same
+// (image, size) pair is requested on every layer rebuild and every save. Results are
+// keyed by (QImage::cacheKey(), target size, format), so any change to the source
+// image misses automatically. Least-recently-used entries are evicted once the byte
+// budget is exceeded. prefetch() computes an entry on the global thread pool, ahead
+// of need (e.g. right after the document size changes); a lookup that arrives while
+// that is still running waits for it instead of scaling a second time.
+// All calls are thread-safe. Returned images are implicitly shared copies.
+class ResampleCache {
+public:
+    static ResampleCache &instance();
+
+    explicit ResampleCache(size_t budgetBytes = 256u * 1024u * 1024u);
+
+    // `src` scaled to `size` (ignoring aspect ratio, smooth) in `format`. Returns `src`
+    // itself when nothing needs to change; null when `src` is null.
+    QImage resampled(const QImage &src, const QSize &size, QImage::Format format = PixelOps::SurfaceFormat);
+    // Start computing resampled(src, size, format) in the background
+    void prefetch(const QImage &src, const QSize &size, QImage::Format format = PixelOps::SurfaceFormat);
+
+    void setBudget(size_t budgetBytes);
+    size_t budget() const;
+    size_t bytesUsed() const;
+    void clear();
+
+private:
+    struct Key {
+        qint64 cacheKey = 0;
+        int width = 0;
+        int height = 0;
+        int format = 0;
+        bool operator==(const Key &o) const {
+            return cacheKey == o.cacheKey && width == o.width && height == o.height && format == o.format;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            size_t h = std::hash<qint64>()(k.cacheKey);
+            h = h * 31u + std::hash<int>()(k.width);
+            h = h * 31u + std::hash<int>()(k.height);
+            return h * 31u + std::hash<int>()(k.format);
+        }
+    };
+    struct Entry {
+        QImage image;
+        std::list<Key>::iterator lruPos;
+    };
+
+    static QImage build(const QImage &src, const QSize &size, QImage::Format format);
+    void insert(const Key &key, const QImage &image);
+    void evictLocked();
+
+    mutable std::mutex m_mutex;
+    size_t m_budget;
+    size_t m_bytes = 0;
+    std::list<Key> m_lru; // front = most recently used
+    std::unordered_map<Key, Entry, KeyHash> m_entries;
+    std::unordered_map<Key, QFuture<QImage>, KeyHash> m_pending; // prefetches in flight
+};
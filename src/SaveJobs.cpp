@@ -0,0 +1,164 @@
+#include "SaveJobs.h"
+#include "PixelOps.h"
+#include "ResampleCache.h"
+#include "../ora/OraCreator.h"
+#include <QDebug>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentMap>
+#include <cstring>
+
+Q_LOGGING_CATEGORY(lcSave, "trahere.save", QtWarningMsg)
+
+namespace SaveJobs {
+
+namespace {
+
+struct Tile {
+    int image; // index of the image the tile belongs to
+    int layer; // index into DocumentSnapshot::layers; -1 for the flattened document
+    QRect rect;
+};
+
+// Cover `size` with tiles of image `image`
+void addTiles(QList<Tile> &tiles, int image, int layer, const QSize &size) {
+    const QRect bounds(QPoint(0, 0), size);
+    for (int y = 0; y < size.height(); y += TileSize) {
+        for (int x = 0; x < size.width(); x += TileSize)
+            tiles.append(Tile{image, layer, QRect(x, y, TileSize, TileSize) & bounds});
+    }
+}
+
+// Render `tiles` into `images` (surfaces of the document size) on the global thread
+// pool, one progress step per tile counted on from `step`. Once the promise is
+// cancelled the remaining tiles are skipped. False when cancelled.
+bool renderTiles(QPromise<bool> &promise, QList<QImage> &images, const QList<Tile> &tiles, const DocumentSnapshot &doc,
+                 const RasterEngine::Options &options, int &step) {
+    // Detach every image here, once: the tiles then write disjoint rows through these
+    QList<uchar *> bits;
+    QList<qsizetype> strides;
+    for (QImage &img : images) {
+        bits.append(img.bits());
+        strides.append(img.bytesPerLine());
+    }
+    QSemaphore finished;
+    auto render = [&](const Tile &tile) {
+        if (!promise.isCanceled()) {
+            const QImage pixels = tile.layer < 0
+                ? RasterEngine::renderDocument(doc, tile.rect, options)
+                : RasterEngine::renderLayer(*doc.layers.at(tile.layer), doc.size, tile.rect);
+            uchar *dst = bits.at(tile.image) + tile.rect.top() * strides.at(tile.image) + size_t(tile.rect.left()) * 4;
+            for (int y = 0; y < pixels.height(); ++y, dst += strides.at(tile.image))
+                std::memcpy(dst, pixels.constScanLine(y), size_t(pixels.width()) * 4);
+        }
+        finished.release();
+    };
+    QThreadPool *pool = QThreadPool::globalInstance();
+    QFuture<void> work = QtConcurrent::map(pool, tiles, render);
+    // Progress is reported here, not by the tiles. This thread only waits meanwhile, so
+    // the pool may run another one in its place.
+    pool->releaseThread();
+    for (int i = 0; i < tiles.size(); ++i) {
+        finished.acquire();
+        promise.setProgressValue(++step);
+    }
+    pool->reserveThread();
+    work.waitForFinished();
+    return !promise.isCanceled();
+}
+
+// Encode and write `images` (top first), with `merged` (unless null) as the merged
+// image and thumbnail source; progress steps are counted on from `step`
+bool writeOra(QPromise<bool> &promise, const QUrl &destinationUrl, const QList<QImage> &images,
+              const QStringList &names, const QList<bool> &visibility, const QList<qreal> &opacities,
+              const QImage &merged, bool mergedImage, int step) {
+    OraCreator creator;
+    creator.setWriteMergedImage(mergedImage);
+    creator.setMergedImage(merged);
+    return creator.saveOraMulti(destinationUrl, images, names, visibility, opacities, [&](int done, int) {
+        promise.setProgressValue(step + done);
+        return !promise.isCanceled();
+    });
+}
+
+} // namespace
+
+void saveFlattened(QPromise<bool> &promise, const QUrl &destinationUrl, const DocumentSnapshot &doc,
+                   const RasterEngine::Options &options) {
+    QList<QImage> images{PixelOps::makeSurface(doc.size)};
+    QList<Tile> tiles;
+    addTiles(tiles, 0, -1, doc.size);
+    // One step per tile, then OraCreator's: the layer, merged image and thumbnail,
+    // and writing the file
+    promise.setProgressRange(0, int(tiles.size()) + 3);
+    int step = 0;
+    if (!renderTiles(promise, images, tiles, doc, options, step)) return;
+    // The single layer is the merged image already
+    const bool ok = writeOra(promise, destinationUrl, images, {QStringLiteral("Layer 0")}, {true}, {1.0}, QImage(), false, step);
+    if (!ok && promise.isCanceled()) return;
+    if (!ok) {
+        qWarning() << "Canvas.saveOraStrokesOnly: failed" << destinationUrl;
+    }
+    promise.addResult(ok);
+}
+
+void saveLayers(QPromise<bool> &promise, const QUrl &destinationUrl, const DocumentSnapshot &doc,
+                const QStringList &names, bool mergedImage) {
+    QList<QImage> layerImages; // first element will be top-most for ORA
+    QStringList layerNames;
+    QList<bool> visibilityFlags;
+    QList<qreal> opacities;
+    QList<Tile> tiles;
+
+    // Snapshot layers are bottom->top; for ORA we need top-most first, so iterate reversed.
+    // Hidden layers are rendered too and saved with their visibility flag.
+    for (int li = int(doc.layers.size()) - 1; li >= 0; --li) {
+        addTiles(tiles, int(layerImages.size()), li, doc.size);
+        layerImages.append(PixelOps::makeSurface(doc.size));
+        layerNames.append(names.value(li));
+        visibilityFlags.append(doc.layers.at(li)->visible);
+        opacities.append(doc.layers.at(li)->opacity);
+    }
+    const bool withBase = !doc.baseImage.isNull();
+    if (layerImages.isEmpty() && !withBase) {
+        qWarning() << "Canvas.saveOraAllLayers: no layers to save";
+        promise.addResult(false);
+        return;
+    }
+    const int imageCount = int(layerImages.size()) + (withBase ? 1 : 0);
+    // The merged image (needed for the thumbnail even when it is not stored) is the
+    // document as the exports render it, over transparent: rendered with the layers,
+    // as the last image, and taken off before they are written
+    addTiles(tiles, int(layerImages.size()), -1, doc.size);
+    layerImages.append(PixelOps::makeSurface(doc.size));
+    RasterEngine::Options mergedOptions;
+    mergedOptions.background = Qt::transparent;
+    // One step per tile, then OraCreator's: one per layer, one for the merged image
+    // and thumbnail, and writing the file
+    promise.setProgressRange(0, int(tiles.size()) + imageCount + 2);
+    int step = 0;
+    if (!renderTiles(promise, layerImages, tiles, doc, mergedOptions, step)) return;
+    const QImage merged = layerImages.takeLast();
+
+    // Optionally include base image as bottom-most layer (appears last in stack.xml, so push back now)
+    if (withBase) {
+        layerImages.append(ResampleCache::instance().resampled(doc.baseImage, doc.size));
+        layerNames.append(QStringLiteral("Base"));
+        visibilityFlags.append(true);
+        opacities.append(1.0);
+    }
+
+    for (int i = 0; i < layerNames.size(); ++i) {
+        qCDebug(lcSave) << "layer" << i << layerNames.at(i) << "visible" << visibilityFlags.at(i)
+                        << "opacity" << opacities.at(i);
+    }
+
+    const bool ok = writeOra(promise, destinationUrl, layerImages, layerNames, visibilityFlags, opacities, merged, mergedImage, step);
+    if (!ok && promise.isCanceled()) return;
+    if (!ok) {
+        qWarning() << "Canvas.saveOraAllLayers: failed" << destinationUrl;
+    }
+    promise.addResult(ok);
+}
+
+} // namespace SaveJobs
@@ -0,0 +1,34 @@
+#pragma once
+#include <QLoggingCategory>
+#include <QPromise>
+#include <QStringList>
+#include <QUrl>
+#include "DocumentSnapshot.h"
+#include "RasterEngine.h"
+
+// Background saves, run with QtConcurrent::run() on a document snapshot taken when the
+// save was requested, so painting can go on meanwhile.
+//
+// Progress is reported on the job's own thread only. Cancellation is honoured between
+// tiles while rendering, between layers while encoding and once more just before the
+// file is committed: a cancelled or failed save leaves the destination as it was and
+// no temporary file next to it. A job that is cancelled adds no result.
+// trahere.save: what a save writes, and saves that were cancelled
+Q_DECLARE_LOGGING_CATEGORY(lcSave)
+
+namespace SaveJobs {
+
+// Rendered tiles are this many document pixels square
+constexpr int TileSize = 512;
+
+// The flattened document as a single-layer ORA
+void saveFlattened(QPromise<bool> &promise, const QUrl &destinationUrl, const DocumentSnapshot &doc,
+                   const RasterEngine::Options &options);
+
+// Every layer, hidden ones too (with their visibility and opacity), plus the base
+// image as the bottom layer, as a multi-layer ORA. `names` are per layer, bottom to
+// top like doc.layers. mergedimage.png is written only with `mergedImage`.
+void saveLayers(QPromise<bool> &promise, const QUrl &destinationUrl, const DocumentSnapshot &doc,
+                const QStringList &names, bool mergedImage);
+
+} // namespace SaveJobs
@@ -0,0 +1,26 @@
+#include "StrokeBaker.h"
+#include "RasterEngine.h"
+
+int StrokeBaker::strokesToBake(const StrokeList &strokes, const Policy &policy) {
+    if (strokes.size() <= policy.keepStrokes) return 0;
+    if (strokes.size() <= policy.maxStrokes && strokes.pointCount() <= policy.maxPoints) return 0;
+    return strokes.size() - policy.keepStrokes;
+}
+
+StrokeBaker::Job StrokeBaker::makeJob(quint64 layerUid, const QImage &raster, const StrokeList &strokes, int count,
+                                      const QSize &size) {
+    Job job;
+    job.layerUid = layerUid;
+    job.count = count;
+    job.lastId = count > 0 ? strokes.idAt(count - 1) : 0;
+    job.rasterKey = raster.cacheKey();
+    job.size = size;
+    job.raster = raster;
+    job.strokes = strokes;
+    return job;
+}
+
+QImage StrokeBaker::bake(const Job &job) {
+    // Rendered exactly as the display renders the layer
+    return RasterEngine::renderLayer(job.raster, job.strokes, job.size, job.count);
+}
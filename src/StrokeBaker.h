@@ -0,0 +1,38 @@
+#pragma once
+#include <QImage>
+#include <QSize>
+#include "BrushEngine.h"
+
+// Folds a layer's oldest strokes into its raster so that rebuilding the layer (undo
+// fallback, document resize, visibility change) never replays more than a bounded
+// number of strokes, however long the session.
+//
+// Once a layer holds more than maxStrokes strokes or maxPoints points, all but its
+// newest keepStrokes strokes are baked. bake() runs on a worker thread over copies (a
+// StrokeList copy shares its storage), rasterizing exactly as the renderer does, so
+// the layer looks the same afterwards. The caller swaps in the result only if the
+// layer did not change underneath in a way that invalidates it.
+class StrokeBaker {
+public:
+    struct Policy {
+        int maxStrokes = 2000;
+        qint64 maxPoints = 1000000;
+        int keepStrokes = 200; // newest strokes left as vectors (undo history)
+    };
+
+    struct Job {
+        quint64 layerUid = 0;
+        int count = 0;          // strokes [0, count) are baked
+        quint64 lastId = 0;     // id of stroke count - 1, to check the prefix is unchanged
+        qint64 rasterKey = 0;   // cacheKey() of the layer raster the job started from
+        QSize size;             // document size the result is for
+        QImage raster;          // layer raster (may be null)
+        StrokeList strokes;
+    };
+
+    // Strokes of `strokes` to bake under `policy` (0 when under the limits)
+    static int strokesToBake(const StrokeList &strokes, const Policy &policy);
+    static Job makeJob(quint64 layerUid, const QImage &raster, const StrokeList &strokes, int count, const QSize &size);
+    // The job's raster at `size` with its strokes [0, count) stamped on top (thread-safe)
+    static QImage bake(const Job &job);
+};
@@ -0,0 +1,100 @@
+#include "StrokeHistory.h"
+
+qint64 StrokeHistory::bytesOf(const Command &command) {
+    // A cleared list shares its storage with the layer until the layer diverges, so
+    // count the points it keeps alive rather than its arena capacity
+    return qint64(sizeof(Entry)) + qint64(command.stroke.points.size()) * qint64(sizeof(QVector2D))
+           + command.cleared.pointCount() * qint64(sizeof(QVector2D));
+}
+
+void StrokeHistory::push(Command command) {
+    while (int(m_commands.size()) > m_position) {
+        m_bytes -= m_commands.back().bytes;
+        m_commands.pop_back();
+    }
+    Entry entry{std::move(command)};
+    entry.bytes = bytesOf(entry.command);
+    m_bytes += entry.bytes;
+    m_commands.push_back(std::move(entry));
+    m_position = int(m_commands.size());
+    evict();
+}
+
+StrokeHistory::Command *StrokeHistory::undoCommand() {
+    return canUndo() ? &m_commands[size_t(m_position - 1)].command : nullptr;
+}
+
+StrokeHistory::Command *StrokeHistory::redoCommand() {
+    return canRedo() ? &m_commands[size_t(m_position)].command : nullptr;
+}
+
+void StrokeHistory::undone() {
+    if (!canUndo()) return;
+    --m_position;
+    recount(m_commands[size_t(m_position)]);
+    evict();
+}
+
+void StrokeHistory::redone() {
+    if (!canRedo()) return;
+    recount(m_commands[size_t(m_position)]);
+    ++m_position;
+    evict();
+}
+
+void StrokeHistory::removeLayer(quint64 layerUid) {
+    for (int i = int(m_commands.size()) - 1; i >= 0; --i) {
+        if (m_commands[size_t(i)].command.layerUid == layerUid) erase(i);
+    }
+}
+
+void StrokeHistory::strokesBaked(quint64 layerUid, int count) {
+    int newestStale = -1;
+    for (int i = 0; i < int(m_commands.size()); ++i) {
+        const Command &c = m_commands[size_t(i)].command;
+        if (c.layerUid == layerUid && (c.kind == Command::ClearStrokes || c.index < count)) newestStale = i;
+    }
+    for (int i = int(m_commands.size()) - 1; i >= 0; --i) {
+        Command &c = m_commands[size_t(i)].command;
+        if (c.layerUid != layerUid) continue;
+        if (i > newestStale) c.index -= count;
+        else erase(i);
+    }
+}
+
+void StrokeHistory::clear() {
+    m_commands.clear();
+    m_position = 0;
+    m_bytes = 0;
+}
+
+void StrokeHistory::setLimit(qint64 bytes) {
+    m_limit = bytes;
+    evict();
+}
+
+void StrokeHistory::recount(Entry &entry) {
+    const qint64 bytes = bytesOf(entry.command);
+    m_bytes += bytes - entry.bytes;
+    entry.bytes = bytes;
+}
+
+void StrokeHistory::erase(int index) {
+    m_bytes -= m_commands[size_t(index)].bytes;
+    m_commands.erase(m_commands.begin() + index);
+    if (index < m_position) --m_position;
+}
+
+void StrokeHistory::evict() {
+    // Oldest first; what could be redone is never dropped before what could be undone
+    while (m_bytes > m_limit && !m_commands.empty()) {
+        if (m_position > 0) {
+            m_bytes -= m_commands.front().bytes;
+            m_commands.pop_front();
+            --m_position;
+        } else {
+            m_bytes -= m_commands.back().bytes;
+            m_commands.pop_back();
+        }
+    }
+}
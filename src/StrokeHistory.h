@@ -0,0 +1,68 @@
+#pragma once
+#include <deque>
+#include "BrushEngine.h"
+
+// Undo / redo history of stroke edits across all layers of a document.
+//
+// Commands are recorded after they were applied to a layer's BrushEngine and are
+// undone and redone in strict last-in, first-out order, so a command always finds its
+// layer in the state it left it in. Commands only keep what they need to go the other
+// way: a committed stroke is copied when it is undone (for redo), a removed stroke
+// when it is removed, and a clear keeps the previous StrokeList (which shares its
+// storage). The kept data is accounted as commands come and go, and once it exceeds
+// the memory limit the oldest commands are dropped. Pixels are not kept here; the renderer restores them from its own tile
+// checkpoints (TileCheckpoints).
+class StrokeHistory {
+public:
+    struct Command {
+        enum Kind { AddStroke, RemoveStroke, ClearStrokes };
+        Kind kind = AddStroke;
+        quint64 layerUid = 0;
+        int index = 0;        // stroke position for AddStroke / RemoveStroke
+        BrushStroke stroke;   // the stroke, while it is not in its layer
+        StrokeList cleared;   // ClearStrokes: the strokes before the clear
+    };
+
+    explicit StrokeHistory(qint64 limitBytes = 64 * 1024 * 1024) : m_limit(limitBytes) {}
+
+    // Record a command that was just applied; discards everything that could be redone
+    void push(Command command);
+    // Command to undo / redo, or nullptr. The caller applies it to the layer, filling in
+    // or taking `stroke` as needed, and then calls undone() / redone().
+    Command *undoCommand();
+    Command *redoCommand();
+    void undone();
+    void redone();
+
+    bool canUndo() const { return m_position > 0; }
+    bool canRedo() const { return m_position < int(m_commands.size()); }
+
+    // Drop the commands of a layer that no longer exists
+    void removeLayer(quint64 layerUid);
+    // Strokes [0, count) of a layer were baked into its raster: drop the layer's
+    // commands that would need them (and the layer's older ones), and shift the
+    // stroke positions of the rest
+    void strokesBaked(quint64 layerUid, int count);
+    void clear();
+
+    void setLimit(qint64 bytes);
+    qint64 limit() const { return m_limit; }
+    qint64 bytesUsed() const { return m_bytes; }
+
+private:
+    struct Entry {
+        Command command;
+        qint64 bytes = 0; // bytesOf(command) as last counted into m_bytes
+    };
+
+    static qint64 bytesOf(const Command &command);
+    // Count `entry` again after its command was filled in or emptied
+    void recount(Entry &entry);
+    void erase(int index);
+    void evict();
+
+    std::deque<Entry> m_commands; // oldest first
+    int m_position = 0;        // commands before this are applied
+    qint64 m_limit;
+    qint64 m_bytes = 0;
+};
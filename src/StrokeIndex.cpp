@@ -0,0 +1,91 @@
+#include "StrokeIndex.h"
+#include "BrushEngine.h"
+#include <algorithm>
+#include <cmath>
+
+QRectF StrokeIndex::boundsOf(const PointSpan &points, float size) {
+    if (points.isEmpty()) return QRectF();
+    float left = points.first().x(), right = left;
+    float top = points.first().y(), bottom = top;
+    for (const QVector2D &p : points) {
+        left = std::min(left, p.x());
+        right = std::max(right, p.x());
+        top = std::min(top, p.y());
+        bottom = std::max(bottom, p.y());
+    }
+    const float reach = std::max(0.5f, size * 0.5f) + 1.0f;
+    return QRectF(QPointF(left - reach, top - reach), QPointF(right + reach, bottom + reach));
+}
+
+QRect StrokeIndex::cellRange(const QRectF &rect) {
+    const int x0 = int(std::floor(rect.left() / CellSize));
+    const int y0 = int(std::floor(rect.top() / CellSize));
+    const int x1 = int(std::floor(rect.right() / CellSize));
+    const int y1 = int(std::floor(rect.bottom() / CellSize));
+    return QRect(QPoint(x0, y0), QPoint(x1, y1));
+}
+
+void StrokeIndex::insert(quint64 id, const QRectF &bounds) {
+    if (bounds.isEmpty()) return;
+    const Entry entry{id, float(bounds.left()), float(bounds.top()), float(bounds.right()), float(bounds.bottom())};
+    const QRect cells = cellRange(bounds);
+    for (int cy = cells.top(); cy <= cells.bottom(); ++cy)
+        for (int cx = cells.left(); cx <= cells.right(); ++cx)
+            m_cells[cellKey(cx, cy)].append(entry);
+}
+
+void StrokeIndex::remove(quint64 id, const QRectF &bounds) {
+    if (bounds.isEmpty()) return;
+    const QRect cells = cellRange(bounds);
+    for (int cy = cells.top(); cy <= cells.bottom(); ++cy) {
+        for (int cx = cells.left(); cx <= cells.right(); ++cx) {
+            auto it = m_cells.find(cellKey(cx, cy));
+            if (it == m_cells.end()) continue;
+            it->removeIf([id](const Entry &e) { return e.id == id; });
+            if (it->isEmpty()) m_cells.erase(it);
+        }
+    }
+}
+
+void StrokeIndex::clear() {
+    m_cells.clear();
+}
+
+QList<quint64> StrokeIndex::query(const QRectF &rect) const {
+    QList<quint64> ids;
+    if (rect.isEmpty() || m_cells.isEmpty()) return ids;
+    auto collect = [&](const QList<Entry> &entries) {
+        for (const Entry &e : entries) {
+            if (e.left < rect.right() && e.right > rect.left() && e.top < rect.bottom() && e.bottom > rect.top())
+                ids.append(e.id);
+        }
+    };
+    const QRect cells = cellRange(rect);
+    if (qint64(cells.width()) * cells.height() > m_cells.size()) {
+        // Query larger than the occupied part of the grid: visit occupied cells instead
+        for (const QList<Entry> &entries : m_cells) collect(entries);
+    } else {
+        for (int cy = cells.top(); cy <= cells.bottom(); ++cy) {
+            for (int cx = cells.left(); cx <= cells.right(); ++cx) {
+                const auto it = m_cells.constFind(cellKey(cx, cy));
+                if (it != m_cells.constEnd()) collect(*it);
+            }
+        }
+    }
+    // A stroke spanning several cells is found once per cell
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+QList<quint64> StrokeIndex::query(const QPointF &pos) const {
+    QList<quint64> ids;
+    const auto it = m_cells.constFind(cellKey(int(std::floor(pos.x() / CellSize)), int(std::floor(pos.y() / CellSize))));
+    if (it == m_cells.constEnd()) return ids;
+    const float x = float(pos.x()), y = float(pos.y());
+    for (const Entry &e : *it) {
+        if (x >= e.left && x <= e.right && y >= e.top && y <= e.bottom) ids.append(e.id);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
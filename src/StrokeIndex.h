@@ -0,0 +1,44 @@
+#pragma once
+#include <QHash>
+#include <QList>
+#include <QPointF>
+#include <QRectF>
+
+class PointSpan;
+
+// Uniform grid over document space that finds the committed strokes touching a
+// rectangle or a point without walking the whole stroke list.
+//
+// Each stroke is entered, by id, into every CellSize cell its bounds overlap, together
+// with those bounds, so a query only tests the entries of the cells it covers. Cells
+// are implicitly shared: copying an index (e.g. into a render snapshot) is cheap, and
+// an insert or removal afterwards only detaches the cells it touches.
+class StrokeIndex {
+public:
+    static constexpr int CellSize = 256; // document pixels
+
+    // Area a stroke can paint: its points' bounding box dilated by the brush radius
+    // plus a pixel of antialiasing
+    static QRectF boundsOf(const PointSpan &points, float size);
+
+    void insert(quint64 id, const QRectF &bounds);
+    // `bounds` must be those passed to insert()
+    void remove(quint64 id, const QRectF &bounds);
+    void clear();
+    bool isEmpty() const { return m_cells.isEmpty(); }
+
+    // Ids of the strokes whose bounds intersect `rect` / contain `pos`, ascending
+    // (stroke ids are assigned in commit order, so this is also stacking order)
+    QList<quint64> query(const QRectF &rect) const;
+    QList<quint64> query(const QPointF &pos) const;
+
+private:
+    struct Entry {
+        quint64 id;
+        float left, top, right, bottom;
+    };
+    static qint64 cellKey(int cx, int cy) { return qint64((quint64(quint32(cy)) << 32) | quint32(cx)); }
+    static QRect cellRange(const QRectF &rect);
+
+    QHash<qint64, QList<Entry>> m_cells; // empty cells are dropped
+};
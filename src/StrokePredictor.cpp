@@ -0,0 +1,69 @@
+#include "StrokePredictor.h"
+#include <algorithm>
+#include <cmath>
+
+void StrokePredictor::reset() {
+    m_count = 0;
+}
+
+void StrokePredictor::addSample(const InputSample &sample) {
+    // Samples with the same timestamp (coalesced events, millisecond clocks) carry no
+    // timing information: keep only the newest position
+    if (m_count > 0 && sample.timestamp <= m_samples[m_count - 1].timestamp) {
+        m_samples[m_count - 1].pos = sample.pos;
+        return;
+    }
+    if (m_count == 3) {
+        m_samples[0] = m_samples[1];
+        m_samples[1] = m_samples[2];
+        m_count = 2;
+    }
+    m_samples[m_count++] = sample;
+}
+
+bool StrokePredictor::extrapolate(float dtMs, QVector2D &pos) const {
+    if (m_count < 2) return false;
+    const InputSample &s2 = m_samples[m_count - 1];
+    const InputSample &s1 = m_samples[m_count - 2];
+    const float dt1 = float(s2.timestamp - s1.timestamp);
+    if (dt1 <= 0.0f || dt1 > StaleMs) return false;
+    const QVector2D v1 = (s2.pos - s1.pos) / dt1;
+    QVector2D a;
+    if (m_count == 3) {
+        const InputSample &s0 = m_samples[0];
+        const float dt0 = float(s1.timestamp - s0.timestamp);
+        if (dt0 > 0.0f && dt0 <= StaleMs) {
+            const QVector2D v0 = (s1.pos - s0.pos) / dt0;
+            a = (v1 - v0) / (0.5f * (dt0 + dt1)) * AccelerationDamping;
+        }
+    }
+    // v1 is the velocity halfway through the last interval; carry it to the newest sample
+    const float t = dtMs + 0.5f * dt1;
+    QVector2D offset = (v1 * t + 0.5f * a * t * t) - (v1 * (0.5f * dt1) + 0.5f * a * (0.25f * dt1 * dt1));
+    const float limit = v1.length() * dtMs * MaxOvershoot;
+    const float len = offset.length();
+    if (len > limit && len > 0.0f) offset *= limit / len;
+    pos = s2.pos + offset;
+    return true;
+}
+
+bool StrokePredictor::isStale(quint64 nowMs) const {
+    if (m_count == 0) return true;
+    const quint64 newest = m_samples[m_count - 1].timestamp;
+    return nowMs > newest && float(nowMs - newest) > StaleMs;
+}
+
+QList<QVector2D> StrokePredictor::predict(float horizonMs, quint64 nowMs) const {
+    QList<QVector2D> tail;
+    if (horizonMs <= 0.0f || isStale(nowMs)) return tail;
+    for (float t = StepMs; ; t += StepMs) {
+        const float dt = std::min(t, horizonMs);
+        QVector2D p;
+        if (!extrapolate(dt, p)) return {};
+        tail.append(p);
+        if (dt >= horizonMs) break;
+    }
+    // A still pointer predicts nothing worth drawing
+    if ((tail.last() - m_samples[m_count - 1].pos).lengthSquared() < 0.25f) return {};
+    return tail;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <QList>
+#include <QVector2D>
+#include "BrushEngine.h"
+
+// Extrapolates where the pointer will be shortly, to draw a provisional stroke tail
+// ahead of the delivered input.
+//
+// The model is constant acceleration over the last three distinct samples: velocity
+// from the newest pair of samples, acceleration (which carries the curvature) from
+// the change against the previous pair. Acceleration is damped, and the tail is
+// clamped to a multiple of the straight-line distance, so that jittery input does
+// not fling the tail sideways. There is no prediction from samples more than StaleMs
+// apart, nor once the newest sample is more than StaleMs old: a pen that stops
+// delivers no more events, so the caller has to ask again with the current time.
+// The tail is purely visual: it is replaced on every frame and never becomes part
+// of a stroke.
+class StrokePredictor {
+public:
+    static constexpr float StepMs = 4.0f;          // spacing of tail points in time
+    static constexpr float StaleMs = 50.0f;        // newest sample older than this: no tail
+    static constexpr float AccelerationDamping = 0.5f;
+    static constexpr float MaxOvershoot = 1.5f;    // tail length vs. velocity * horizon
+
+    void reset();
+    void addSample(const InputSample &sample);
+
+    // True when there is no sample, or the newest one is more than StaleMs older than
+    // `nowMs` (same clock as InputSample::timestamp)
+    bool isStale(quint64 nowMs) const;
+
+    // Predicted positions from just after the newest sample up to `horizonMs` ahead
+    // of it (document coordinates, oldest first), as of `nowMs`. Empty when there is
+    // too little motion or the samples are stale.
+    QList<QVector2D> predict(float horizonMs, quint64 nowMs) const;
+
+private:
+    // Position `dtMs` after the newest sample; false when no prediction is possible
+    bool extrapolate(float dtMs, QVector2D &pos) const;
+
+    InputSample m_samples[3]; // newest last
+    int m_count = 0;
+};
@@ -0,0 +1,260 @@
+#include "StrokeRasterizer.h"
+#include <QtConcurrent/QtConcurrentMap>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+Q_LOGGING_CATEGORY(lcDabs, "trahere.dabs", QtWarningMsg)
+
+namespace StrokeRasterizer {
+
+namespace {
+
+// Below this many dabs the thread hand-off costs more than it saves
+constexpr int ParallelDabThreshold = 4096;
+
+struct PreparedStroke {
+    std::shared_ptr<const StrokeDabs> dabs;
+    QRect bounds; // dabs->bounds clipped to the surface
+};
+
+DabKernel::Surface surfaceFor(QImage &target) {
+    DabKernel::Surface s;
+    s.bits = target.bits();
+    s.width = target.width();
+    s.height = target.height();
+    s.bytesPerLine = int(target.bytesPerLine());
+    return s;
+}
+
+DabKernel::Color kernelColor(const QColor &c) {
+    return DabKernel::Color{c.redF(), c.greenF(), c.blueF(), c.alphaF()};
+}
+
+QRect dabBounds(const QVector2D &c, float radius) {
+    const int reach = int(std::ceil(radius)) + 2;
+    const int x = int(std::floor(c.x()));
+    const int y = int(std::floor(c.y()));
+    return QRect(x - reach, y - reach, 2 * reach + 1, 2 * reach + 1);
+}
+
+} // namespace
+
+float dabRadius(float sizeLogical, float scale) {
+    return std::max(0.5f, sizeLogical * 0.5f * scale);
+}
+
+float dabSpacing(float radiusPix) {
+    return std::max(1.0f, radiusPix * 0.5f); // dense enough to avoid gaps
+}
+
+void interpolate(const QVector2D *ptsLogical, int n, float scale, float spacing, Cursor &cursor, QList<QVector2D> &dabs) {
+    if (cursor.nextPoint >= n) return;
+    // Always stamp first point
+    if (cursor.nextPoint == 0) {
+        dabs.append(ptsLogical[0] * scale);
+        cursor.nextPoint = 1;
+        cursor.carry = 0.0f;
+    }
+    for (int i = cursor.nextPoint; i < n; ++i) {
+        const QVector2D a = ptsLogical[i - 1] * scale;
+        const QVector2D b = ptsLogical[i] * scale;
+        const QVector2D d = b - a;
+        const float len = std::sqrt(d.lengthSquared());
+        if (len < 1e-3f) continue;
+        const QVector2D dir = d / len;
+        // Next dab lies `spacing` past the previous one, which may be on an earlier segment
+        float t = spacing - cursor.carry;
+        while (t <= len) {
+            dabs.append(a + dir * t);
+            t += spacing;
+        }
+        cursor.carry = len - (t - spacing);
+    }
+    cursor.nextPoint = n;
+}
+
+StrokeDabs computeDabs(const StrokeView &stroke, float scale) {
+    StrokeDabs result;
+    result.radius = dabRadius(stroke.size, scale);
+    Cursor cursor;
+    interpolate(stroke.points.data(), stroke.points.size(), scale, dabSpacing(result.radius), cursor, result.centres);
+    for (const QVector2D &d : std::as_const(result.centres)) result.bounds |= dabBounds(d, result.radius);
+    return result;
+}
+
+DabCache::DabCache(size_t budgetBytes)
+    : m_budget(budgetBytes)
+{
+}
+
+std::shared_ptr<const StrokeDabs> DabCache::find(quint64 strokeId, float scale) {
+    auto it = m_entries.find(strokeId);
+    if (it == m_entries.end() || it->second.scale != scale) return nullptr;
+    m_lru.splice(m_lru.begin(), m_lru, it->second.lruPos);
+    return it->second.dabs;
+}
+
+void DabCache::insert(quint64 strokeId, float scale, std::shared_ptr<const StrokeDabs> dabs) {
+    auto it = m_entries.find(strokeId);
+    if (it != m_entries.end()) {
+        m_bytes -= it->second.bytes;
+        m_lru.erase(it->second.lruPos);
+        m_entries.erase(it);
+    }
+    const size_t bytes = sizeof(StrokeDabs) + size_t(dabs->centres.size()) * sizeof(QVector2D);
+    m_lru.push_front(strokeId);
+    m_entries.emplace(strokeId, Entry{std::move(dabs), scale, bytes, m_lru.begin()});
+    m_bytes += bytes;
+    evict();
+}
+
+void DabCache::evict() {
+    while (m_bytes > m_budget && m_lru.size() > 1) {
+        auto it = m_entries.find(m_lru.back());
+        m_lru.pop_back();
+        if (it != m_entries.end()) {
+            m_bytes -= it->second.bytes;
+            m_entries.erase(it);
+        }
+    }
+}
+
+void DabCache::clear() {
+    m_entries.clear();
+    m_lru.clear();
+    m_bytes = 0;
+}
+
+std::shared_ptr<const StrokeDabs> dabsFor(const StrokeList &strokes, int index, float scale, DabCache *cache) {
+    std::shared_ptr<const StrokeDabs> dabs = cache ? cache->find(strokes.idAt(index), scale) : nullptr;
+    if (!dabs) {
+        const StrokeView stroke = strokes.at(index);
+        dabs = std::make_shared<const StrokeDabs>(computeDabs(stroke, scale));
+        qCDebug(lcDabs) << "stroke" << stroke.id << ":" << stroke.points.size() << "points ->"
+                        << dabs->centres.size() << "dabs";
+        if (cache) cache->insert(stroke.id, scale, dabs);
+    }
+    return dabs;
+}
+
+QRect stampDabs(const DabKernel::Surface &surface, const QList<QVector2D> &dabs, const QColor &color,
+                float radiusPix, const QRect &clip) {
+    const QRect area = clip.intersected(QRect(surface.originX, surface.originY, surface.width, surface.height));
+    if (area.isEmpty() || dabs.isEmpty()) return QRect();
+    // View of just the clip rectangle; dab centres stay in canvas coordinates
+    DabKernel::Surface view = surface;
+    view.bits = surface.bits + size_t(area.top() - surface.originY) * size_t(surface.bytesPerLine)
+                + size_t(area.left() - surface.originX) * 4;
+    view.originX = area.left();
+    view.originY = area.top();
+    view.width = area.width();
+    view.height = area.height();
+
+    const DabKernel::Color c = kernelColor(color);
+    QRect touched;
+    for (const QVector2D &d : dabs) {
+        if (!dabBounds(d, radiusPix).intersects(area)) continue;
+        touched |= DabKernel::stampCircle(view, d.x(), d.y(), radiusPix, c);
+    }
+    return touched;
+}
+
+QRect stampDabs(QImage &target, const QList<QVector2D> &dabs, const QColor &color, float radiusPix) {
+    const DabKernel::Surface s = surfaceFor(target);
+    return stampDabs(s, dabs, color, radiusPix, QRect(0, 0, s.width, s.height));
+}
+
+QRect rasterizeStrokes(QImage &target, const StrokeList &strokes, int first, float scale, DabCache *cache) {
+    QList<int> indices;
+    indices.reserve(std::max(0, strokes.size() - first));
+    for (int i = first; i < strokes.size(); ++i) indices.append(i);
+    return rasterizeStrokes(target, strokes, indices, target.rect(), scale, cache);
+}
+
+QRect rasterizeStrokes(QImage &target, const StrokeList &strokes, const QList<int> &indices, const QRect &clip,
+                       float scale, DabCache *cache) {
+    return rasterizeStrokes(target, QPoint(0, 0), strokes, indices, clip, scale, cache);
+}
+
+QRect rasterizeStrokes(QImage &target, const QPoint &origin, const StrokeList &strokes, const QList<int> &indices,
+                       const QRect &clip, float scale, DabCache *cache) {
+    const int count = int(indices.size());
+    if (count <= 0 || target.isNull()) return QRect();
+    QElapsedTimer timer;
+    timer.start();
+    // Take the pixel pointer once on this thread; workers only see the raw surface
+    DabKernel::Surface surface = surfaceFor(target);
+    surface.originX = origin.x();
+    surface.originY = origin.y();
+    const QRect canvas = clip & QRect(origin, target.size());
+    if (canvas.isEmpty()) return QRect();
+
+    // 1) Dabs of every stroke: cached ones are reused, the rest are interpolated
+    //    (independently per stroke, so in parallel)
+    std::vector<PreparedStroke> prepared(static_cast<size_t>(count));
+    std::vector<int> missing;
+    for (int i = 0; i < count; ++i) {
+        if (cache) prepared[size_t(i)].dabs = cache->find(strokes.idAt(indices.at(i)), scale);
+        if (!prepared[size_t(i)].dabs) missing.push_back(i);
+    }
+    auto prepare = [&](const int &i) {
+        prepared[size_t(i)].dabs = std::make_shared<const StrokeDabs>(computeDabs(strokes.at(indices.at(i)), scale));
+    };
+    const bool threaded = QThreadPool::globalInstance()->maxThreadCount() > 1;
+    if (threaded && missing.size() > 1) QtConcurrent::blockingMap(missing, prepare);
+    else for (const int &i : missing) prepare(i);
+    for (int i : missing) {
+        const quint64 id = strokes.idAt(indices.at(i));
+        qCDebug(lcDabs) << "stroke" << id << ":" << prepared[size_t(i)].dabs->centres.size() << "dabs";
+        if (cache) cache->insert(id, scale, prepared[size_t(i)].dabs);
+    }
+
+    size_t totalDabs = 0;
+    QRect touched;
+    for (PreparedStroke &p : prepared) {
+        p.bounds = p.dabs->bounds & canvas;
+        touched |= p.bounds;
+        totalDabs += size_t(p.dabs->centres.size());
+    }
+    if (!threaded || totalDabs < size_t(ParallelDabThreshold)) {
+        for (int i = 0; i < count; ++i) {
+            const StrokeDabs &d = *prepared[size_t(i)].dabs;
+            stampDabs(surface, d.centres, strokes.colorAt(indices.at(i)), d.radius, canvas);
+        }
+    } else {
+        // 2) Bin strokes into tiles (relative to the surface origin) by bounding box,
+        //    keeping stroke order within each tile
+        const int cols = (surface.width + TileSize - 1) / TileSize;
+        const int rows = (surface.height + TileSize - 1) / TileSize;
+        std::vector<std::vector<int>> bins(size_t(cols) * size_t(rows));
+        for (int i = 0; i < count; ++i) {
+            const QRect b = prepared[size_t(i)].bounds.translated(-origin);
+            if (b.isEmpty()) continue;
+            for (int ty = b.top() / TileSize; ty <= b.bottom() / TileSize; ++ty)
+                for (int tx = b.left() / TileSize; tx <= b.right() / TileSize; ++tx)
+                    bins[size_t(ty) * size_t(cols) + size_t(tx)].push_back(i);
+        }
+        std::vector<int> tiles;
+        for (size_t t = 0; t < bins.size(); ++t)
+            if (!bins[t].empty()) tiles.push_back(int(t));
+
+        // 3) Tiles are disjoint, so they can be stamped concurrently
+        QtConcurrent::blockingMap(tiles, [&](const int &t) {
+            const QRect tile = QRect(origin.x() + (t % cols) * TileSize, origin.y() + (t / cols) * TileSize,
+                                     TileSize, TileSize) & canvas;
+            for (int i : bins[size_t(t)]) {
+                const StrokeDabs &d = *prepared[size_t(i)].dabs;
+                stampDabs(surface, d.centres, strokes.colorAt(indices.at(i)), d.radius, tile);
+            }
+        });
+    }
+    qCDebug(lcDabs) << "rasterized" << count << "strokes," << totalDabs << "dabs,"
+                    << (count - int(missing.size())) << "strokes from cache," << timer.elapsed() << "ms";
+    return touched;
+}
+
+} // namespace StrokeRasterizer
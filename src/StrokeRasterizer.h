@@ -0,0 +1,100 @@
+#pragma once
+#include <QImage>
+#include <QList>
+#include <QVector2D>
+#include <QColor>
+#include <QRect>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include "BrushEngine.h"
+#include "DabKernel.h"
+
+// Turns brush strokes into dabs and stamps them onto premultiplied surfaces
+// (PixelOps::SurfaceFormat). Holds no QObject or GL state, so batches can be spread
+// over worker threads.
+namespace StrokeRasterizer {
+
+// Incremental stamping position along a stroke: index of the next point whose incoming
+// segment has not been interpolated yet, and the arc length travelled since the last dab
+// (so spacing carries over between segments and between calls).
+struct Cursor {
+    int nextPoint = 0;
+    float carry = 0.0f;
+};
+
+// Dab radius in pixels for a stroke size in logical units, and the spacing between dabs
+float dabRadius(float sizeLogical, float scale);
+float dabSpacing(float radiusPix);
+
+// Append the dab centres (pixels) for the part of the stroke not yet consumed by `cursor`.
+// The first point is always a dab; after that dabs lie every `spacing` pixels of arc length.
+// A fresh cursor replays the stroke from the start.
+void interpolate(const QVector2D *ptsLogical, int n, float scale, float spacing, Cursor &cursor, QList<QVector2D> &dabs);
+inline void interpolate(const QList<QVector2D> &ptsLogical, float scale, float spacing, Cursor &cursor, QList<QVector2D> &dabs) {
+    interpolate(ptsLogical.constData(), int(ptsLogical.size()), scale, spacing, cursor, dabs);
+}
+
+// Stamp dabs in order, restricted to `clip` (canvas pixels). Returns the touched rectangle.
+QRect stampDabs(const DabKernel::Surface &surface, const QList<QVector2D> &dabs, const QColor &color,
+                float radiusPix, const QRect &clip);
+QRect stampDabs(QImage &target, const QList<QVector2D> &dabs, const QColor &color, float radiusPix);
+
+// Dabs of one committed stroke at a given scale
+struct StrokeDabs {
+    QList<QVector2D> centres; // pixels
+    float radius = 0.5f;
+    QRect bounds;             // pixels any dab can touch (not clipped to a surface)
+};
+StrokeDabs computeDabs(const StrokeView &stroke, float scale);
+
+// Interpolated dabs of committed strokes, keyed by stroke id. Committed strokes never
+// change, so an entry stays valid until evicted (least recently used first once the
+// byte budget is exceeded) or until it is requested for a different scale.
+// Not thread-safe: used from the thread that drives rasterizeStrokes.
+class DabCache {
+public:
+    explicit DabCache(size_t budgetBytes = 32u * 1024u * 1024u);
+
+    std::shared_ptr<const StrokeDabs> find(quint64 strokeId, float scale);
+    void insert(quint64 strokeId, float scale, std::shared_ptr<const StrokeDabs> dabs);
+    void clear();
+    size_t bytesUsed() const { return m_bytes; }
+
+private:
+    struct Entry {
+        std::shared_ptr<const StrokeDabs> dabs;
+        float scale = 1.0f;
+        size_t bytes = 0;
+        std::list<quint64>::iterator lruPos;
+    };
+    void evict();
+
+    size_t m_budget;
+    size_t m_bytes = 0;
+    std::list<quint64> m_lru; // front = most recently used
+    std::unordered_map<quint64, Entry> m_entries;
+};
+
+// Dabs of stroke `index` of `strokes`, taken from `cache` when present (interpolated and
+// added on a miss; only then are the stroke's points read)
+std::shared_ptr<const StrokeDabs> dabsFor(const StrokeList &strokes, int index, float scale, DabCache *cache);
+
+// Rasterize strokes [first, strokes.size()) onto `target` in order. Dabs come from
+// `cache` when given (and newly interpolated strokes are added to it). Large batches are
+// binned by bounding box into TileSize tiles and the tiles stamped in parallel on the
+// global thread pool; each tile replays its strokes in order, so the result is
+// identical to the serial one. Dab counts are logged under the trahere.dabs category.
+// Returns the rectangle of pixels that may have changed.
+constexpr int TileSize = 256;
+QRect rasterizeStrokes(QImage &target, const StrokeList &strokes, int first, float scale, DabCache *cache = nullptr);
+// Same for the strokes at `indices` (ascending), touching only pixels inside `clip`
+QRect rasterizeStrokes(QImage &target, const StrokeList &strokes, const QList<int> &indices, const QRect &clip,
+                       float scale, DabCache *cache = nullptr);
+// Same onto a tile of the canvas: `target` holds the canvas pixels from `origin` on, and
+// `clip` and the returned rectangle are in canvas pixels
+QRect rasterizeStrokes(QImage &target, const QPoint &origin, const StrokeList &strokes, const QList<int> &indices,
+                       const QRect &clip, float scale, DabCache *cache = nullptr);
+
+} // namespace StrokeRasterizer
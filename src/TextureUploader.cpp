@@ -0,0 +1,132 @@
+#include "TextureUploader.h"
+#include <QOpenGLContext>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cstring>
+
+#ifndef GL_UNPACK_ROW_LENGTH
+#define GL_UNPACK_ROW_LENGTH 0x0CF2
+#endif
+
+TextureUploader::~TextureUploader() {
+    if (!m_initialized || !QOpenGLContext::currentContext()) return;
+    for (Slot &slot : m_slots) {
+        if (slot.fence) glDeleteSync(slot.fence);
+        if (slot.buffer) glDeleteBuffers(1, &slot.buffer);
+    }
+}
+
+void TextureUploader::initialize() {
+    if (m_initialized) return;
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+    if (!ctx) return;
+    initializeOpenGLFunctions();
+    // Pixel unpack buffers, buffer mapping and fences are core in GL 3.0 / ES 3.0,
+    // as is GL_UNPACK_ROW_LENGTH for the direct path
+    const bool gl3 = ctx->format().majorVersion() >= 3;
+    m_hasRowLength = !ctx->isOpenGLES() || gl3;
+    m_streaming = gl3 && qEnvironmentVariable("TRAHERE_PBO") != QLatin1String("0");
+    if (m_streaming) {
+        for (Slot &slot : m_slots) glGenBuffers(1, &slot.buffer);
+    }
+    m_initialized = true;
+}
+
+void TextureUploader::beginFrame() {
+    if (!m_streaming) return;
+    m_slot = (m_slot + 1) % RingSize;
+    m_offset = 0;
+    Slot &slot = m_slots[m_slot];
+    if (slot.fence) {
+        // Written RingSize frames ago, so normally signalled long since; if the GPU
+        // is that far behind, waiting here is the back-pressure we want
+        glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+    }
+}
+
+void TextureUploader::endFrame() {
+    if (!m_streaming || m_offset == 0) return;
+    m_slots[m_slot].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void TextureUploader::upload(GLuint texture, const QImage &surface, const QList<QRect> &rects) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (rects.isEmpty()) return;
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!m_streaming) {
+        uploadDirect(surface, rects);
+        m_uploadNs += timer.nsecsElapsed();
+        return;
+    }
+
+    qsizetype total = 0;
+    for (const QRect &r : rects) total += qsizetype(r.width()) * r.height() * 4;
+    Slot &slot = m_slots[m_slot];
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+    if (m_offset + total > slot.capacity) {
+        // Grow by orphaning: uploads already issued from the old storage keep it alive
+        slot.capacity = std::max({total, slot.capacity * 2, qsizetype(1) << 20});
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, slot.capacity, nullptr, GL_STREAM_DRAW);
+        m_offset = 0;
+    }
+    // The fence waited for in beginFrame() covers every earlier read of this buffer,
+    // and ranges within a frame never overlap, so the map need not synchronize
+    auto *dst = static_cast<uchar *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, m_offset, total,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+    if (!dst) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        uploadDirect(surface, rects);
+        m_uploadNs += timer.nsecsElapsed();
+        return;
+    }
+    // Rectangles are packed row by row, so the unpack state needs no row length
+    const qsizetype bpl = surface.bytesPerLine();
+    const uchar *bits = surface.constBits();
+    uchar *out = dst;
+    for (const QRect &r : rects) {
+        const size_t rowBytes = size_t(r.width()) * 4;
+        for (int y = r.top(); y <= r.bottom(); ++y) {
+            std::memcpy(out, bits + y * bpl + qsizetype(r.left()) * 4, rowBytes);
+            out += rowBytes;
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    qsizetype offset = m_offset;
+    for (const QRect &r : rects) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, r.left(), r.top(), r.width(), r.height(), GL_RGBA, GL_UNSIGNED_BYTE,
+                        reinterpret_cast<const void *>(offset));
+        offset += qsizetype(r.width()) * r.height() * 4;
+    }
+    m_offset = offset;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_uploadNs += timer.nsecsElapsed();
+}
+
+void TextureUploader::uploadDirect(const QImage &surface, const QList<QRect> &rects) {
+    // Sub-rectangle uploads need GL_UNPACK_ROW_LENGTH (desktop GL / GLES3); on GLES2
+    // each rectangle is widened to full rows so the source stays contiguous
+    const qsizetype bpl = surface.bytesPerLine();
+    const uchar *bits = surface.constBits();
+    if (m_hasRowLength) glPixelStorei(GL_UNPACK_ROW_LENGTH, surface.width());
+    for (const QRect &r : rects) {
+        if (m_hasRowLength) {
+            const uchar *src = bits + r.top() * bpl + qsizetype(r.left()) * 4;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, r.left(), r.top(), r.width(), r.height(), GL_RGBA, GL_UNSIGNED_BYTE, src);
+        } else {
+            const uchar *src = bits + r.top() * bpl;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, r.top(), surface.width(), r.height(), GL_RGBA, GL_UNSIGNED_BYTE, src);
+        }
+    }
+    if (m_hasRowLength) glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+qint64 TextureUploader::takeUploadNanoseconds() {
+    const qint64 ns = m_uploadNs;
+    m_uploadNs = 0;
+    return ns;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <QOpenGLExtraFunctions>
+#include <QImage>
+#include <QList>
+#include <QRect>
+
+// Streams CPU surface rectangles into GL textures.
+//
+// With OpenGL 3 / OpenGL ES 3 the pixels are copied into one of RingSize rotating
+// pixel unpack buffers and glTexSubImage2D reads from that buffer, so the call
+// returns without waiting for the transfer. Each frame's buffer is fenced in
+// endFrame() and only reused once that fence has signalled, RingSize frames later.
+// The transfer of frame N therefore overlaps the CPU stamping of frame N + 1.
+// Older contexts, or TRAHERE_PBO=0, fall back to plain glTexSubImage2D from client
+// memory.
+//
+// Render thread time spent in upload() is accumulated for measurement.
+// All calls need the render thread's context to be current.
+class TextureUploader : protected QOpenGLExtraFunctions {
+public:
+    static constexpr int RingSize = 3;
+
+    TextureUploader() = default;
+    ~TextureUploader();
+
+    void initialize();
+    bool isStreaming() const { return m_streaming; }
+
+    // Bracket all uploads of one frame
+    void beginFrame();
+    void endFrame();
+
+    // Copy `rects` of a premultiplied RGBA8 surface into the same place in `texture`,
+    // which must already have the surface's size. Leaves the texture bound.
+    void upload(GLuint texture, const QImage &surface, const QList<QRect> &rects);
+
+    // Time spent in upload() since the previous call
+    qint64 takeUploadNanoseconds();
+
+private:
+    struct Slot {
+        GLuint buffer = 0;
+        qsizetype capacity = 0;
+        GLsync fence = nullptr;
+    };
+
+    void uploadDirect(const QImage &surface, const QList<QRect> &rects);
+
+    bool m_initialized = false;
+    bool m_streaming = false;
+    bool m_hasRowLength = false;
+    Slot m_slots[RingSize];
+    int m_slot = 0;
+    qsizetype m_offset = 0; // bytes of the current slot used this frame
+    qint64 m_uploadNs = 0;
+};
@@ -0,0 +1,96 @@
+#include "TileCheckpoints.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+void TileCheckpoints::save(quint64 layerUid, quint64 strokeId, quint64 previousId, const QImage &surface,
+                           const StrokeRasterizer::StrokeDabs &dabs) {
+    if (surface.isNull() || m_budget <= 0) return;
+    const int cols = (surface.width() + TileSize - 1) / TileSize;
+    const int rows = (surface.height() + TileSize - 1) / TileSize;
+    // Tiles any dab can touch (same reach as the rasterizer's dab bounds)
+    const int reach = int(std::ceil(dabs.radius)) + 2;
+    std::vector<int> touched;
+    for (const QVector2D &c : dabs.centres) {
+        const int x0 = std::max(0, (int(std::floor(c.x())) - reach) / TileSize);
+        const int y0 = std::max(0, (int(std::floor(c.y())) - reach) / TileSize);
+        const int x1 = std::min(cols - 1, (int(std::floor(c.x())) + reach) / TileSize);
+        const int y1 = std::min(rows - 1, (int(std::floor(c.y())) + reach) / TileSize);
+        for (int ty = y0; ty <= y1; ++ty)
+            for (int tx = x0; tx <= x1; ++tx) touched.push_back(ty * cols + tx);
+    }
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+    Checkpoint cp;
+    cp.strokeId = strokeId;
+    cp.previousId = previousId;
+    cp.sequence = ++m_sequence;
+    cp.tiles.reserve(qsizetype(touched.size()));
+    size_t bytes = 0;
+    for (int t : touched) {
+        const QRect tile = QRect((t % cols) * TileSize, (t / cols) * TileSize, TileSize, TileSize) & surface.rect();
+        cp.tiles.append(tile);
+        bytes += size_t(tile.width()) * size_t(tile.height()) * 4;
+    }
+    cp.pixels.resize(bytes);
+    uchar *dst = cp.pixels.data();
+    for (const QRect &tile : std::as_const(cp.tiles)) {
+        const size_t row = size_t(tile.width()) * 4;
+        for (int y = tile.top(); y <= tile.bottom(); ++y, dst += row)
+            std::memcpy(dst, surface.constScanLine(y) + size_t(tile.left()) * 4, row);
+    }
+    m_bytes += qint64(bytes);
+    m_layers[layerUid].push_back(std::move(cp));
+    evict();
+}
+
+bool TileCheckpoints::restore(quint64 layerUid, int count, quint64 topId, quint64 newTopId, QImage &surface,
+                              QRect &restored) {
+    restored = QRect();
+    auto it = m_layers.find(layerUid);
+    if (it == m_layers.end() || count <= 0 || int(it->size()) < count) return false;
+    std::deque<Checkpoint> &stack = *it;
+    // The stack is contiguous in stamping order, so checking both ends of the range
+    // checks all of it
+    if (stack.back().strokeId != topId || stack[stack.size() - size_t(count)].previousId != newTopId) return false;
+    for (int i = 0; i < count; ++i) {
+        const Checkpoint &cp = stack.back();
+        const uchar *src = cp.pixels.data();
+        for (const QRect &tile : cp.tiles) {
+            const size_t row = size_t(tile.width()) * 4;
+            for (int y = tile.top(); y <= tile.bottom(); ++y, src += row)
+                std::memcpy(surface.scanLine(y) + size_t(tile.left()) * 4, src, row);
+            restored |= tile;
+        }
+        m_bytes -= qint64(cp.pixels.size());
+        stack.pop_back();
+    }
+    if (stack.empty()) m_layers.erase(it);
+    return true;
+}
+
+void TileCheckpoints::dropLayer(quint64 layerUid) {
+    auto it = m_layers.find(layerUid);
+    if (it == m_layers.end()) return;
+    for (const Checkpoint &cp : *it) m_bytes -= qint64(cp.pixels.size());
+    m_layers.erase(it);
+}
+
+void TileCheckpoints::setBudget(qint64 bytes) {
+    if (bytes == m_budget) return;
+    m_budget = bytes;
+    evict();
+}
+
+void TileCheckpoints::evict() {
+    while (m_bytes > m_budget && !m_layers.isEmpty()) {
+        auto oldest = m_layers.end();
+        for (auto it = m_layers.begin(); it != m_layers.end(); ++it) {
+            if (oldest == m_layers.end() || it->front().sequence < oldest->front().sequence) oldest = it;
+        }
+        m_bytes -= qint64(oldest->front().pixels.size());
+        oldest->pop_front();
+        if (oldest->empty()) m_layers.erase(oldest);
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QRect>
+#include <deque>
+#include <vector>
+#include "DirtyTiles.h"
+#include "StrokeRasterizer.h"
+
+// Pixels of layer surfaces as they were before each recently stamped stroke, kept per
+// DirtyTiles tile, so that undoing the newest strokes of a layer copies back just the
+// tiles they covered instead of replaying the layer.
+//
+// A layer's checkpoints form a stack in stamping order. Each remembers the id of the
+// stroke below it, so restore() can verify that the strokes being undone are exactly
+// the top of the stack. Anything else that changes a surface (a removal further
+// down, a rebuild) must drop the layer's checkpoints. Once the pixels kept exceed the
+// budget the oldest checkpoints of any layer go first; undoing past them falls back
+// to redrawing. Render thread only.
+class TileCheckpoints {
+public:
+    static constexpr int TileSize = DirtyTiles::TileSize;
+
+    explicit TileCheckpoints(qint64 budgetBytes = 64 * 1024 * 1024) : m_budget(budgetBytes) {}
+
+    // Call just before stamping stroke `strokeId` with `dabs` onto `surface`: keeps the
+    // tiles any dab reaches. `previousId` is the stroke below it (0 for none).
+    void save(quint64 layerUid, quint64 strokeId, quint64 previousId, const QImage &surface,
+              const StrokeRasterizer::StrokeDabs &dabs);
+    // Undo the top `count` strokes of a layer, the newest being `topId`, leaving
+    // `newTopId` on top (0 for none), and set `restored` to the area copied back.
+    // False (with `surface` untouched) when the checkpoints do not cover exactly those
+    // strokes.
+    bool restore(quint64 layerUid, int count, quint64 topId, quint64 newTopId, QImage &surface, QRect &restored);
+    void dropLayer(quint64 layerUid);
+
+    void setBudget(qint64 bytes);
+    qint64 bytesUsed() const { return m_bytes; }
+
+private:
+    struct Checkpoint {
+        quint64 strokeId = 0;
+        quint64 previousId = 0;
+        quint64 sequence = 0;       // global age, for eviction across layers
+        QList<QRect> tiles;         // clipped to the surface
+        std::vector<uchar> pixels;  // tile rows, tightly packed, in `tiles` order
+    };
+    void evict();
+
+    QHash<quint64, std::deque<Checkpoint>> m_layers; // per layer uid, oldest first
+    quint64 m_sequence = 0;
+    qint64 m_budget;
+    qint64 m_bytes = 0;
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <QByteArray>
+#include <QFile>
+#include <QImage>
+#include <QList>
+#include <QString>
+#include <QtEndian>
+
+// Reads back archives written by OraCreator. They only store, so every local header
+// carries the sizes and the data follows it as is.
+struct OraEntry {
+    QString name;
+    QByteArray data;
+};
+
+// Entries in file order; empty when the file cannot be read
+inline QList<OraEntry> readOraEntries(const QString &path) {
+    QList<OraEntry> entries;
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) return entries;
+    const QByteArray zip = f.readAll();
+    const auto *p = reinterpret_cast<const uchar *>(zip.constData());
+    qsizetype pos = 0;
+    while (pos + 30 <= zip.size() && qFromLittleEndian<quint32>(p + pos) == 0x04034B50) {
+        const quint32 size = qFromLittleEndian<quint32>(p + pos + 18);
+        const quint16 nameLength = qFromLittleEndian<quint16>(p + pos + 26);
+        const quint16 extraLength = qFromLittleEndian<quint16>(p + pos + 28);
+        const qsizetype dataPos = pos + 30 + nameLength + extraLength;
+        if (dataPos + qsizetype(size) > zip.size()) break;
+        entries.append(OraEntry{QString::fromUtf8(zip.mid(pos + 30, nameLength)), zip.mid(dataPos, size)});
+        pos = dataPos + size;
+    }
+    return entries;
+}
+
+inline QStringList oraEntryNames(const QList<OraEntry> &entries) {
+    QStringList names;
+    for (const OraEntry &e : entries) names.append(e.name);
+    return names;
+}
+
+inline QByteArray oraEntry(const QList<OraEntry> &entries, const QString &name) {
+    for (const OraEntry &e : entries) {
+        if (e.name == name) return e.data;
+    }
+    return QByteArray();
+}
+
+// PNG stores straight alpha: entries and the images they were written from are
+// compared in this format
+inline QImage straight(const QImage &img) {
+    return img.convertToFormat(QImage::Format_ARGB32);
+}
+
+inline QImage decoded(const QByteArray &png) {
+    return straight(QImage::fromData(png, "PNG"));
+}
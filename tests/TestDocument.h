@@ -0,0 +1,38 @@
+#pragma once
+#include <QColor>
+#include <QRandomGenerator>
+#include <memory>
+#include "BrushEngine.h"
+#include "DocumentSnapshot.h"
+
+// Document snapshots with random strokes, built the way Canvas::documentSnapshot()
+// builds them from its layers
+inline std::shared_ptr<LayerSnapshot> makeLayer(const QSize &size, int strokes, int pointsPerStroke, quint32 seed) {
+    QRandomGenerator rng(seed);
+    BrushEngine engine;
+    for (int s = 0; s < strokes; ++s) {
+        const QColor color = QColor::fromRgb(rng.bounded(256), rng.bounded(256), rng.bounded(256), 64 + rng.bounded(192));
+        QVector2D pos(float(rng.bounded(size.width())), float(rng.bounded(size.height())));
+        engine.beginStroke(pos, color, 1.0f + float(rng.bounded(40)));
+        for (int i = 1; i < pointsPerStroke; ++i) {
+            pos += QVector2D(float(rng.bounded(41) - 20), float(rng.bounded(41) - 20));
+            engine.addPoint(pos);
+        }
+        engine.endStroke();
+    }
+    auto layer = std::make_shared<LayerSnapshot>();
+    layer->uid = seed;
+    layer->strokes = engine.strokes();
+    layer->index = engine.index();
+    layer->strokeRevision = engine.revision();
+    return layer;
+}
+
+inline DocumentSnapshot makeDocument(const QSize &size, int layers, int strokesPerLayer, int pointsPerStroke = 40) {
+    DocumentSnapshot doc;
+    doc.generation = 1;
+    doc.size = size;
+    for (int i = 0; i < layers; ++i)
+        doc.layers.append(makeLayer(size, strokesPerLayer, pointsPerStroke, quint32(i + 1)));
+    return doc;
+}
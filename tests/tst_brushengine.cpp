@@ -0,0 +1,70 @@
+#include <QtTest>
+#include "BrushEngine.h"
+
+namespace {
+
+void addLine(BrushEngine &engine, const QVector2D &from, const QVector2D &to, float size) {
+    engine.beginStroke(from, Qt::black, size);
+    engine.addPoint(to);
+    engine.endStroke();
+}
+
+} // namespace
+
+class TestBrushEngine : public QObject {
+    Q_OBJECT
+
+private slots:
+    void strokeAtHitsPath();
+    void strokeAtToleranceOutsideBounds();
+    void strokeAtToleranceAcrossCells();
+    void strokeAtPrefersTopmost();
+};
+
+void TestBrushEngine::strokeAtHitsPath() {
+    BrushEngine engine;
+    addLine(engine, QVector2D(10, 10), QVector2D(100, 100), 4.0f);
+    QCOMPARE(engine.strokeAt(QPointF(50, 50)), 0);
+    QCOMPARE(engine.strokeAt(QPointF(51, 53)), 0);
+    // Inside the bounding box but away from the path
+    QCOMPARE(engine.strokeAt(QPointF(90, 20)), -1);
+    QCOMPARE(engine.strokeAt(QPointF(90, 20), 5.0f), -1);
+}
+
+void TestBrushEngine::strokeAtToleranceOutsideBounds() {
+    BrushEngine engine;
+    // Radius 2: the indexed bounds end 3 px from the path
+    addLine(engine, QVector2D(10, 10), QVector2D(100, 10), 4.0f);
+    QCOMPARE(engine.strokeAt(QPointF(50, 16)), -1);
+    // 6 px from the path, within radius + tolerance
+    QCOMPARE(engine.strokeAt(QPointF(50, 16), 5.0f), 0);
+    QCOMPARE(engine.strokeAt(QPointF(104, 6), 5.0f), 0);
+    QCOMPARE(engine.strokeAt(QPointF(50, 20), 5.0f), -1);
+}
+
+void TestBrushEngine::strokeAtToleranceAcrossCells() {
+    BrushEngine engine;
+    // Ends just left of the first index cell boundary; the query point is in the next
+    // cell, which the stroke does not reach
+    const float edge = float(StrokeIndex::CellSize);
+    addLine(engine, QVector2D(edge - 50, 40), QVector2D(edge - 5, 40), 2.0f);
+    QCOMPARE(engine.strokeAt(QPointF(edge + 2, 40)), -1);
+    QCOMPARE(engine.strokeAt(QPointF(edge + 2, 40), 8.0f), 0);
+    QCOMPARE(engine.strokeAt(QPointF(edge + 2, 40), 4.0f), -1);
+}
+
+void TestBrushEngine::strokeAtPrefersTopmost() {
+    BrushEngine engine;
+    addLine(engine, QVector2D(0, 50), QVector2D(100, 50), 4.0f);
+    addLine(engine, QVector2D(0, 60), QVector2D(100, 60), 4.0f);
+    addLine(engine, QVector2D(50, 0), QVector2D(50, 100), 4.0f);
+    QCOMPARE(engine.strokeAt(QPointF(50, 50)), 2);
+    QCOMPARE(engine.strokeAt(QPointF(20, 50)), 0);
+    // Both horizontal strokes are in reach; the later one is on top
+    QCOMPARE(engine.strokeAt(QPointF(20, 55), 4.0f), 1);
+    engine.removeStrokeAt(2);
+    QCOMPARE(engine.strokeAt(QPointF(50, 50)), 0);
+}
+
+QTEST_APPLESS_MAIN(TestBrushEngine)
+#include "tst_brushengine.moc"
@@ -0,0 +1,246 @@
+#include <QtTest>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include "DabKernel.h"
+#include "DabMaskCache.h"
+
+namespace {
+
+// Largest per-channel difference allowed between the kernel and the renderer it
+// replaced. Both count coverage on the same 4x4 sample grid; the kernel rounds the
+// source alpha once and blends in integers, the old renderer blended in floating
+// point and rounded the result. With an 8-bit brush colour that keeps every channel
+// within 1 LSB.
+constexpr int Tolerance = 1;
+
+struct Pixels {
+    std::vector<uint8_t> bits;
+    int width = 0;
+    int height = 0;
+
+    Pixels(int w, int h) : bits(size_t(w) * size_t(h) * 4), width(w), height(h) {}
+    DabKernel::Surface surface() {
+        DabKernel::Surface s;
+        s.bits = bits.data();
+        s.width = width;
+        s.height = height;
+        s.bytesPerLine = width * 4;
+        return s;
+    }
+};
+
+struct Random {
+    unsigned seed = 12345u;
+    float operator()() { seed = seed * 1103515245u + 12345u; return float((seed >> 8) & 0xFFFF) / 65535.0f; }
+    int byte() { return int((*this)() * 255.0f + 0.5f); }
+};
+
+// Premultiplied pixels with every alpha, as on a layer surface
+Pixels background(int w, int h, Random &rnd) {
+    Pixels p(w, h);
+    for (size_t i = 0; i < p.bits.size(); i += 4) {
+        const int a = rnd.byte();
+        for (int c = 0; c < 3; ++c) p.bits[i + size_t(c)] = uint8_t(std::min(a, rnd.byte()));
+        p.bits[i + 3] = uint8_t(a);
+    }
+    return p;
+}
+
+// A colour as the colour picker gives it: 8 bits per channel
+DabKernel::Color brushColor(Random &rnd, float minAlpha) {
+    auto to8 = [](float v) { return float(int(v * 255.0f + 0.5f)) / 255.0f; };
+    return DabKernel::Color{to8(rnd()), to8(rnd()), to8(rnd()), to8(minAlpha + (1.0f - minAlpha) * rnd())};
+}
+
+// The dab loop of the renderer the kernel replaced (paintCirclePix): 4x4 supersampled
+// edge pixels and floating-point premultiplied source-over, one pixel at a time
+void stampBaseline(Pixels &target, float cxPix, float cyPix, float radiusPix, const DabKernel::Color &color) {
+    const float r = std::max(0.5f, radiusPix);
+    const int rPix = static_cast<int>(std::ceil(r));
+    const int x0 = std::max(0, static_cast<int>(std::floor(cxPix - rPix)));
+    const int x1 = std::min(target.width - 1, static_cast<int>(std::ceil(cxPix + rPix)));
+    const int y0 = std::max(0, static_cast<int>(std::floor(cyPix - rPix)));
+    const int y1 = std::min(target.height - 1, static_cast<int>(std::ceil(cyPix + rPix)));
+
+    const float rSq = r * r;
+    constexpr float root2over2 = 0.70710678f;
+    const float inner = std::max(0.0f, r - root2over2);
+    const float innerSq = inner * inner;
+    const float outer = r + root2over2;
+    const float outerSq = outer * outer;
+    static const float offs[4] = {-0.375f, -0.125f, 0.125f, 0.375f};
+
+    for (int y = y0; y <= y1; ++y) {
+        uint8_t *scan = target.bits.data() + size_t(y) * size_t(target.width) * 4;
+        const float pyCenter = (float)y + 0.5f;
+        const float dyc = pyCenter - cyPix;
+        const float dycSq = dyc * dyc;
+        for (int x = x0; x <= x1; ++x) {
+            const float pxCenter = (float)x + 0.5f;
+            const float dxc = pxCenter - cxPix;
+            const float centerDistSq = dxc * dxc + dycSq;
+            float coverage = 0.0f;
+            if (centerDistSq <= innerSq) {
+                coverage = 1.0f;
+            } else if (centerDistSq >= outerSq) {
+                continue;
+            } else {
+                int inside = 0;
+                for (int jy = 0; jy < 4; ++jy) {
+                    const float dy = pyCenter + offs[jy] - cyPix;
+                    for (int ix = 0; ix < 4; ++ix) {
+                        const float dx = pxCenter + offs[ix] - cxPix;
+                        if (dx * dx + dy * dy <= rSq) ++inside;
+                    }
+                }
+                coverage = inside / 16.0f;
+                if (coverage <= 0.0f) continue;
+            }
+            const float srcA = std::clamp(coverage * color.a, 0.0f, 1.0f);
+            if (srcA <= 0.0f) continue;
+            uint8_t *px = scan + size_t(x) * 4;
+            const float src[4] = {color.r, color.g, color.b, 1.0f};
+            for (int c = 0; c < 4; ++c) {
+                const float out = src[c] * srcA + px[c] / 255.0f * (1.0f - srcA);
+                px[c] = uint8_t(std::lround(std::clamp(out * 255.0f, 0.0f, 255.0f)));
+            }
+        }
+    }
+}
+
+int maxDifference(const Pixels &a, const Pixels &b) {
+    int diff = 0;
+    for (size_t i = 0; i < a.bits.size(); ++i) diff = std::max(diff, std::abs(int(a.bits[i]) - int(b.bits[i])));
+    return diff;
+}
+
+const DabKernel::Isa AllIsas[] = {DabKernel::Isa::Scalar, DabKernel::Isa::SSE41, DabKernel::Isa::AVX2};
+
+} // namespace
+
+class TestDabKernel : public QObject {
+    Q_OBJECT
+
+private slots:
+    void matchesBaseline_data();
+    void matchesBaseline();
+    void isasWriteSameBytes();
+    void maskMatchesExactOnPhaseGrid();
+    void maskOffGridWithinHalfCoverage();
+};
+
+void TestDabKernel::matchesBaseline_data() {
+    QTest::addColumn<float>("maxRadius");
+    QTest::addColumn<float>("minAlpha");
+    QTest::newRow("small") << 6.0f << 0.05f;
+    QTest::newRow("medium") << 40.0f << 0.2f;
+    // Past DabMaskCache::MaxRadius, where stampCircle() samples every dab itself
+    QTest::newRow("large") << 300.0f << 0.5f;
+}
+
+void TestDabKernel::matchesBaseline() {
+    QFETCH(float, maxRadius);
+    QFETCH(float, minAlpha);
+    Random rnd;
+    const int size = int(maxRadius) * 2 + 40;
+    const Pixels under = background(size, size, rnd);
+    // One dab at a time on the same background, so a difference cannot build up
+    for (int i = 0; i < 60; ++i) {
+        const float radius = 0.3f + maxRadius * rnd();
+        const float cx = float(size) * (0.2f + 0.6f * rnd());
+        const float cy = float(size) * (0.2f + 0.6f * rnd());
+        const DabKernel::Color color = brushColor(rnd, minAlpha);
+        Pixels expected = under;
+        stampBaseline(expected, cx, cy, radius, color);
+        for (DabKernel::Isa isa : AllIsas) {
+            if (!DabKernel::isSupported(isa)) continue;
+            Pixels exact = under;
+            DabKernel::stampCircleExact(exact.surface(), cx, cy, radius, color, isa);
+            const int diff = maxDifference(exact, expected);
+            QVERIFY2(diff <= Tolerance, qPrintable(QStringLiteral("%1: dab %2 (radius %3) differs by %4, tolerance %5")
+                                                       .arg(QString::fromLatin1(DabKernel::isaName(isa))).arg(i)
+                                                       .arg(radius).arg(diff).arg(Tolerance)));
+        }
+    }
+}
+
+void TestDabKernel::isasWriteSameBytes() {
+    // Overlapping dabs through the mask cache and without it, clipped at every edge
+    Random rnd;
+    const Pixels under = background(197, 131, rnd);
+    std::vector<Pixels> results;
+    for (DabKernel::Isa isa : AllIsas) {
+        if (!DabKernel::isSupported(isa)) continue;
+        Pixels p = under;
+        Random dabs;
+        for (int i = 0; i < 400; ++i) {
+            const float radius = 0.2f + 30.0f * dabs() * dabs();
+            const float cx = -20.0f + 237.0f * dabs();
+            const float cy = -20.0f + 171.0f * dabs();
+            const DabKernel::Color color = brushColor(dabs, 0.0f);
+            if (i % 2) DabKernel::stampCircle(p.surface(), cx, cy, radius, color, isa);
+            else DabKernel::stampCircleExact(p.surface(), cx, cy, radius, color, isa);
+        }
+        results.push_back(std::move(p));
+    }
+    for (size_t i = 1; i < results.size(); ++i) QCOMPARE(maxDifference(results[i], results[0]), 0);
+}
+
+void TestDabKernel::maskMatchesExactOnPhaseGrid() {
+    // The mask cache only moves the centre to the nearest phase and rounds the radius;
+    // on that grid it must write exactly what sampling each dab does
+    Random rnd;
+    const Pixels under = background(160, 160, rnd);
+    for (int i = 0; i < 200; ++i) {
+        const float radius = float(int(1 + 60 * rnd() * rnd() * DabMaskCache::RadiusSteps)) / DabMaskCache::RadiusSteps;
+        const float cx = float(int(160 * rnd() * DabMaskCache::PhaseSteps)) / DabMaskCache::PhaseSteps;
+        const float cy = float(int(160 * rnd() * DabMaskCache::PhaseSteps)) / DabMaskCache::PhaseSteps;
+        const DabKernel::Color color = brushColor(rnd, 0.1f);
+        Pixels masked = under;
+        Pixels exact = under;
+        const QRect a = DabKernel::stampCircle(masked.surface(), cx, cy, radius, color);
+        const QRect b = DabKernel::stampCircleExact(exact.surface(), cx, cy, radius, color);
+        QVERIFY(b.contains(a));
+        QVERIFY2(maxDifference(masked, exact) == 0,
+                 qPrintable(QStringLiteral("dab %1 at (%2, %3), radius %4").arg(i).arg(cx).arg(cy).arg(radius)));
+    }
+}
+
+void TestDabKernel::maskOffGridWithinHalfCoverage() {
+    // Off the grid the mask cache stamps the dab with its centre and radius rounded:
+    // exactly the dab at the rounded values, and at the given ones each pixel's
+    // coverage within Samples / 2. Opaque white on transparent makes the written alpha
+    // the coverage, (coverage * 255 + 8) / 16.
+    constexpr int MaxAlphaDifference = (DabKernel::Samples / 2 * 255 + DabKernel::Samples - 1) / DabKernel::Samples;
+    Random rnd;
+    const DabKernel::Color white{1.0f, 1.0f, 1.0f, 1.0f};
+    int largest = 0;
+    for (int i = 0; i < 400; ++i) {
+        const float radius = float(int(2 + 60 * rnd() * rnd() * DabMaskCache::RadiusSteps)) / DabMaskCache::RadiusSteps;
+        const float cx = float(int(30 + 100 * rnd() * DabMaskCache::PhaseSteps)) / DabMaskCache::PhaseSteps;
+        const float cy = float(int(30 + 100 * rnd() * DabMaskCache::PhaseSteps)) / DabMaskCache::PhaseSteps;
+        // Less than half a step off, so each value rounds back to the grid
+        auto off = [&rnd](int steps) { return (rnd() - 0.5f) * 0.99f / float(steps); };
+        const float ox = cx + off(DabMaskCache::PhaseSteps);
+        const float oy = cy + off(DabMaskCache::PhaseSteps);
+        const float oradius = radius + off(DabMaskCache::RadiusSteps);
+        Pixels masked(160, 160);
+        Pixels snapped(160, 160);
+        Pixels exact(160, 160);
+        DabKernel::stampCircle(masked.surface(), ox, oy, oradius, white);
+        DabKernel::stampCircleExact(snapped.surface(), cx, cy, radius, white);
+        DabKernel::stampCircleExact(exact.surface(), ox, oy, oradius, white);
+        const QString dab = QStringLiteral("dab %1 at (%2, %3), radius %4").arg(i).arg(ox).arg(oy).arg(oradius);
+        QVERIFY2(maxDifference(masked, snapped) == 0, qPrintable(dab));
+        const int diff = maxDifference(masked, exact);
+        QVERIFY2(diff <= MaxAlphaDifference, qPrintable(dab + QStringLiteral(" differs by %1").arg(diff)));
+        largest = std::max(largest, diff);
+    }
+    // The rounding does show at the given centres and radii
+    QVERIFY(largest > 0);
+}
+
+QTEST_APPLESS_MAIN(TestDabKernel)
+#include "tst_dabkernel.moc"
@@ -0,0 +1,80 @@
+#include <QtTest>
+#include <QtConcurrent/QtConcurrentMap>
+#include <atomic>
+#include <cmath>
+#include "DabMaskCache.h"
+
+class TestDabMaskCache : public QObject {
+    Q_OBJECT
+
+private slots:
+    void largestMaskSize();
+    void hitsReturnTheCachedMask();
+    void evictsLeastRecentlyUsed();
+    void concurrentLookups();
+};
+
+void TestDabMaskCache::largestMaskSize() {
+    // What MaxRadius is chosen by: one phase of the largest cached dab
+    DabMaskCache cache;
+    const auto mask = cache.mask(DabMaskCache::MaxRadius, 0, 0);
+    QCOMPARE(mask->size, 517);
+    QCOMPARE(mask->coverage.size(), size_t(517 * 517));
+    QCOMPARE(cache.bytesUsed(), mask->bytes());
+}
+
+void TestDabMaskCache::hitsReturnTheCachedMask() {
+    DabMaskCache cache;
+    const auto a = cache.mask(7.3f, 1, 2);
+    // Same quantized radius and phase
+    QCOMPARE(cache.mask(7.26f, 1, 2).get(), a.get());
+    QVERIFY(cache.mask(7.3f, 2, 1).get() != a.get());
+    QCOMPARE(cache.bytesUsed(), 2 * a->bytes());
+    cache.clear();
+    QCOMPARE(cache.bytesUsed(), size_t(0));
+    QVERIFY(cache.mask(7.3f, 1, 2).get() != a.get());
+}
+
+void TestDabMaskCache::evictsLeastRecentlyUsed() {
+    // Masks of one radius all have the same size; room for three and a half
+    const size_t bytes = DabMaskCache().mask(10.0f, 0, 0)->bytes();
+    DabMaskCache cache(3 * bytes + bytes / 2);
+    const auto a = cache.mask(10.0f, 0, 0);
+    const auto b = cache.mask(10.0f, 1, 0);
+    const auto c = cache.mask(10.0f, 2, 0);
+    QCOMPARE(cache.mask(10.0f, 0, 0).get(), a.get()); // a is now more recent than b
+    const auto d = cache.mask(10.0f, 3, 0);
+    QCOMPARE(cache.bytesUsed(), 3 * bytes);
+    QCOMPARE(cache.mask(10.0f, 0, 0).get(), a.get());
+    QCOMPARE(cache.mask(10.0f, 2, 0).get(), c.get());
+    QCOMPARE(cache.mask(10.0f, 3, 0).get(), d.get());
+    // b was evicted, but the caller's copy stays valid
+    QCOMPARE(b->size, a->size);
+    // A budget below a single mask keeps the most recent one
+    const auto e = cache.mask(10.0f, 0, 3);
+    cache.setBudget(1);
+    QCOMPARE(cache.bytesUsed(), bytes);
+    QCOMPARE(cache.mask(10.0f, 0, 3).get(), e.get());
+}
+
+void TestDabMaskCache::concurrentLookups() {
+    // Threads stamping dabs of a few radii at once, with a budget small enough that
+    // misses keep evicting while others hit
+    DabMaskCache cache(64 * 1024);
+    QList<int> workers(8);
+    std::atomic<int> wrong{0};
+    QtConcurrent::blockingMap(workers, [&](int &) {
+        for (int i = 0; i < 20000; ++i) {
+            const float radius = 2.0f + float(i % 13);
+            const auto mask = cache.mask(radius, i % DabMaskCache::PhaseSteps, (i / 4) % DabMaskCache::PhaseSteps);
+            // Covers the dab: reach is ceil(radius + 0.5) + 1 on each side
+            if (mask->size != 2 * (int(std::ceil(radius + 0.5f)) + 1) + 1 || mask->spanEnd[size_t(mask->origin)] < 0)
+                wrong.fetch_add(1);
+        }
+    });
+    QCOMPARE(wrong.load(), 0);
+    QVERIFY(cache.bytesUsed() <= cache.budget());
+}
+
+QTEST_APPLESS_MAIN(TestDabMaskCache)
+#include "tst_dabmaskcache.moc"
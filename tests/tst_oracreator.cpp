@@ -0,0 +1,151 @@
+#include <QtTest>
+#include <QBuffer>
+#include <QPainter>
+#include <QTemporaryDir>
+#include "OraArchive.h"
+#include "OraCreator.h"
+#include "PixelOps.h"
+
+namespace {
+
+// Gradients with partial alpha in every channel, different per layer, so a layer
+// written to the wrong entry or a wrongly (un)premultiplied pixel shows up
+QImage makeLayer(const QSize &size, int seed, QImage::Format format) {
+    QImage img(size, QImage::Format_ARGB32);
+    for (int y = 0; y < size.height(); ++y) {
+        for (int x = 0; x < size.width(); ++x) {
+            const int a = (x * 7 + y * 3 + seed * 40) % 256;
+            img.setPixel(x, y, qRgba((x + seed * 50) % 256, (y * 2 + seed) % 256, (x ^ y) % 256, a));
+        }
+    }
+    return img.convertToFormat(format);
+}
+
+// What saveOraMulti stores for an image, encoded on this thread alone
+QByteArray serialPng(const QImage &img) {
+    QByteArray png;
+    QBuffer buf(&png);
+    buf.open(QIODevice::WriteOnly);
+    return img.save(&buf, "PNG") ? png : QByteArray();
+}
+
+struct Layers {
+    QList<QImage> images; // top first
+    QStringList names;
+    QList<bool> visible;
+    QList<qreal> opacities;
+};
+
+Layers makeLayers(const QSize &size, int count) {
+    Layers layers;
+    for (int i = 0; i < count; ++i) {
+        // Mixed formats, as the export paths hand them over
+        layers.images.append(makeLayer(size, i, i % 2 ? QImage::Format_ARGB32 : PixelOps::SurfaceFormat));
+        layers.names.append(QStringLiteral("layer %1").arg(i));
+        layers.visible.append(i != 1);
+        layers.opacities.append(i % 3 ? 1.0 : 0.6);
+    }
+    return layers;
+}
+
+} // namespace
+
+class TestOraCreator : public QObject {
+    Q_OBJECT
+
+private slots:
+    void layersMatchSerialEncode();
+    void mergedImageMatchesComposite();
+    void mergedImageIsOptional();
+    void givenMergedImageIsStored();
+};
+
+void TestOraCreator::layersMatchSerialEncode() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("layers.ora"));
+    // More layers than a typical pool has threads, so tasks finish out of order
+    const Layers layers = makeLayers(QSize(300, 170), 12);
+    OraCreator creator;
+    QVERIFY(creator.saveOraMulti(path, layers.images, layers.names, layers.visible, layers.opacities, OraCreator::Progress()));
+
+    const QList<OraEntry> entries = readOraEntries(path);
+    QCOMPARE(entries.size(), 2 + 12 + 2);
+    QCOMPARE(entries.at(0).name, QStringLiteral("mimetype"));
+    QCOMPARE(entries.at(1).name, QStringLiteral("stack.xml"));
+    const QByteArray stack = entries.at(1).data;
+    for (int i = 0; i < 12; ++i) {
+        const QString file = QStringLiteral("data/layer%1.png").arg(i);
+        QCOMPARE(entries.at(2 + i).name, file);
+        // Same bytes as encoding the layer alone, and the same pixels back
+        const QByteArray png = entries.at(2 + i).data;
+        QCOMPARE(png, serialPng(layers.images.at(i)));
+        QCOMPARE(decoded(png), straight(layers.images.at(i)));
+        const QString layer = QStringLiteral("name=\"%1\" src=\"%2\" x=\"0\" y=\"0\" opacity=\"%3\" visibility=\"%4\"")
+                                  .arg(layers.names.at(i), file, i % 3 ? QStringLiteral("1.000") : QStringLiteral("0.600"),
+                                       layers.visible.at(i) ? QStringLiteral("visible") : QStringLiteral("hidden"));
+        QVERIFY2(stack.contains(layer.toUtf8()), qPrintable(layer));
+    }
+}
+
+void TestOraCreator::mergedImageMatchesComposite() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("merged.ora"));
+    const Layers layers = makeLayers(QSize(640, 400), 4);
+    OraCreator creator;
+    QVERIFY(creator.saveOraMulti(path, layers.images, layers.names, layers.visible, layers.opacities, OraCreator::Progress()));
+
+    // The visible layers, bottom first, painted at their opacity over transparent
+    QImage composite(640, 400, QImage::Format_RGBA8888);
+    composite.fill(Qt::transparent);
+    {
+        QPainter p(&composite);
+        for (int i = int(layers.images.size()) - 1; i >= 0; --i) {
+            if (!layers.visible.at(i)) continue;
+            p.setOpacity(layers.opacities.at(i));
+            p.drawImage(0, 0, layers.images.at(i));
+        }
+    }
+    const QList<OraEntry> entries = readOraEntries(path);
+    QCOMPARE(entries.at(entries.size() - 2).name, QStringLiteral("mergedimage.png"));
+    QCOMPARE(entries.last().name, QStringLiteral("Thumbnails/thumbnail.png"));
+    QCOMPARE(decoded(entries.at(entries.size() - 2).data), straight(composite));
+    // Scaled to fit 256 px
+    QCOMPARE(decoded(entries.last().data).size(), QSize(256, 160));
+}
+
+void TestOraCreator::mergedImageIsOptional() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("nomerged.ora"));
+    const Layers layers = makeLayers(QSize(64, 48), 2);
+    OraCreator creator;
+    creator.setWriteMergedImage(false);
+    QVERIFY(creator.saveOraMulti(path, layers.images, layers.names, layers.visible));
+    const QStringList expected{QStringLiteral("mimetype"), QStringLiteral("stack.xml"),
+                               QStringLiteral("data/layer0.png"), QStringLiteral("data/layer1.png"),
+                               QStringLiteral("Thumbnails/thumbnail.png")};
+    QCOMPARE(oraEntryNames(readOraEntries(path)), expected);
+}
+
+void TestOraCreator::givenMergedImageIsStored() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("given.ora"));
+    const Layers layers = makeLayers(QSize(96, 80), 3);
+    const QImage merged = makeLayer(QSize(96, 80), 7, PixelOps::SurfaceFormat);
+    OraCreator creator;
+    creator.setMergedImage(merged);
+    QVERIFY(creator.saveOraMulti(path, layers.images, layers.names, layers.visible));
+    const QList<OraEntry> entries = readOraEntries(path);
+    QCOMPARE(oraEntry(entries, QStringLiteral("mergedimage.png")), serialPng(merged));
+    QCOMPARE(oraEntry(entries, QStringLiteral("Thumbnails/thumbnail.png")), serialPng(merged));
+    // Not the layers' size: nothing is written
+    creator.setMergedImage(makeLayer(QSize(95, 80), 7, PixelOps::SurfaceFormat));
+    QVERIFY(!creator.saveOraMulti(dir.filePath(QStringLiteral("wrong.ora")), layers.images, layers.names, layers.visible));
+    QVERIFY(!QFile::exists(dir.filePath(QStringLiteral("wrong.ora"))));
+}
+
+QTEST_MAIN(TestOraCreator)
+#include "tst_oracreator.moc"
@@ -0,0 +1,140 @@
+#include <QtTest>
+#include <cmath>
+#include "BrushEngine.h"
+#include "PointCodec.h"
+
+namespace {
+
+// Curving strokes with tablet-like sub-pixel positions, 0.5-6 px between samples,
+// spread over an 8K canvas
+QList<QVector2D> makePoints(int count) {
+    QList<QVector2D> points;
+    points.reserve(count);
+    unsigned seed = 12345u;
+    auto rnd = [&seed]() { seed = seed * 1103515245u + 12345u; return float((seed >> 8) & 0xFFFF) / 65535.0f; };
+    QVector2D pos;
+    float heading = 0.0f;
+    for (int i = 0; i < count; ++i) {
+        if (i % 500 == 0) {
+            pos = QVector2D(rnd() * 8192.0f, rnd() * 8192.0f);
+            heading = rnd() * 6.2832f;
+        }
+        heading += (rnd() - 0.5f) * 0.3f;
+        const float step = 0.5f + 5.5f * rnd();
+        pos += QVector2D(std::cos(heading), std::sin(heading)) * step;
+        points.append(pos);
+    }
+    return points;
+}
+
+QByteArray encoded(const QList<QVector2D> &points) {
+    QByteArray bytes(points.size() * PointCodec::MaxBytesPerPoint, Qt::Uninitialized);
+    bytes.resize(PointCodec::encode(points.constData(), int(points.size()), reinterpret_cast<quint8 *>(bytes.data())));
+    return bytes;
+}
+
+QList<QVector2D> decoded(const QByteArray &bytes, int count) {
+    QList<QVector2D> points(count);
+    PointCodec::decode(reinterpret_cast<const quint8 *>(bytes.constData()), count, points.data());
+    return points;
+}
+
+constexpr float MaxError = 1.0f / 32.0f; // half a quantization step
+
+} // namespace
+
+class TestPointCodec : public QObject {
+    Q_OBJECT
+
+private slots:
+    void roundTripWithinHalfStep();
+    void reencodeGivesSameBytes();
+    void clampsFarCoordinates();
+    void deltaListMatchesFloatList();
+    void benchmarkEncode();
+    void benchmarkDecode();
+};
+
+void TestPointCodec::roundTripWithinHalfStep() {
+    QList<QVector2D> points = makePoints(20000);
+    // Exact ties, negative coordinates and a jump across the canvas
+    points.append(QVector2D(1.0f + MaxError, -1.0f - MaxError));
+    points.append(QVector2D(-3.5f, -0.001f));
+    points.append(QVector2D(0.0f, 0.0f));
+    points.append(QVector2D(16000.0f, 16000.0f));
+    const QList<QVector2D> back = decoded(encoded(points), int(points.size()));
+    for (int i = 0; i < points.size(); ++i) {
+        QVERIFY2(std::abs(back.at(i).x() - points.at(i).x()) <= MaxError
+                     && std::abs(back.at(i).y() - points.at(i).y()) <= MaxError,
+                 qPrintable(QStringLiteral("point %1").arg(i)));
+        QCOMPARE(back.at(i), PointCodec::quantize(points.at(i)));
+    }
+}
+
+void TestPointCodec::reencodeGivesSameBytes() {
+    const QList<QVector2D> points = makePoints(5000);
+    const QByteArray bytes = encoded(points);
+    // Most points fit in far fewer than 8 bytes
+    QVERIFY(bytes.size() < points.size() * 4);
+    QCOMPARE(encoded(decoded(bytes, int(points.size()))), bytes);
+}
+
+void TestPointCodec::clampsFarCoordinates() {
+    const float limit = float(1 << 24);
+    const QList<QVector2D> points{QVector2D(1e12f, -1e12f), QVector2D(-1e12f, 1e12f), QVector2D(1.0f, 2.0f)};
+    const QList<QVector2D> back = decoded(encoded(points), int(points.size()));
+    QCOMPARE(back.at(0), QVector2D(limit, -limit));
+    QCOMPARE(back.at(1), QVector2D(-limit, limit));
+    QCOMPARE(back.at(2), QVector2D(1.0f, 2.0f));
+}
+
+void TestPointCodec::deltaListMatchesFloatList() {
+    const QList<QVector2D> points = makePoints(3000);
+    StrokeList floats;
+    floats.setEncoding(StrokeList::Encoding::Float);
+    quint64 id = 1;
+    for (int first = 0; first < points.size(); first += 300) {
+        // Strokes of different lengths, so the decode buffer is reused at other sizes
+        const int count = 20 + (first / 300) * 37 % 280;
+        floats.append(BrushStroke{QColor(10, 20, 30, 200), 4.0f, points.mid(first, count), id++});
+    }
+    StrokeList delta = floats;
+    delta.setEncoding(StrokeList::Encoding::Delta);
+    QCOMPARE(delta.size(), floats.size());
+    QVERIFY(delta.arenaBytes() > 0);
+    for (int i = 0; i < floats.size(); ++i) {
+        const StrokeView f = floats.at(i);
+        const StrokeView d = delta.at(i);
+        QCOMPARE(d.id, f.id);
+        QCOMPARE(d.color, f.color);
+        QCOMPARE(d.points.size(), f.points.size());
+        for (int p = 0; p < f.points.size(); ++p)
+            QCOMPARE(d.points.at(p), PointCodec::quantize(f.points.at(p)));
+    }
+    // Back to floats keeps the rounded points
+    delta.setEncoding(StrokeList::Encoding::Float);
+    QCOMPARE(delta.at(3).points.at(5), PointCodec::quantize(floats.at(3).points.at(5)));
+}
+
+void TestPointCodec::benchmarkEncode() {
+    const QList<QVector2D> points = makePoints(1024 * 1024);
+    QByteArray bytes(points.size() * PointCodec::MaxBytesPerPoint, Qt::Uninitialized);
+    int size = 0;
+    QBENCHMARK {
+        size = PointCodec::encode(points.constData(), int(points.size()), reinterpret_cast<quint8 *>(bytes.data()));
+    }
+    qDebug() << double(size) / double(points.size()) << "bytes per point";
+}
+
+void TestPointCodec::benchmarkDecode() {
+    const QList<QVector2D> points = makePoints(1024 * 1024);
+    const QByteArray bytes = encoded(points);
+    QList<QVector2D> back(points.size());
+    QBENCHMARK {
+        PointCodec::decode(reinterpret_cast<const quint8 *>(bytes.constData()), int(points.size()), back.data());
+    }
+    QCOMPARE(back.last(), PointCodec::quantize(points.last()));
+}
+
+QTEST_APPLESS_MAIN(TestPointCodec)
+#include "tst_pointcodec.moc"
@@ -0,0 +1,176 @@
+#include <QtTest>
+#include <QDir>
+#include <QFile>
+#include <QPromise>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+#include "OraArchive.h"
+#include "OraCreator.h"
+#include "PixelOps.h"
+#include "RasterEngine.h"
+#include "SaveJobs.h"
+#include "TestDocument.h"
+
+namespace {
+
+bool writeFile(const QString &path, const QByteArray &contents) {
+    QFile f(path);
+    return f.open(QIODevice::WriteOnly) && f.write(contents) == contents.size();
+}
+
+QByteArray readFile(const QString &path) {
+    QFile f(path);
+    return f.open(QIODevice::ReadOnly) ? f.readAll() : QByteArray();
+}
+
+} // namespace
+
+class TestSaveJobs : public QObject {
+    Q_OBJECT
+
+private slots:
+    void savesEveryLayer();
+    void savesFlattened();
+    void cancelledBeforeStartWritesNothing();
+    void cancelledWhileRenderingWritesNothing();
+    void cancelledBeforeCommitWritesNothing();
+};
+
+void TestSaveJobs::savesEveryLayer() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("layers.ora"));
+    // Not a multiple of the tile size, one hidden layer, a base image
+    DocumentSnapshot doc = makeDocument(QSize(700, 530), 3, 60);
+    std::const_pointer_cast<LayerSnapshot>(doc.layers[1])->visible = false;
+    std::const_pointer_cast<LayerSnapshot>(doc.layers[2])->opacity = 0.25f;
+    doc.baseImage = PixelOps::makeSurface(QSize(350, 265), QColor(40, 80, 120));
+    const QStringList names{QStringLiteral("bottom"), QStringLiteral("middle"), QStringLiteral("top")};
+
+    QFuture<bool> future = QtConcurrent::run(&SaveJobs::saveLayers, QUrl::fromLocalFile(path), doc, names, true);
+    int lastProgress = 0;
+    while (!future.isFinished()) {
+        QVERIFY(future.progressValue() >= lastProgress);
+        lastProgress = future.progressValue();
+        QThread::msleep(1);
+    }
+    QVERIFY(future.resultCount() == 1 && future.result());
+    QVERIFY(future.progressMaximum() > 0);
+    QCOMPARE(future.progressValue(), future.progressMaximum());
+
+    const QList<OraEntry> entries = readOraEntries(path);
+    const QStringList expected{QStringLiteral("mimetype"), QStringLiteral("stack.xml"),
+                               QStringLiteral("data/layer0.png"), QStringLiteral("data/layer1.png"),
+                               QStringLiteral("data/layer2.png"), QStringLiteral("data/layer3.png"),
+                               QStringLiteral("mergedimage.png"), QStringLiteral("Thumbnails/thumbnail.png")};
+    QCOMPARE(oraEntryNames(entries), expected);
+    const QByteArray stack = oraEntry(entries, QStringLiteral("stack.xml"));
+    QVERIFY(stack.indexOf("name=\"top\"") < stack.indexOf("name=\"middle\""));
+    QVERIFY(stack.contains("name=\"top\" src=\"data/layer0.png\" x=\"0\" y=\"0\" opacity=\"0.250\" visibility=\"visible\""));
+    QVERIFY(stack.contains("name=\"middle\" src=\"data/layer1.png\" x=\"0\" y=\"0\" opacity=\"1.000\" visibility=\"hidden\""));
+    QVERIFY(stack.contains("name=\"Base\" src=\"data/layer3.png\" x=\"0\" y=\"0\" opacity=\"1.000\" visibility=\"visible\""));
+    // Rendered tile by tile, each layer matches a whole-layer render
+    for (int i = 0; i < 3; ++i) {
+        const QImage layer = RasterEngine::renderLayer(*doc.layers.at(2 - i), doc.size);
+        QCOMPARE(decoded(oraEntry(entries, QStringLiteral("data/layer%1.png").arg(i))), straight(layer));
+    }
+    QCOMPARE(decoded(oraEntry(entries, QStringLiteral("data/layer3.png"))).size(), doc.size);
+    // The merged image is the document as exported: base image and visible layers at
+    // their opacity, over transparent
+    RasterEngine::Options merged;
+    merged.background = Qt::transparent;
+    QCOMPARE(decoded(oraEntry(entries, QStringLiteral("mergedimage.png"))), straight(RasterEngine::renderDocument(doc, merged)));
+    QCOMPARE(QDir(dir.path()).entryList(QDir::Files), QStringList{QStringLiteral("layers.ora")});
+}
+
+void TestSaveJobs::savesFlattened() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("flat.ora"));
+    const DocumentSnapshot doc = makeDocument(QSize(600, 520), 2, 40);
+    RasterEngine::Options options;
+    options.background = Qt::transparent;
+
+    QFuture<bool> future = QtConcurrent::run(&SaveJobs::saveFlattened, QUrl::fromLocalFile(path), doc, options);
+    future.waitForFinished();
+    QVERIFY(future.resultCount() == 1 && future.result());
+    QCOMPARE(future.progressValue(), future.progressMaximum());
+    const QList<OraEntry> entries = readOraEntries(path);
+    const QStringList expected{QStringLiteral("mimetype"), QStringLiteral("stack.xml"),
+                               QStringLiteral("data/layer0.png"), QStringLiteral("Thumbnails/thumbnail.png")};
+    QCOMPARE(oraEntryNames(entries), expected);
+    QCOMPARE(decoded(oraEntry(entries, QStringLiteral("data/layer0.png"))),
+             straight(RasterEngine::renderDocument(doc, options)));
+}
+
+void TestSaveJobs::cancelledBeforeStartWritesNothing() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("doc.ora"));
+    QVERIFY(writeFile(path, "previous save"));
+    const DocumentSnapshot doc = makeDocument(QSize(300, 300), 2, 20);
+
+    QPromise<bool> promise;
+    QFuture<bool> future = promise.future();
+    promise.start();
+    future.cancel();
+    SaveJobs::saveLayers(promise, QUrl::fromLocalFile(path), doc, QStringList(), true);
+    promise.finish();
+    QCOMPARE(future.resultCount(), 0);
+    QCOMPARE(readFile(path), QByteArray("previous save"));
+    QCOMPARE(QDir(dir.path()).entryList(QDir::Files), QStringList{QStringLiteral("doc.ora")});
+}
+
+void TestSaveJobs::cancelledWhileRenderingWritesNothing() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("doc.ora"));
+    QVERIFY(writeFile(path, "previous save"));
+    // Large enough that rendering takes far longer than reacting to the first tile
+    const DocumentSnapshot doc = makeDocument(QSize(3000, 2000), 6, 400, 200);
+
+    QFuture<bool> future = QtConcurrent::run(&SaveJobs::saveLayers, QUrl::fromLocalFile(path), doc, QStringList(), true);
+    // Cancel once the first tile is done
+    while (future.progressValue() == 0 && !future.isFinished()) QThread::yieldCurrentThread();
+    QVERIFY(!future.isFinished());
+    future.cancel();
+    future.waitForFinished();
+    QVERIFY(future.isCanceled());
+    QCOMPARE(future.resultCount(), 0);
+    QCOMPARE(readFile(path), QByteArray("previous save"));
+    QCOMPARE(QDir(dir.path()).entryList(QDir::Files), QStringList{QStringLiteral("doc.ora")});
+}
+
+void TestSaveJobs::cancelledBeforeCommitWritesNothing() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("doc.ora"));
+    QVERIFY(writeFile(path, "previous save"));
+    const QList<QImage> layers{PixelOps::makeSurface(QSize(64, 64), Qt::red),
+                               PixelOps::makeSurface(QSize(64, 64), Qt::blue)};
+    const QStringList names{QStringLiteral("a"), QStringLiteral("b")};
+    const QList<bool> visible{true, true};
+
+    // Steps: two layers, merged image and thumbnail, writing the file. Giving up at
+    // any of them, the last one included, leaves the previous file alone.
+    for (int stopAt = 1; stopAt <= 4; ++stopAt) {
+        OraCreator creator;
+        QThread *const caller = QThread::currentThread();
+        int calls = 0;
+        bool onCaller = true;
+        const bool ok = creator.saveOraMulti(path, layers, names, visible, QList<qreal>(), [&](int done, int total) {
+            onCaller = onCaller && QThread::currentThread() == caller;
+            ++calls;
+            return !(done == stopAt && total == 4);
+        });
+        QVERIFY(!ok);
+        QVERIFY(onCaller);
+        QCOMPARE(calls, stopAt);
+        QCOMPARE(readFile(path), QByteArray("previous save"));
+        QCOMPARE(QDir(dir.path()).entryList(QDir::Files), QStringList{QStringLiteral("doc.ora")});
+    }
+}
+
+QTEST_MAIN(TestSaveJobs)
+#include "tst_savejobs.moc"
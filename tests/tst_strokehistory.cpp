@@ -0,0 +1,154 @@
+#include <QtTest>
+#include "StrokeHistory.h"
+
+namespace {
+
+StrokeHistory::Command addStroke(quint64 layerUid, int index) {
+    StrokeHistory::Command command;
+    command.kind = StrokeHistory::Command::AddStroke;
+    command.layerUid = layerUid;
+    command.index = index;
+    return command;
+}
+
+BrushStroke strokeOf(int points) {
+    BrushStroke stroke;
+    stroke.color = Qt::black;
+    stroke.size = 4.0f;
+    for (int i = 0; i < points; ++i) stroke.points.append(QVector2D(float(i), 0.0f));
+    return stroke;
+}
+
+// What one command without stroke data costs
+qint64 emptyCommandBytes() {
+    StrokeHistory history;
+    history.push(addStroke(1, 0));
+    return history.bytesUsed();
+}
+
+} // namespace
+
+class TestStrokeHistory : public QObject {
+    Q_OBJECT
+
+private slots:
+    void countsUndoAndRedo();
+    void pushDropsRedo();
+    void evictsOldestFirst();
+    void keepsRedoOverUndo();
+    void countsRemovedCommands();
+    void countsClearedStrokes();
+};
+
+void TestStrokeHistory::countsUndoAndRedo() {
+    const qint64 base = emptyCommandBytes();
+    StrokeHistory history;
+    for (int i = 0; i < 3; ++i) history.push(addStroke(1, i));
+    QCOMPARE(history.bytesUsed(), 3 * base);
+    // Undoing an added stroke keeps it for redo
+    history.undoCommand()->stroke = strokeOf(10);
+    history.undone();
+    QCOMPARE(history.bytesUsed(), 3 * base + 10 * qint64(sizeof(QVector2D)));
+    history.undoCommand()->stroke = strokeOf(5);
+    history.undone();
+    QCOMPARE(history.bytesUsed(), 3 * base + 15 * qint64(sizeof(QVector2D)));
+    // Redoing gives it back to the layer
+    history.redoCommand()->stroke = BrushStroke{};
+    history.redone();
+    QCOMPARE(history.bytesUsed(), 3 * base + 10 * qint64(sizeof(QVector2D)));
+    history.redoCommand()->stroke = BrushStroke{};
+    history.redone();
+    QCOMPARE(history.bytesUsed(), 3 * base);
+    QVERIFY(!history.canRedo());
+}
+
+void TestStrokeHistory::pushDropsRedo() {
+    const qint64 base = emptyCommandBytes();
+    StrokeHistory history;
+    for (int i = 0; i < 3; ++i) history.push(addStroke(1, i));
+    for (int i = 0; i < 2; ++i) {
+        history.undoCommand()->stroke = strokeOf(100);
+        history.undone();
+    }
+    history.push(addStroke(1, 1));
+    QVERIFY(!history.canRedo());
+    QCOMPARE(history.bytesUsed(), 2 * base);
+}
+
+void TestStrokeHistory::evictsOldestFirst() {
+    const qint64 base = emptyCommandBytes();
+    StrokeHistory history(3 * base);
+    for (int i = 0; i < 5; ++i) history.push(addStroke(1, i));
+    QCOMPARE(history.bytesUsed(), 3 * base);
+    // The three newest are left
+    QCOMPARE(history.undoCommand()->index, 4);
+    for (int i = 0; i < 3; ++i) {
+        QVERIFY(history.canUndo());
+        history.undone();
+    }
+    QVERIFY(!history.canUndo());
+    QCOMPARE(history.redoCommand()->index, 2);
+    // A smaller limit evicts right away
+    history.setLimit(base);
+    QCOMPARE(history.bytesUsed(), base);
+}
+
+void TestStrokeHistory::keepsRedoOverUndo() {
+    const qint64 base = emptyCommandBytes();
+    const qint64 point = qint64(sizeof(QVector2D));
+    StrokeHistory history(3 * base + 50 * point);
+    for (int i = 0; i < 3; ++i) history.push(addStroke(1, i));
+    // Keeping the undone stroke pushes the history over its limit: the oldest
+    // undoable command goes, not the one that was just undone
+    history.undoCommand()->stroke = strokeOf(60);
+    history.undone();
+    QCOMPARE(history.bytesUsed(), 2 * base + 60 * point);
+    QCOMPARE(history.redoCommand()->index, 2);
+    QCOMPARE(history.undoCommand()->index, 1);
+}
+
+void TestStrokeHistory::countsRemovedCommands() {
+    const qint64 base = emptyCommandBytes();
+    StrokeHistory history;
+    for (int i = 0; i < 4; ++i) {
+        history.push(addStroke(1, i));
+        history.push(addStroke(2, i));
+    }
+    history.undoCommand()->stroke = strokeOf(8);
+    history.undone(); // layer 2, index 3
+    history.removeLayer(2);
+    QCOMPARE(history.bytesUsed(), 4 * base);
+    QVERIFY(!history.canRedo());
+    // Baking strokes [0, 2) of layer 1 drops the commands that added them
+    history.strokesBaked(1, 2);
+    QCOMPARE(history.bytesUsed(), 2 * base);
+    QCOMPARE(history.undoCommand()->index, 1);
+    history.undone();
+    QCOMPARE(history.undoCommand()->index, 0);
+}
+
+void TestStrokeHistory::countsClearedStrokes() {
+    const qint64 base = emptyCommandBytes();
+    StrokeList strokes;
+    strokes.append(strokeOf(7));
+    strokes.append(strokeOf(3));
+    StrokeHistory history;
+    StrokeHistory::Command command;
+    command.kind = StrokeHistory::Command::ClearStrokes;
+    command.layerUid = 1;
+    command.cleared = strokes;
+    history.push(std::move(command));
+    QCOMPARE(history.bytesUsed(), base + 10 * qint64(sizeof(QVector2D)));
+    // Undoing a clear gives the strokes back to the layer
+    history.undoCommand()->cleared = StrokeList();
+    history.undone();
+    QCOMPARE(history.bytesUsed(), base);
+    history.redoCommand()->cleared = strokes;
+    history.redone();
+    QCOMPARE(history.bytesUsed(), base + 10 * qint64(sizeof(QVector2D)));
+    history.clear();
+    QCOMPARE(history.bytesUsed(), qint64(0));
+}
+
+QTEST_APPLESS_MAIN(TestStrokeHistory)
+#include "tst_strokehistory.moc"
@@ -0,0 +1,99 @@
+#include <QtTest>
+#include <cmath>
+#include "StrokePredictor.h"
+
+namespace {
+
+constexpr float Horizon = 16.0f;
+
+// Pointer on a circle of radius 100 px, one turn per second
+QVector2D circleAt(double ms) {
+    const double a = 2.0 * M_PI * ms / 1000.0;
+    return QVector2D(float(200.0 + 100.0 * std::cos(a)), float(200.0 + 100.0 * std::sin(a)));
+}
+
+} // namespace
+
+class TestStrokePredictor : public QObject {
+    Q_OBJECT
+
+private slots:
+    void predictsAlongMotion();
+    void emptyAfterStall();
+    void emptyAcrossSampleGap();
+    void emptyForStillPointer();
+    void followsCurve_data();
+    void followsCurve();
+};
+
+void TestStrokePredictor::predictsAlongMotion() {
+    StrokePredictor predictor;
+    for (int i = 0; i < 4; ++i) predictor.addSample(InputSample{QVector2D(10.0f * i, 0.0f), 1.0f, quint64(1000 + 10 * i)});
+    const QList<QVector2D> tail = predictor.predict(Horizon, 1030);
+    QVERIFY(!tail.isEmpty());
+    // 1 px/ms along x, starting from the newest sample at x = 30
+    QCOMPARE(tail.last().x(), 30.0f + Horizon);
+    QCOMPARE(tail.last().y(), 0.0f);
+}
+
+void TestStrokePredictor::emptyAfterStall() {
+    StrokePredictor predictor;
+    for (int i = 0; i < 4; ++i) predictor.addSample(InputSample{QVector2D(10.0f * i, 0.0f), 1.0f, quint64(1000 + 10 * i)});
+    // The pen stops at 1030 and sends nothing more: the tail shrinks to nothing once
+    // the newest sample is StaleMs old
+    QVERIFY(!predictor.isStale(1030));
+    QVERIFY(!predictor.predict(Horizon, 1030 + quint64(StrokePredictor::StaleMs)).isEmpty());
+    QVERIFY(predictor.isStale(1031 + quint64(StrokePredictor::StaleMs)));
+    QVERIFY(predictor.predict(Horizon, 1031 + quint64(StrokePredictor::StaleMs)).isEmpty());
+    QVERIFY(predictor.predict(Horizon, 5000).isEmpty());
+    // and comes back with the next movement
+    predictor.addSample(InputSample{QVector2D(40.0f, 0.0f), 1.0f, 5000});
+    predictor.addSample(InputSample{QVector2D(50.0f, 0.0f), 1.0f, 5010});
+    QVERIFY(!predictor.predict(Horizon, 5010).isEmpty());
+}
+
+void TestStrokePredictor::emptyAcrossSampleGap() {
+    StrokePredictor predictor;
+    predictor.addSample(InputSample{QVector2D(0.0f, 0.0f), 1.0f, 1000});
+    predictor.addSample(InputSample{QVector2D(60.0f, 0.0f), 1.0f, 1060});
+    QVERIFY(predictor.predict(Horizon, 1060).isEmpty());
+}
+
+void TestStrokePredictor::emptyForStillPointer() {
+    StrokePredictor predictor;
+    QVERIFY(predictor.predict(Horizon, 0).isEmpty());
+    for (int i = 0; i < 4; ++i) predictor.addSample(InputSample{QVector2D(5.0f, 5.0f), 1.0f, quint64(1000 + 8 * i)});
+    QVERIFY(predictor.predict(Horizon, 1024).isEmpty());
+}
+
+void TestStrokePredictor::followsCurve_data() {
+    QTest::addColumn<int>("intervalMs");
+    QTest::addColumn<float>("maxMeanError");
+    // Without prediction the tail would lag Horizon ms behind: about 10 px here
+    QTest::newRow("120 Hz") << 8 << 2.0f;
+    QTest::newRow("1000 Hz") << 1 << 0.5f;
+}
+
+void TestStrokePredictor::followsCurve() {
+    QFETCH(int, intervalMs);
+    QFETCH(float, maxMeanError);
+    StrokePredictor predictor;
+    double sum = 0.0;
+    float lag = 0.0f;
+    int predictions = 0;
+    for (int ms = 0; ms <= 1000; ms += intervalMs) {
+        predictor.addSample(InputSample{circleAt(ms), 1.0f, quint64(ms)});
+        const QList<QVector2D> tail = predictor.predict(Horizon, quint64(ms));
+        if (tail.isEmpty()) continue;
+        sum += (tail.last() - circleAt(ms + Horizon)).length();
+        lag = (circleAt(ms) - circleAt(ms + Horizon)).length();
+        ++predictions;
+    }
+    QVERIFY(predictions > 0);
+    const double mean = sum / predictions;
+    QVERIFY2(mean < maxMeanError, qPrintable(QStringLiteral("mean error %1 px").arg(mean)));
+    QVERIFY(mean < lag);
+}
+
+QTEST_APPLESS_MAIN(TestStrokePredictor)
+#include "tst_strokepredictor.moc"
@@ -0,0 +1,115 @@
+#include <QtTest>
+#include "PixelOps.h"
+#include "RasterEngine.h"
+#include "StrokeRasterizer.h"
+#include "TestDocument.h"
+#include "TileCheckpoints.h"
+
+namespace {
+
+constexpr quint64 LayerUid = 7;
+
+// Stamp the strokes of `layer` one by one onto `surface` the way the CPU backend does,
+// saving a checkpoint before each
+void stampWithCheckpoints(TileCheckpoints &checkpoints, QImage &surface, const LayerSnapshot &layer,
+                          StrokeRasterizer::DabCache &cache) {
+    const StrokeList &strokes = layer.strokes;
+    for (int i = 0; i < strokes.size(); ++i) {
+        const auto dabs = StrokeRasterizer::dabsFor(strokes, i, 1.0f, &cache);
+        checkpoints.save(LayerUid, strokes.idAt(i), i > 0 ? strokes.idAt(i - 1) : 0, surface, *dabs);
+        StrokeRasterizer::rasterizeStrokes(surface, strokes, QList<int>{i}, surface.rect(), 1.0f, &cache);
+    }
+}
+
+quint64 idBelow(const StrokeList &strokes, int count) {
+    return count > 0 ? strokes.idAt(count - 1) : 0;
+}
+
+} // namespace
+
+class TestTileCheckpoints : public QObject {
+    Q_OBJECT
+
+private slots:
+    void restoreMatchesRerender();
+    void refusesStrokesNotOnTop();
+    void evictsOldestOverBudget();
+};
+
+void TestTileCheckpoints::restoreMatchesRerender() {
+    // Not a multiple of the tile size, strokes reaching past every edge
+    const QSize size(301, 187);
+    const auto layer = makeLayer(size, 12, 30, 3);
+    const StrokeList &strokes = layer->strokes;
+    StrokeRasterizer::DabCache cache;
+    TileCheckpoints checkpoints;
+    QImage surface = PixelOps::makeSurface(size);
+    stampWithCheckpoints(checkpoints, surface, *layer, cache);
+    QCOMPARE(surface, RasterEngine::renderLayer(QImage(), strokes, size));
+
+    // Undo one stroke, then three at once: the same pixels as rendering what is left
+    int count = int(strokes.size());
+    for (int undo : {1, 3}) {
+        QRect restored;
+        QVERIFY(checkpoints.restore(LayerUid, undo, strokes.idAt(count - 1), idBelow(strokes, count - undo), surface, restored));
+        count -= undo;
+        QVERIFY(!restored.isEmpty());
+        QCOMPARE(surface, RasterEngine::renderLayer(QImage(), strokes, size, count));
+    }
+    // Down to the empty layer, and nothing is kept after that
+    QRect restored;
+    QVERIFY(checkpoints.restore(LayerUid, count, strokes.idAt(count - 1), 0, surface, restored));
+    QCOMPARE(surface, PixelOps::makeSurface(size));
+    QCOMPARE(checkpoints.bytesUsed(), qint64(0));
+}
+
+void TestTileCheckpoints::refusesStrokesNotOnTop() {
+    const QSize size(200, 200);
+    const auto layer = makeLayer(size, 5, 20, 4);
+    const StrokeList &strokes = layer->strokes;
+    StrokeRasterizer::DabCache cache;
+    TileCheckpoints checkpoints;
+    QImage surface = PixelOps::makeSurface(size);
+    stampWithCheckpoints(checkpoints, surface, *layer, cache);
+    const QImage stamped = surface;
+
+    QRect restored;
+    // Not the newest stroke, a wrong stroke below, more strokes than kept, another layer
+    QVERIFY(!checkpoints.restore(LayerUid, 1, strokes.idAt(3), strokes.idAt(2), surface, restored));
+    QVERIFY(!checkpoints.restore(LayerUid, 2, strokes.idAt(4), strokes.idAt(1), surface, restored));
+    QVERIFY(!checkpoints.restore(LayerUid, 6, strokes.idAt(4), 0, surface, restored));
+    QVERIFY(!checkpoints.restore(LayerUid + 1, 1, strokes.idAt(4), strokes.idAt(3), surface, restored));
+    QCOMPARE(surface, stamped);
+    QVERIFY(restored.isEmpty());
+    // Dropped with the layer
+    checkpoints.dropLayer(LayerUid);
+    QCOMPARE(checkpoints.bytesUsed(), qint64(0));
+    QVERIFY(!checkpoints.restore(LayerUid, 1, strokes.idAt(4), strokes.idAt(3), surface, restored));
+}
+
+void TestTileCheckpoints::evictsOldestOverBudget() {
+    const QSize size(256, 256);
+    const auto layer = makeLayer(size, 8, 20, 5);
+    const StrokeList &strokes = layer->strokes;
+    StrokeRasterizer::DabCache cache;
+    TileCheckpoints unlimited;
+    QImage surface = PixelOps::makeSurface(size);
+    stampWithCheckpoints(unlimited, surface, *layer, cache);
+
+    // One byte short of keeping them all: the oldest goes, the newest can still be undone
+    const qint64 budget = unlimited.bytesUsed() - 1;
+    TileCheckpoints checkpoints(budget);
+    surface = PixelOps::makeSurface(size);
+    stampWithCheckpoints(checkpoints, surface, *layer, cache);
+    QVERIFY(checkpoints.bytesUsed() <= budget);
+    QRect restored;
+    QVERIFY(!checkpoints.restore(LayerUid, 8, strokes.idAt(7), 0, surface, restored));
+    QVERIFY(checkpoints.restore(LayerUid, 1, strokes.idAt(7), strokes.idAt(6), surface, restored));
+    QCOMPARE(surface, RasterEngine::renderLayer(QImage(), strokes, size, 7));
+    // A smaller budget evicts right away
+    checkpoints.setBudget(0);
+    QCOMPARE(checkpoints.bytesUsed(), qint64(0));
+}
+
+QTEST_APPLESS_MAIN(TestTileCheckpoints)
+#include "tst_tilecheckpoints.moc"